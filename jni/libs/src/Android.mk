@@ -56,10 +56,13 @@ LOCAL_SRC_FILES := \
   $(subst $(LOCAL_PATH)/,,$(DEPENDENCIES_SDL_DIR))/src/main/android/SDL_android_main.c \
   $(PIE_NOON_RELATIVE_DIR)/src/ai_controller.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/analytics_tracking.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/asset_archive.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/asset_file.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/async_loader.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/cardboard_controller.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/character.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/character_state_machine.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/compressed_texture.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/controller.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/components/drip_and_vanish.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/components/player_character.cpp \
@@ -67,6 +70,7 @@ LOCAL_SRC_FILES := \
   $(PIE_NOON_RELATIVE_DIR)/src/components/shakeable_prop.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/entity/entity_manager.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/font_manager.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/frustum.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/full_screen_fader.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/gamepad_controller.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/game_camera.cpp \
@@ -89,13 +93,16 @@ LOCAL_SRC_FILES := \
   $(PIE_NOON_RELATIVE_DIR)/src/renderer_android.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/shader.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/pie_noon_game.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/pixel_conversion.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/touchscreen_button.cpp \
   $(PIE_NOON_RELATIVE_DIR)/src/touchscreen_controller.cpp \
-  $(PIE_NOON_RELATIVE_DIR)/src/utilities.cpp
+  $(PIE_NOON_RELATIVE_DIR)/src/utilities.cpp \
+  $(PIE_NOON_RELATIVE_DIR)/src/worker_thread.cpp
 
 PIE_NOON_SCHEMA_DIR := $(PIE_NOON_DIR)/src/flatbufferschemas
 
 PIE_NOON_SCHEMA_FILES := \
+  $(PIE_NOON_SCHEMA_DIR)/asset_archive.fbs \
   $(PIE_NOON_SCHEMA_DIR)/character_state_machine_def.fbs \
   $(PIE_NOON_SCHEMA_DIR)/config.fbs \
   $(PIE_NOON_SCHEMA_DIR)/components.fbs \
@@ -104,6 +111,7 @@ PIE_NOON_SCHEMA_FILES := \
   $(PIE_NOON_SCHEMA_DIR)/particles.fbs \
   $(PIE_NOON_SCHEMA_DIR)/pie_noon_common.fbs \
   $(PIE_NOON_SCHEMA_DIR)/scoring_rules.fbs \
+  $(PIE_NOON_SCHEMA_DIR)/texture_atlas.fbs \
   $(PIE_NOON_SCHEMA_DIR)/timeline.fbs
 
 # Make each source file dependent upon the assets
@@ -17,21 +17,36 @@
 
 Finds the flatbuffer compiler and cwebp tool and then uses them to convert the
 JSON files to flatbuffer binary files and the png files to webp files so that
-they can be loaded by the game. This script also includes various 'make' style
-rules. If you just want to build the flatbuffer binaries you can pass
-'flatbuffer' as an argument, or if you want to just build the webp files you can
-pass 'cwebp' as an argument. Additionally, if you would like to clean all
-generated files, you can call this script with the argument 'clean'.
+they can be loaded by the game. Textures listed in src/rawassets/atlases are
+additionally packed into texture atlases. This script also includes various
+'make' style rules. If you just want to build the flatbuffer binaries you can
+pass 'flatbuffer' as an argument, or if you want to just build the webp files
+you can pass 'cwebp' as an argument, or 'atlases' for just the texture atlases.
+Passing 'ktx' additionally compresses opaque textures to ETC1 KTX files with
+precomputed mip levels, which the game prefers over the webp files when
+present. That needs the EtcTool binary from etc2comp, so isn't part of 'all'.
+Additionally, if you would like to clean all generated files, you can call this
+script with the argument 'clean'.
 """
 
 import argparse
 import distutils.spawn
 import glob
+import json
 import os
 import platform
 import shutil
+import struct
 import subprocess
 import sys
+import tempfile
+
+# PIL is only needed to build texture atlases. Without it, atlases are skipped
+# and the game falls back to the individual textures.
+try:
+  from PIL import Image
+except ImportError:
+  Image = None
 
 # The project root directory, which is one level up from this script's
 # directory.
@@ -79,6 +94,15 @@ CWEBP_PATHS = [
     os.path.dirname(CWEBP_BINARY_IN_PATH) if CWEBP_BINARY_IN_PATH else '',
 ]
 
+# Directory that contains the EtcTool binary from etc2comp.
+ETCTOOL_BINARY_IN_PATH = distutils.spawn.find_executable('EtcTool')
+ETCTOOL_PATHS = [
+    os.path.join(PROJECT_ROOT, 'bin'),
+    os.path.join(PROJECT_ROOT, 'bin', 'Release'),
+    os.path.join(PROJECT_ROOT, 'bin', 'Debug'),
+    os.path.dirname(ETCTOOL_BINARY_IN_PATH) if ETCTOOL_BINARY_IN_PATH else '',
+]
+
 # Directory to place processed assets.
 ASSETS_PATH = os.path.join(PROJECT_ROOT, 'assets')
 
@@ -97,6 +121,9 @@ RAW_MATERIAL_PATH = os.path.join(RAW_ASSETS_PATH, 'materials')
 # Directory where unprocessed textures can be found.
 RAW_TEXTURE_PATH = os.path.join(RAW_ASSETS_PATH, 'textures')
 
+# Directory where texture atlas definitions can be found.
+RAW_ATLAS_PATH = os.path.join(RAW_ASSETS_PATH, 'atlases')
+
 # Directory where unprocessed assets can be found.
 SCHEMA_PATHS = [
     os.path.join(PROJECT_ROOT, 'src', 'flatbufferschemas'),
@@ -113,6 +140,9 @@ FLATC_EXECUTABLE_NAME = 'flatc' + EXECUTABLE_EXTENSION
 # Name of the cwebp executable.
 CWEBP_EXECUTABLE_NAME = 'cwebp' + EXECUTABLE_EXTENSION
 
+# Name of the EtcTool executable.
+ETCTOOL_EXECUTABLE_NAME = 'EtcTool' + EXECUTABLE_EXTENSION
+
 # What level of quality we want to apply to the webp files.
 # Ranges from 0 to 100.
 WEBP_QUALITY = 90
@@ -180,12 +210,44 @@ def processed_texture_path(path, target_directory):
 # PNG files to convert to webp.
 PNG_TEXTURES = glob.glob(os.path.join(RAW_TEXTURE_PATH, '*.png'))
 
+# Texture atlas definitions. Each is a json file with the list of png
+# `textures` to pack, the maximum `page_size` and the `padding` in pixels
+# around each texture.
+TEXTURE_ATLASES = glob.glob(os.path.join(RAW_ATLAS_PATH, '*.json'))
+
+# Schema of the texture atlas binaries we generate.
+TEXTURE_ATLAS_SCHEMA = find_in_paths('texture_atlas.fbs', SCHEMA_PATHS)
+
 # Location of FlatBuffers compiler.
 FLATC = find_in_paths(FLATC_EXECUTABLE_NAME, FLATBUFFERS_PATHS)
 
 # Location of webp compression tool.
 CWEBP = find_in_paths(CWEBP_EXECUTABLE_NAME, CWEBP_PATHS)
 
+# Location of the ETC compression tool.
+ETCTOOL = find_in_paths(ETCTOOL_EXECUTABLE_NAME, ETCTOOL_PATHS)
+
+# Number of mip levels to ask EtcTool for. It stops at 1x1 by itself.
+KTX_MIP_LEVELS = 16
+
+# Name of the asset archive, relative to the target assets directory.
+ASSET_ARCHIVE_NAME = 'assets.pak'
+
+# Schema of the asset archive index.
+ASSET_ARCHIVE_SCHEMA = find_in_paths('asset_archive.fbs', SCHEMA_PATHS)
+
+# Assets in the order the game first uses them, to lay the archive out in.
+ASSET_ARCHIVE_LOAD_ORDER = os.path.join(RAW_ASSETS_PATH,
+                                        'archive_load_order.txt')
+
+# Extensions of the files the game loads through its own file functions, and
+# can thus find in the archive. Sounds are loaded by the audio engine.
+ASSET_ARCHIVE_EXTENSIONS = ('.bin', '.glslf', '.glslv', '.ktx', '.otf', '.ttf',
+                            '.webp')
+
+# File contents in the archive start at multiples of this many bytes.
+ASSET_ARCHIVE_ALIGNMENT = 16
+
 
 class BuildError(Exception):
   """Error indicating there was a problem building assets."""
@@ -242,6 +304,59 @@ def convert_png_image_to_webp(png, out, quality=80):
   run_subprocess(command)
 
 
+def png_has_alpha(png):
+  """Checks whether a png file has an alpha channel or transparent pixels.
+
+  Args:
+    png: The path to the png file.
+
+  Returns:
+    True if the color type has alpha, or there's a transparency chunk.
+  """
+  with open(png, 'rb') as f:
+    data = f.read()
+  # Chunks follow the 8 byte signature: a 4 byte big endian length, a 4 byte
+  # type, the data and a 4 byte CRC. IHDR comes first, with the color type at
+  # offset 9 of its data.
+  color_type = ord(data[25:26])
+  if color_type in (4, 6):
+    return True
+  offset = 8
+  while offset + 8 <= len(data):
+    length = struct.unpack('>I', data[offset:offset + 4])[0]
+    chunk_type = data[offset + 4:offset + 8]
+    if chunk_type == b'tRNS':
+      return True
+    if chunk_type == b'IDAT':
+      return False
+    offset += 12 + length
+  return False
+
+
+def processed_ktx_path(path, target_directory):
+  """Take the path to a raw png asset and convert it to target ktx path.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  return path.replace(RAW_ASSETS_PATH, target_directory).replace('png', 'ktx')
+
+
+def convert_png_image_to_ktx(png, out):
+  """Compress the given png file to ETC1, with all its mip levels.
+
+  Args:
+    png: The path to the png file to compress.
+    out: The path of the ktx file to write to.
+
+  Raises:
+    BuildError: Process return code was nonzero.
+  """
+  command = [ETCTOOL, png, '-format', 'ETC1', '-mipmaps', str(KTX_MIP_LEVELS),
+             '-output', out]
+  run_subprocess(command)
+
+
 def needs_rebuild(source, target):
   """Checks if the source file needs to be rebuilt.
 
@@ -300,6 +415,313 @@ def generate_webp_textures(target_directory):
     if needs_rebuild(png, out):
       convert_png_image_to_webp(png, out, WEBP_QUALITY)
 
+
+def generate_ktx_textures(target_directory):
+  """Compress the opaque png files to ETC1 ktx files.
+
+  ETC1 has no alpha, so textures with alpha are left alone. The game keeps
+  using their webp files.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  for png in PNG_TEXTURES:
+    if png_has_alpha(png):
+      continue
+    out = processed_ktx_path(png, target_directory)
+    out_dir = os.path.dirname(out)
+    if not os.path.exists(out_dir):
+      os.makedirs(out_dir)
+    if needs_rebuild(png, out):
+      convert_png_image_to_ktx(png, out)
+
+
+def next_power_of_two(value):
+  """Returns the smallest power of two that is greater or equal to value."""
+  power = 1
+  while power < value:
+    power *= 2
+  return power
+
+
+def pack_atlas_pages(sizes, page_size, padding):
+  """Packs rectangles onto as few atlas pages as possible.
+
+  Uses a simple shelf packer: rectangles are placed left to right in order of
+  decreasing height, starting a new shelf when a row is full, and a new page
+  when a page is full.
+
+  Args:
+    sizes: List of (width, height) tuples of the rectangles to pack.
+    page_size: Maximum width and height of a page.
+    padding: Number of pixels to keep free around each rectangle.
+
+  Returns:
+    A tuple (placements, page_sizes). placements holds a (page, x, y) tuple for
+    each of the rectangles in sizes, where (x, y) is the top left of its padded
+    area. page_sizes holds the (width, height) of each page, which are the
+    smallest powers of two that fit the page's contents.
+
+  Raises:
+    ValueError: A rectangle is too big to fit on a page.
+  """
+  placements = [None] * len(sizes)
+  page_extents = []
+  x = y = shelf_height = page_size
+  for index in sorted(range(len(sizes)), key=lambda i: -sizes[i][1]):
+    width = sizes[index][0] + 2 * padding
+    height = sizes[index][1] + 2 * padding
+    if width > page_size or height > page_size:
+      raise ValueError('%dx%d texture does not fit on a %d page' %
+                       (sizes[index][0], sizes[index][1], page_size))
+    if x + width > page_size:
+      x = 0
+      y += shelf_height
+      shelf_height = height
+    if y + height > page_size:
+      page_extents.append([0, 0])
+      x = y = 0
+      shelf_height = height
+    placements[index] = (len(page_extents) - 1, x, y)
+    extent = page_extents[-1]
+    extent[0] = max(extent[0], x + width)
+    extent[1] = max(extent[1], y + height)
+    x += width
+  page_sizes = [(next_power_of_two(w), next_power_of_two(h))
+                for w, h in page_extents]
+  return placements, page_sizes
+
+
+def paste_with_gutter(page, image, x, y, padding):
+  """Pastes image onto page, replicating its edges into the padding.
+
+  Filling the gutter with the edge pixels stops bilinear filtering and the
+  smaller mipmap levels from picking up texels of neighbouring textures.
+
+  Args:
+    page: The atlas page image to paste into.
+    image: The image to paste.
+    x: Left edge of the padded area on the page.
+    y: Top edge of the padded area on the page.
+    padding: Width of the gutter around the image, in pixels.
+  """
+  width, height = image.size
+  padded = Image.new('RGBA', (width + 2 * padding, height + 2 * padding))
+  padded.paste(image, (padding, padding))
+  top_row = image.crop((0, 0, width, 1))
+  bottom_row = image.crop((0, height - 1, width, height))
+  for i in range(padding):
+    padded.paste(top_row, (padding, i))
+    padded.paste(bottom_row, (padding, padding + height + i))
+  left_column = padded.crop((padding, 0, padding + 1, height + 2 * padding))
+  right_column = padded.crop((padding + width - 1, 0, padding + width,
+                              height + 2 * padding))
+  for i in range(padding):
+    padded.paste(left_column, (i, 0))
+    padded.paste(right_column, (padding + width + i, 0))
+  page.paste(padded, (x, y))
+
+
+def atlas_page_path(atlas_name, page):
+  """Returns the path of an atlas page texture, relative to the assets."""
+  return 'textures/atlas_%s_%d.webp' % (atlas_name, page)
+
+
+def generate_texture_atlas(flatc, atlas_json, target_directory):
+  """Packs the textures listed in an atlas definition into atlas pages.
+
+  Writes the pages as webp textures, and a flatbuffer binary that maps the
+  original texture filenames onto their page and uv rectangle.
+
+  Args:
+    flatc: Path to the flatc binary.
+    atlas_json: Path to the atlas definition.
+    target_directory: Path to the target assets directory.
+
+  Raises:
+    BuildError: Packing or one of the conversion processes failed.
+  """
+  with open(atlas_json) as f:
+    definition = json.load(f)
+  sources = [os.path.join(RAW_ASSETS_PATH, texture)
+             for texture in definition['textures']]
+  page_size = definition.get('page_size', 2048)
+  padding = definition.get('padding', 4)
+
+  images = [Image.open(source).convert('RGBA') for source in sources]
+  try:
+    placements, page_sizes = pack_atlas_pages(
+        [image.size for image in images], page_size, padding)
+  except ValueError as e:
+    raise BuildError([atlas_json], 1, message=str(e))
+  pages = [Image.new('RGBA', size, (0, 0, 0, 0)) for size in page_sizes]
+
+  entries = []
+  for texture, image, (page, x, y) in zip(definition['textures'], images,
+                                          placements):
+    paste_with_gutter(pages[page], image, x, y, padding)
+    page_width, page_height = page_sizes[page]
+    width, height = image.size
+    entries.append({
+        'texture_filename': texture.replace('.png', '.webp'),
+        'page': page,
+        'uv': {
+            'left': float(x + padding) / page_width,
+            'top': float(y + padding) / page_height,
+            'right': float(x + padding + width) / page_width,
+            'bottom': float(y + padding + height) / page_height
+        }
+    })
+
+  atlas_name = os.path.splitext(os.path.basename(atlas_json))[0]
+  intermediate_directory = tempfile.mkdtemp()
+  try:
+    for index, page in enumerate(pages):
+      png = os.path.join(intermediate_directory, '%d.png' % index)
+      page.save(png)
+      out = os.path.join(target_directory, atlas_page_path(atlas_name, index))
+      if not os.path.exists(os.path.dirname(out)):
+        os.makedirs(os.path.dirname(out))
+      convert_png_image_to_webp(png, out, WEBP_QUALITY)
+
+    description = os.path.join(intermediate_directory, atlas_name + '.json')
+    with open(description, 'w') as f:
+      json.dump({'pages': [atlas_page_path(atlas_name, i)
+                           for i in range(len(pages))],
+                 'entries': entries}, f, indent=2)
+    target_file_dir = os.path.dirname(
+        processed_json_path(atlas_json, target_directory))
+    if not os.path.exists(target_file_dir):
+      os.makedirs(target_file_dir)
+    convert_json_to_flatbuffer_binary(flatc, description, TEXTURE_ATLAS_SCHEMA,
+                                      target_file_dir)
+  finally:
+    shutil.rmtree(intermediate_directory)
+
+
+def generate_texture_atlases(flatc, target_directory):
+  """Builds all texture atlases whose definition or textures have changed.
+
+  Args:
+    flatc: Path to the flatc binary.
+    target_directory: Path to the target assets directory.
+  """
+  for atlas_json in TEXTURE_ATLASES:
+    target = processed_json_path(atlas_json, target_directory)
+    with open(atlas_json) as f:
+      textures = json.load(f)['textures']
+    dependencies = [atlas_json, TEXTURE_ATLAS_SCHEMA] + [
+        os.path.join(RAW_ASSETS_PATH, texture) for texture in textures]
+    if not any(needs_rebuild(source, target) for source in dependencies):
+      continue
+    if not Image:
+      sys.stderr.write('PIL not found, skipping texture atlas %s. The game '
+                       'will use the individual textures instead.\n' %
+                       atlas_json)
+      continue
+    generate_texture_atlas(flatc, atlas_json, target_directory)
+
+
+def asset_path_hash(path):
+  """Returns the 32 bit FNV-1a hash of path, as AssetArchive::HashPath does."""
+  value = 2166136261
+  for byte in bytearray(path.encode('utf-8')):
+    value = ((value ^ byte) * 16777619) & 0xffffffff
+  return value
+
+
+def align(value, alignment):
+  """Rounds value up to a multiple of alignment."""
+  return (value + alignment - 1) // alignment * alignment
+
+
+def archived_asset_paths(target_directory):
+  """Lists the assets to put in the archive, in the order to store them.
+
+  Args:
+    target_directory: Path to the target assets directory.
+
+  Returns:
+    Paths relative to target_directory, with forward slashes.
+  """
+  paths = []
+  for dirpath, _, files in os.walk(target_directory):
+    for name in files:
+      if os.path.splitext(name)[1] in ASSET_ARCHIVE_EXTENSIONS:
+        path = os.path.relpath(os.path.join(dirpath, name), target_directory)
+        paths.append(path.replace(os.sep, '/'))
+  ordered = []
+  if os.path.isfile(ASSET_ARCHIVE_LOAD_ORDER):
+    with open(ASSET_ARCHIVE_LOAD_ORDER) as f:
+      for line in f:
+        path = line.strip()
+        if not path or path.startswith('#'):
+          continue
+        # Textures look for their ktx version first.
+        if path.endswith('.webp'):
+          ordered.append(path.replace('.webp', '.ktx'))
+        ordered.append(path)
+  ordered = [path for path in ordered if path in paths]
+  return ordered + sorted(set(paths) - set(ordered))
+
+
+def generate_asset_archive(flatc, target_directory):
+  """Packs the assets into a single archive file, with an index.
+
+  See src/flatbufferschemas/asset_archive.fbs for the format. The individual
+  files are left in place, the game uses them if there's no archive.
+
+  Args:
+    flatc: Path to the flatc binary.
+    target_directory: Path to the target assets directory.
+
+  Raises:
+    BuildError: The flatbuffer conversion failed.
+  """
+  archive = os.path.join(target_directory, ASSET_ARCHIVE_NAME)
+  paths = archived_asset_paths(target_directory)
+  sources = [os.path.join(target_directory, path) for path in paths]
+  dependencies = sources + [ASSET_ARCHIVE_SCHEMA]
+  if os.path.isfile(ASSET_ARCHIVE_LOAD_ORDER):
+    dependencies.append(ASSET_ARCHIVE_LOAD_ORDER)
+  if not any(needs_rebuild(source, archive) for source in dependencies):
+    return
+
+  entries = []
+  offset = 0
+  for path, source in zip(paths, sources):
+    size = os.path.getsize(source)
+    entries.append({'path_hash': asset_path_hash(path), 'path': path,
+                    'offset': offset, 'size': size})
+    offset = align(offset + size, ASSET_ARCHIVE_ALIGNMENT)
+  entries.sort(key=lambda entry: (entry['path_hash'], entry['path']))
+
+  intermediate_directory = tempfile.mkdtemp()
+  try:
+    description = os.path.join(intermediate_directory, 'asset_archive.json')
+    with open(description, 'w') as f:
+      json.dump({'entries': entries}, f, indent=2)
+    convert_json_to_flatbuffer_binary(flatc, description, ASSET_ARCHIVE_SCHEMA,
+                                      intermediate_directory)
+    with open(os.path.join(intermediate_directory, 'asset_archive.bin'),
+              'rb') as f:
+      index = f.read()
+  finally:
+    shutil.rmtree(intermediate_directory)
+
+  with open(archive, 'wb') as out:
+    header = struct.pack('<I', len(index)) + index
+    out.write(header)
+    out.write(b'\0' * (align(len(header), ASSET_ARCHIVE_ALIGNMENT) -
+                       len(header)))
+    for source in sources:
+      with open(source, 'rb') as f:
+        data = f.read()
+      out.write(data)
+      out.write(b'\0' * (align(len(data), ASSET_ARCHIVE_ALIGNMENT) -
+                         len(data)))
+
+
 def copy_assets(target_directory):
   """Copy modified assets to the target assets directory.
 
@@ -333,6 +755,18 @@ def clean_webp_textures():
       os.remove(webp)
 
 
+def clean_ktx_textures(target_directory):
+  """Delete all the compressed ktx textures.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  for png in PNG_TEXTURES:
+    ktx = processed_ktx_path(png, target_directory)
+    if os.path.isfile(ktx):
+      os.remove(ktx)
+
+
 def clean_flatbuffer_binaries(target_directory):
   """Delete all the processed flatbuffer binaries.
 
@@ -346,10 +780,40 @@ def clean_flatbuffer_binaries(target_directory):
         os.remove(path)
 
 
+def clean_texture_atlases(target_directory):
+  """Delete all the generated texture atlases.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  for atlas_json in TEXTURE_ATLASES:
+    atlas_name = os.path.splitext(os.path.basename(atlas_json))[0]
+    paths = [processed_json_path(atlas_json, target_directory)] + glob.glob(
+        os.path.join(target_directory, atlas_page_path(atlas_name, 0)).replace(
+            '_0.webp', '_*.webp'))
+    for path in paths:
+      if os.path.isfile(path):
+        os.remove(path)
+
+
+def clean_asset_archive(target_directory):
+  """Delete the asset archive.
+
+  Args:
+    target_directory: Path to the target assets directory.
+  """
+  archive = os.path.join(target_directory, ASSET_ARCHIVE_NAME)
+  if os.path.isfile(archive):
+    os.remove(archive)
+
+
 def clean():
   """Delete all the processed files."""
   clean_flatbuffer_binaries()
   clean_webp_textures()
+  clean_texture_atlases(ASSETS_PATH)
+  clean_ktx_textures(ASSETS_PATH)
+  clean_asset_archive(ASSETS_PATH)
 
 
 def handle_build_error(error):
@@ -364,8 +828,11 @@ def main(argv):
   To build all assets, either call this script without any arguments. Or
   alternatively, call it with the argument 'all'. To just convert the
   flatbuffer json files, call it with 'flatbuffers'. Likewise to convert the
-  png files to webp files, call it with 'webp'. To clean all converted files,
-  call it with 'clean'.
+  png files to webp files, call it with 'webp', and to pack the texture atlases
+  call it with 'atlases'. To compress opaque textures to ETC1 ktx files, call
+  it with 'ktx'. To pack the built assets into a single archive, call it with
+  'archive' after building them; once it exists, the other targets update it
+  too. To clean all converted files, call it with 'clean'.
 
   Args:
     argv: The command line argument containing which command to run.
@@ -381,7 +848,8 @@ def main(argv):
   parser.add_argument('args', nargs=argparse.REMAINDER)
   args = parser.parse_args()
   target = args.args[1] if len(args.args) >= 2 else 'all'
-  if target not in ('all', 'flatbuffers', 'webp', 'clean'):
+  if target not in ('all', 'flatbuffers', 'webp', 'atlases', 'ktx', 'archive',
+                    'clean'):
     sys.stderr.write('No rule to build target %s.\n' % target)
 
   if target != 'clean':
@@ -398,6 +866,27 @@ def main(argv):
     except BuildError as error:
       handle_build_error(error)
       return 1
+  if target in ('all', 'atlases'):
+    try:
+      generate_texture_atlases(args.flatc, args.output)
+    except BuildError as error:
+      handle_build_error(error)
+      return 1
+  if target == 'ktx':
+    try:
+      generate_ktx_textures(args.output)
+    except BuildError as error:
+      handle_build_error(error)
+      return 1
+  # The game loads assets from the archive before the individual files, so
+  # keep an existing archive up to date with the files built above.
+  archive = os.path.join(args.output, ASSET_ARCHIVE_NAME)
+  if target == 'archive' or (target != 'clean' and os.path.isfile(archive)):
+    try:
+      generate_asset_archive(args.flatc, args.output)
+    except BuildError as error:
+      handle_build_error(error)
+      return 1
   if target == 'clean':
     try:
       clean()
@@ -0,0 +1,97 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "precompiled.h"
+#include "asset_archive.h"
+#include "asset_archive_generated.h"
+
+namespace fpl {
+
+// File contents start at a multiple of this, from the start of the archive.
+static const size_t kContentsAlignment = 16;
+
+bool AssetArchive::Open(const char *filename) {
+  index_ = nullptr;
+  if (!file_.Open(filename)) return false;
+  const uint8_t *archive = file_.data();
+  const size_t archive_size = file_.size();
+  if (archive_size < sizeof(uint32_t)) return false;
+  const size_t index_size = flatbuffers::ReadScalar<uint32_t>(archive);
+  const size_t contents_start =
+      (sizeof(uint32_t) + index_size + kContentsAlignment - 1) &
+      ~(kContentsAlignment - 1);
+  if (contents_start > archive_size) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "%s: truncated asset archive",
+                 filename);
+    file_.Close();
+    return false;
+  }
+  const uint8_t *index = archive + sizeof(uint32_t);
+  flatbuffers::Verifier verifier(index, index_size);
+  if (!archivedef::VerifyAssetArchiveBuffer(verifier)) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "%s: corrupt asset archive index",
+                 filename);
+    file_.Close();
+    return false;
+  }
+  index_ = archivedef::GetAssetArchive(index);
+  contents_ = archive + contents_start;
+  contents_size_ = archive_size - contents_start;
+  return true;
+}
+
+bool AssetArchive::Find(const char *path, const uint8_t **data,
+                        size_t *size) const {
+  if (!index_) return false;
+  const uint32_t hash = HashPath(path);
+  auto entries = index_->entries();
+  // Binary search for the first entry with this hash, then check the path to
+  // rule out collisions.
+  flatbuffers::uoffset_t lo = 0, hi = entries->size();
+  while (lo < hi) {
+    const flatbuffers::uoffset_t mid = lo + (hi - lo) / 2;
+    if (entries->Get(mid)->path_hash() < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  for (; lo < entries->size() && entries->Get(lo)->path_hash() == hash; lo++) {
+    auto entry = entries->Get(lo);
+    if (strcmp(entry->path()->c_str(), path)) continue;
+    if (entry->compression() != archivedef::Compression_None ||
+        static_cast<size_t>(entry->offset()) + entry->size() >
+            contents_size_) {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR, "%s: bad asset archive entry",
+                   path);
+      return false;
+    }
+    *data = contents_ + entry->offset();
+    *size = entry->size();
+    return true;
+  }
+  return false;
+}
+
+uint32_t AssetArchive::HashPath(const char *path) {
+  uint32_t hash = 2166136261u;
+  for (; *path; path++) {
+    hash ^= static_cast<uint8_t>(*path);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+}  // namespace fpl
@@ -0,0 +1,59 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FPL_ASSET_ARCHIVE_H
+#define FPL_ASSET_ARCHIVE_H
+
+#include "asset_file.h"
+#include "common.h"
+
+namespace archivedef {
+struct AssetArchive;
+}
+
+namespace fpl {
+
+// A single file holding many assets, with an index to find them by path.
+// Built by scripts/build_assets.py, see asset_archive.fbs for the layout.
+// Assets are stored in the order the game first uses them, so that loading
+// reads through the archive front to back.
+class AssetArchive {
+ public:
+  AssetArchive() : index_(nullptr), contents_(nullptr), contents_size_(0) {}
+
+  // Maps the archive. Returns false if it's missing or corrupt, in which case
+  // Find() finds nothing.
+  bool Open(const char *filename);
+
+  // Looks up the asset at 'path'. Returns false if it isn't in the archive,
+  // otherwise points 'data' at its contents, valid as long as the archive.
+  // Safe to call from any thread.
+  bool Find(const char *path, const uint8_t **data, size_t *size) const;
+
+  // FNV-1a hash of 'path', as the index is sorted by.
+  static uint32_t HashPath(const char *path);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AssetArchive);
+
+  AssetFile file_;
+  const archivedef::AssetArchive *index_;
+  const uint8_t *contents_;
+  size_t contents_size_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_ASSET_ARCHIVE_H
@@ -0,0 +1,167 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "precompiled.h"
+#include "asset_file.h"
+#include "asset_archive.h"
+
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#include <android/asset_manager_jni.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace fpl {
+
+#ifdef __ANDROID__
+// The application's asset manager, which outlives any asset we open.
+static AAssetManager *GetAssetManager() {
+  static AAssetManager *asset_manager = []() {
+    JNIEnv *env = reinterpret_cast<JNIEnv *>(SDL_AndroidGetJNIEnv());
+    jobject activity = reinterpret_cast<jobject>(SDL_AndroidGetActivity());
+    jclass fpl_class = env->GetObjectClass(activity);
+    jmethodID get_assets = env->GetMethodID(
+        fpl_class, "getAssets", "()Landroid/content/res/AssetManager;");
+    jobject java_asset_manager = env->CallObjectMethod(activity, get_assets);
+    // Keep the Java object alive, since the native one is owned by it.
+    jobject global_asset_manager = env->NewGlobalRef(java_asset_manager);
+    env->DeleteLocalRef(java_asset_manager);
+    env->DeleteLocalRef(fpl_class);
+    env->DeleteLocalRef(activity);
+    return AAssetManager_fromJava(env, global_asset_manager);
+  }();
+  return asset_manager;
+}
+#endif
+
+// static
+const AssetArchive *AssetFile::archive_ = nullptr;
+
+AssetFile::AssetFile() : data_(nullptr), size_(0) {
+#if defined(__ANDROID__)
+  asset_ = nullptr;
+#else
+  mapped_ = false;
+#endif
+}
+
+bool AssetFile::Open(const char *filename) {
+  Close();
+  // Files in the archive point into its mapping, so there's nothing to close.
+  if (archive_ && archive_->Find(filename, &data_, &size_)) return true;
+  if (Map(filename)) return true;
+
+  auto handle = SDL_RWFromFile(filename, "rb");
+  if (!handle) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "LoadFile fail on %s", filename);
+    return false;
+  }
+  auto len = static_cast<size_t>(SDL_RWseek(handle, 0, RW_SEEK_END));
+  SDL_RWseek(handle, 0, RW_SEEK_SET);
+  buffer_.resize(len);
+  size_t rlen =
+      len ? static_cast<size_t>(SDL_RWread(handle, &buffer_[0], 1, len)) : 0;
+  SDL_RWclose(handle);
+  if (len != rlen || !len) {
+    std::string().swap(buffer_);
+    return false;
+  }
+  data_ = reinterpret_cast<const uint8_t *>(buffer_.c_str());
+  size_ = len;
+  return true;
+}
+
+bool AssetFile::Exists(const char *filename) {
+  const uint8_t *data;
+  size_t size;
+  if (archive_ && archive_->Find(filename, &data, &size)) return true;
+  auto handle = SDL_RWFromFile(filename, "rb");
+  if (!handle) return false;
+  SDL_RWclose(handle);
+  return true;
+}
+
+void AssetFile::Close() {
+  Unmap();
+  std::string().swap(buffer_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+#if defined(__ANDROID__)
+
+bool AssetFile::Map(const char *filename) {
+  AAssetManager *asset_manager = GetAssetManager();
+  if (!asset_manager) return false;
+  asset_ = AAssetManager_open(asset_manager, filename, AASSET_MODE_BUFFER);
+  if (!asset_) return false;
+  // Uncompressed assets are memory mapped straight out of the APK, compressed
+  // ones are inflated into a buffer owned by the asset.
+  data_ = static_cast<const uint8_t *>(AAsset_getBuffer(asset_));
+  size_ = static_cast<size_t>(AAsset_getLength(asset_));
+  if (!data_ || !size_) {
+    Unmap();
+    return false;
+  }
+  return true;
+}
+
+void AssetFile::Unmap() {
+  if (asset_) {
+    AAsset_close(asset_);
+    asset_ = nullptr;
+  }
+}
+
+#elif !defined(_WIN32)
+
+bool AssetFile::Map(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat file_stat;
+  void *mapping = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    mapping = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ,
+                   MAP_PRIVATE, fd, 0);
+  }
+  // The mapping stays valid after the file is closed.
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+  data_ = static_cast<const uint8_t *>(mapping);
+  size_ = static_cast<size_t>(file_stat.st_size);
+  mapped_ = true;
+  return true;
+}
+
+void AssetFile::Unmap() {
+  if (mapped_) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+    mapped_ = false;
+  }
+}
+
+#else
+
+// Not implemented on this platform yet, files are read into buffer_ instead.
+bool AssetFile::Map(const char * /*filename*/) { return false; }
+
+void AssetFile::Unmap() {}
+
+#endif
+
+}  // namespace fpl
@@ -0,0 +1,80 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FPL_ASSET_FILE_H
+#define FPL_ASSET_FILE_H
+
+#include "common.h"
+
+#ifdef __ANDROID__
+struct AAsset;
+#endif
+
+namespace fpl {
+
+class AssetArchive;
+
+// The read-only contents of an asset file. Where the platform allows, the
+// file is memory mapped (or on Android, its AAsset buffer is used) rather than
+// copied onto the heap, so that FlatBuffers and compressed textures can be
+// used in place, and only the parts actually touched are paged in.
+class AssetFile {
+ public:
+  AssetFile();
+  ~AssetFile() { Close(); }
+
+  // Opens 'filename', closing any file opened before. Returns false if the
+  // file can't be read or is empty. Safe to call from any thread.
+  bool Open(const char *filename);
+  void Close();
+
+  // Whether Open() would find 'filename', without logging an error if not.
+  static bool Exists(const char *filename);
+
+  // Makes Open() look in 'archive' before the file system, or stop doing so
+  // if nullptr. Not to be called while other threads may be opening files.
+  static void set_archive(const AssetArchive *archive) { archive_ = archive; }
+
+  // The contents of the file, valid until Close(). Not null-terminated.
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool is_open() const { return data_ != nullptr; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AssetFile);
+
+  // Platform specific zero-copy access. Returns false if not available, in
+  // which case Open() falls back to reading the file into buffer_.
+  bool Map(const char *filename);
+  void Unmap();
+
+  const uint8_t *data_;
+  size_t size_;
+
+#if defined(__ANDROID__)
+  AAsset *asset_;
+#else
+  // Whether data_ points at a memory mapping rather than into buffer_.
+  bool mapped_;
+#endif
+
+  std::string buffer_;
+
+  static const AssetArchive *archive_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_ASSET_FILE_H
@@ -17,24 +17,20 @@
 
 namespace fpl {
 
-// Push this to signal the worker thread that it's time to quit.
-class BookendAsyncResource : public AsyncResource {
-  static std::string kBookendFileName;
-
- public:
-  BookendAsyncResource() : AsyncResource(kBookendFileName) {}
-  virtual ~BookendAsyncResource() {}
-  virtual void Load() {}
-  virtual void Finalize() {}
-  static bool IsBookend(const AsyncResource &res) {
-    return res.filename() == kBookendFileName;
-  }
-};
+// Upper bound on the number of loader threads picked automatically. Each of
+// them holds a fully decoded texture in memory while it works.
+static const int kMaxAutoLoaderThreads = 4;
 
-// static
-std::string BookendAsyncResource::kBookendFileName = "bookend";
+// How much data TryFinalize() lets a resource process at a time, when it has
+// a time budget to stick to.
+static const size_t kFinalizeSliceBytes = 256 * 1024;
 
-AsyncLoader::AsyncLoader() {
+AsyncLoader::AsyncLoader()
+    : next_sequence_(0),
+      num_queued_(0),
+      num_finalized_(0),
+      num_loading_(0),
+      stop_when_complete_(false) {
   mutex_ = SDL_CreateMutex();
   job_semaphore_ = SDL_CreateSemaphore(0);
   assert(mutex_ && job_semaphore_);
@@ -42,7 +38,7 @@ AsyncLoader::AsyncLoader() {
 
 AsyncLoader::~AsyncLoader() {
   StopLoadingWhenComplete();
-  SDL_WaitThread(worker_thread_, nullptr);
+  WaitForWorkers();
 
   if (mutex_) {
     SDL_DestroyMutex(mutex_);
@@ -54,27 +50,38 @@ AsyncLoader::~AsyncLoader() {
   }
 }
 
-void AsyncLoader::QueueJob(AsyncResource *res) {
-  Lock([this, res]() { queue_.push_back(res); });
+void AsyncLoader::QueueJob(AsyncResource *res, int priority) {
+  Lock([this, res, priority]() {
+    Job job = {res, priority, next_sequence_++};
+    queue_.push(job);
+    num_queued_++;
+  });
   SDL_SemPost(job_semaphore_);
 }
 
 void AsyncLoader::LoaderWorker() {
   for (;;) {
-    auto res = LockReturn<AsyncResource *>(
-        [this]() { return queue_.empty() ? nullptr : queue_[0]; });
+    // Every queued job posts the semaphore once, so there is always a job
+    // waiting for us here, unless we're being asked to stop.
+    SDL_SemWait(job_semaphore_);
+    auto res = LockReturn<AsyncResource *>([this]() -> AsyncResource * {
+      if (queue_.empty()) return nullptr;
+      auto job = queue_.top().res;
+      queue_.pop();
+      num_loading_++;
+      return job;
+    });
     if (!res) {
-      SDL_SemWait(job_semaphore_);
+      // Stop loading once all jobs have been taken, if requested by
+      // StopLoadingWhenComplete(). To start loading again, call StartLoading().
+      if (LockReturn<bool>([this]() { return stop_when_complete_; })) break;
       continue;
     }
-    // Stop loading once we reach the bookend enqueued by
-    // StopLoadingWhenComplete(). To start loading again, call StartLoading().
-    if (BookendAsyncResource::IsBookend(*res)) break;
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "async load: %s",
                  res->filename_.c_str());
     res->Load();
     Lock([this, res]() {
-      queue_.erase(queue_.begin());
+      num_loading_--;
       done_.push_back(res);
     });
   }
@@ -85,29 +92,79 @@ int AsyncLoader::LoaderThread(void *user_data) {
   return 0;
 }
 
-void AsyncLoader::StartLoading() {
-  worker_thread_ =
-      SDL_CreateThread(AsyncLoader::LoaderThread, "FPL Loader Thread", this);
-  assert(worker_thread_);
+void AsyncLoader::StartLoading(int num_threads) {
+  // Let threads from a previous StopLoadingWhenComplete() finish first.
+  WaitForWorkers();
+  Lock([this]() { stop_when_complete_ = false; });
+  if (num_threads <= 0) {
+    num_threads = std::max(
+        1, std::min(SDL_GetCPUCount() - 1, kMaxAutoLoaderThreads));
+  }
+  for (int i = 0; i < num_threads; i++) {
+    auto thread =
+        SDL_CreateThread(AsyncLoader::LoaderThread, "FPL Loader Thread", this);
+    if (!thread) {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't create loader thread: %s",
+                   SDL_GetError());
+      break;
+    }
+    worker_threads_.push_back(thread);
+  }
+  assert(!worker_threads_.empty());
 }
 
 void AsyncLoader::StopLoadingWhenComplete() {
-  // When the loader thread hits the bookend, it will exit.
-  static BookendAsyncResource bookend;
-  QueueJob(&bookend);
+  Lock([this]() { stop_when_complete_ = true; });
+  // Wake up each worker once more, so those left idle notice they're done.
+  for (size_t i = 0; i < worker_threads_.size(); i++) {
+    SDL_SemPost(job_semaphore_);
+  }
 }
 
-bool AsyncLoader::TryFinalize() {
+void AsyncLoader::WaitForWorkers() {
+  for (auto it = worker_threads_.begin(); it != worker_threads_.end(); ++it) {
+    SDL_WaitThread(*it, nullptr);
+  }
+  worker_threads_.clear();
+}
+
+bool AsyncLoader::TryFinalize(int budget_ms) {
+  const Uint32 start_time = SDL_GetTicks();
+  // Without a budget, there's no point in slicing anything up.
+  const size_t slice_bytes = budget_ms ? kFinalizeSliceBytes : SIZE_MAX;
   for (;;) {
+    // Only this thread removes from done_, so the front stays put until a
+    // resource has been finalized completely.
     auto res = LockReturn<AsyncResource *>(
-        [this]() { return done_.empty() ? nullptr : done_[0]; });
+        [this]() { return done_.empty() ? nullptr : done_.front(); });
     if (!res) break;
-    SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "finalize: %s",
-                 res->filename_.c_str());
-    res->Finalize();
-    Lock([this]() { done_.erase(done_.begin()); });
+    if (res->FinalizeSlice(slice_bytes)) {
+      SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "finalize: %s",
+                   res->filename_.c_str());
+      Lock([this]() {
+        done_.pop_front();
+        num_finalized_++;
+      });
+    }
+    if (budget_ms &&
+        SDL_GetTicks() - start_time >= static_cast<Uint32>(budget_ms)) {
+      break;
+    }
   }
-  return LockReturn<bool>([this]() { return queue_.empty(); });
+  return Done();
+}
+
+bool AsyncLoader::Done() {
+  return LockReturn<bool>([this]() {
+    return queue_.empty() && !num_loading_ && done_.empty();
+  });
+}
+
+float AsyncLoader::Progress() {
+  return LockReturn<float>([this]() {
+    return num_queued_ ? static_cast<float>(num_finalized_) / num_queued_
+                       : 1.0f;
+  });
 }
 
 }  // namespace fpl
@@ -27,16 +27,25 @@ class AsyncResource {
   virtual ~AsyncResource() {}
 
   // Load should perform the actual loading of filename_, and store the
-  // result in data_, or nullptr upon failure. It is called on the loader
-  // thread, so should not access any program state outside of this object.
-  // Since there will be only one loader thread, any libraries called by Load
-  // need not be MT-safe as long as they're not also called by the main thread.
+  // result in data_, or nullptr upon failure. It is called on one of the
+  // loader threads, so should not access any program state outside of this
+  // object. Several resources may be loading at the same time, so any
+  // libraries called by Load must be MT-safe.
   virtual void Load() = 0;
 
   // This should implement the behavior of turning data_ into the actual
   // desired resource. Called on the main thread only.
   virtual void Finalize() = 0;
 
+  // Like Finalize(), but resources that are expensive to finalize may do only
+  // part of the work per call, processing roughly 'max_bytes' of data_. Returns
+  // false until it's done, and is called again later to continue.
+  virtual bool FinalizeSlice(size_t max_bytes) {
+    (void)max_bytes;
+    Finalize();
+    return true;
+  }
+
   const std::string &filename() const { return filename_; }
 
  protected:
@@ -46,26 +55,48 @@ class AsyncResource {
   friend class AsyncLoader;
 };
 
+// Jobs queued with a higher priority are loaded before those with a lower
+// one. Jobs of equal priority are loaded in the order they were queued.
+enum AsyncLoadPriority {
+  // Not queued at all until the resource is first used, or prefetched. See
+  // MaterialManager::LoadTexture().
+  kLoadPriorityOnDemand = -1,
+  kLoadPriorityNormal = 0,
+  // For resources needed to show the loading screen itself.
+  kLoadPriorityHigh = 1
+};
+
 class AsyncLoader {
  public:
   AsyncLoader();
   ~AsyncLoader();
 
-  // Call this any number of times before StartLoading.
-  void QueueJob(AsyncResource *res);
+  // Call this any number of times, before or after StartLoading.
+  void QueueJob(AsyncResource *res, int priority = kLoadPriorityNormal);
 
-  // Launches the loading thread.
-  void StartLoading();
+  // Launches the loading threads, which load queued jobs in parallel.
+  // If num_threads is 0, one thread is used per CPU core, minus the one the
+  // main thread runs on.
+  void StartLoading(int num_threads = 0);
 
-  // Cleans-up the background loading thread once all jobs have been completed.
-  // You can restart with StartLoading() if you like.
+  // Cleans-up the background loading threads once all jobs have been
+  // completed. You can restart with StartLoading() if you like.
   void StopLoadingWhenComplete();
 
-  // Call this once per frame after StartLoading. Will call Finalize on any
-  // resources that have finished loading. One it returns true, that means
-  // the queue is empty, all resources have been processed, and the loading
-  // thread has terminated.
-  bool TryFinalize();
+  // Call this once per frame after StartLoading. Will finalize any resources
+  // that have finished loading. If budget_ms is non-zero, it returns once
+  // about that many milliseconds have been spent, finalizing large resources
+  // in slices that continue on the next call. Once it returns true, that means
+  // the queue is empty and all resources have been loaded and finalized.
+  bool TryFinalize(int budget_ms = 0);
+
+  // Whether all queued jobs have been loaded and finalized, i.e. what
+  // TryFinalize() returns, without finalizing anything.
+  bool Done();
+
+  // The fraction of all jobs queued so far that have been finalized, from 0
+  // to 1, e.g. for a progress bar.
+  float Progress();
 
  private:
   void Lock(const std::function<void()> &body) {
@@ -82,19 +113,44 @@ class AsyncLoader {
     return ret;
   }
 
+  struct Job {
+    AsyncResource *res;
+    int priority;
+    // Order in which the job was queued, to break ties between priorities.
+    unsigned int sequence;
+    bool operator<(const Job &other) const {
+      return priority != other.priority ? priority < other.priority
+                                        : sequence > other.sequence;
+    }
+  };
+
   void LoaderWorker();
   static int LoaderThread(void *user_data);
+  void WaitForWorkers();
+
+  std::priority_queue<Job> queue_;
+  std::deque<AsyncResource *> done_;
+  unsigned int next_sequence_;
+
+  // Number of jobs ever queued, and how many of those have been finalized.
+  int num_queued_;
+  int num_finalized_;
+
+  // Number of jobs taken off queue_ that are still loading.
+  int num_loading_;
 
-  std::vector<AsyncResource *> queue_, done_;
+  // Set by StopLoadingWhenComplete(), so workers exit once queue_ is empty.
+  bool stop_when_complete_;
 
-  // Keep handle to the worker thread around so that we can wait for it to
-  // finish before destroying the class.
-  SDL_Thread *worker_thread_;
+  // Keep handles to the worker threads around so that we can wait for them
+  // to finish before destroying the class.
+  std::vector<SDL_Thread *> worker_threads_;
 
-  // This lock protects ALL state in this class, i.e. the two vectors.
+  // This lock protects ALL state in this class, i.e. the queues and counters.
   SDL_mutex *mutex_;
 
-  // Kick-off the worker thread when a new job arrives.
+  // Wakes up one worker thread per job queued, and each of them once more
+  // when they should stop.
   SDL_semaphore *job_semaphore_;
 };
 
@@ -0,0 +1,171 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "compressed_texture.h"
+
+namespace fpl {
+
+static const uint8_t kKTXIdentifier[12] = {0xAB, 'K',  'T',  'X', ' ',  '1',
+                                           '1',  0xBB, '\r', '\n', 0x1A, '\n'};
+static const uint32_t kKTXEndianness = 0x04030201;
+
+// The header that follows the identifier, see
+// https://www.khronos.org/opengles/sdk/tools/KTX/file_format_spec/
+struct KTXHeader {
+  uint32_t endianness;
+  uint32_t gl_type;
+  uint32_t gl_type_size;
+  uint32_t gl_format;
+  uint32_t gl_internal_format;
+  uint32_t gl_base_internal_format;
+  uint32_t pixel_width;
+  uint32_t pixel_height;
+  uint32_t pixel_depth;
+  uint32_t number_of_array_elements;
+  uint32_t number_of_faces;
+  uint32_t number_of_mipmap_levels;
+  uint32_t bytes_of_key_value_data;
+};
+static_assert(sizeof(KTXHeader) == 13 * sizeof(uint32_t),
+              "Members of struct KTXHeader need to be packed with no padding.");
+
+bool KTXTexture::HasCompleteMipChain() const {
+  int levels_needed = 1;
+  for (int extent = std::max(size.x(), size.y()); extent > 1; extent /= 2) {
+    levels_needed++;
+  }
+  return static_cast<int>(levels.size()) >= levels_needed;
+}
+
+bool ParseKTX(const uint8_t *data, size_t size, KTXTexture *ktx) {
+  if (size < sizeof(kKTXIdentifier) + sizeof(KTXHeader) ||
+      memcmp(data, kKTXIdentifier, sizeof(kKTXIdentifier))) {
+    return false;
+  }
+  KTXHeader header;
+  memcpy(&header, data + sizeof(kKTXIdentifier), sizeof(header));
+  // Files written on a machine of the other endianness would need swapping.
+  // Our asset pipeline and all our targets are little endian.
+  if (header.endianness != kKTXEndianness) return false;
+  // glType 0 marks compressed formats.
+  if (header.gl_type != 0 || header.pixel_depth > 1 ||
+      header.number_of_array_elements > 0 || header.number_of_faces != 1) {
+    return false;
+  }
+  ktx->internal_format = header.gl_internal_format;
+  ktx->size = vec2i(static_cast<int>(header.pixel_width),
+                    static_cast<int>(header.pixel_height));
+  ktx->levels.clear();
+  ktx->level_sizes.clear();
+
+  size_t offset = sizeof(kKTXIdentifier) + sizeof(KTXHeader) +
+                  header.bytes_of_key_value_data;
+  const uint32_t num_levels = std::max(header.number_of_mipmap_levels, 1u);
+  for (uint32_t i = 0; i < num_levels; i++) {
+    uint32_t image_size;
+    if (offset + sizeof(image_size) > size) return false;
+    memcpy(&image_size, data + offset, sizeof(image_size));
+    offset += sizeof(image_size);
+    if (offset + image_size > size) return false;
+    ktx->levels.push_back(data + offset);
+    ktx->level_sizes.push_back(image_size);
+    // Each level is padded to a multiple of 4 bytes.
+    offset += (image_size + 3) & ~3u;
+  }
+  return true;
+}
+
+bool CompressedFormatHasAlpha(uint32_t internal_format) {
+  return internal_format != kCompressedETC1RGB8 &&
+         internal_format != kCompressedRGB8ETC2;
+}
+
+// Intensity modifiers of ETC1, per table codeword. The pixel index selects
+// the first or second value, positive or negated.
+static const int kETC1Modifiers[8][2] = {{2, 8},   {5, 17},  {9, 29},
+                                          {13, 42}, {18, 60}, {24, 80},
+                                          {33, 106}, {47, 183}};
+
+static uint8_t ClampToByte(int value) {
+  return static_cast<uint8_t>(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+// Decodes one 64 bit ETC1 block to 4x4 RGB888 pixels.
+static void DecodeETC1Block(const uint8_t *block, uint8_t pixels[4][4][3]) {
+  // The upper word holds the base colors, the lower one the pixel indices.
+  const uint32_t hi = (block[0] << 24) | (block[1] << 16) | (block[2] << 8) |
+                      block[3];
+  const uint32_t lo = (block[4] << 24) | (block[5] << 16) | (block[6] << 8) |
+                      block[7];
+  const bool differential = (hi & 2) != 0;
+  const bool flipped = (hi & 1) != 0;
+
+  // Base color of both sub-blocks, per channel.
+  int base[2][3];
+  for (int c = 0; c < 3; c++) {
+    const int shift = 24 - c * 8;
+    if (differential) {
+      const int color = (hi >> (shift + 3)) & 0x1F;
+      // The delta is a 3 bit two's complement number.
+      int delta = static_cast<int>((hi >> shift) & 7);
+      if (delta >= 4) delta -= 8;
+      const int color2 = (color + delta) & 0x1F;
+      base[0][c] = (color << 3) | (color >> 2);
+      base[1][c] = (color2 << 3) | (color2 >> 2);
+    } else {
+      base[0][c] = ((hi >> (shift + 4)) & 0xF) * 0x11;
+      base[1][c] = ((hi >> shift) & 0xF) * 0x11;
+    }
+  }
+  const int tables[2] = {static_cast<int>((hi >> 5) & 7),
+                         static_cast<int>((hi >> 2) & 7)};
+
+  for (int x = 0; x < 4; x++) {
+    for (int y = 0; y < 4; y++) {
+      // Sub-blocks are 2x4 side by side, or 4x2 on top of each other when
+      // flipped.
+      const int sub_block = flipped ? y >= 2 : x >= 2;
+      const int bit = x * 4 + y;
+      const int index = (((lo >> (bit + 16)) & 1) << 1) | ((lo >> bit) & 1);
+      const int magnitude = kETC1Modifiers[tables[sub_block]][index & 1];
+      const int modifier = index & 2 ? -magnitude : magnitude;
+      for (int c = 0; c < 3; c++) {
+        pixels[y][x][c] = ClampToByte(base[sub_block][c] + modifier);
+      }
+    }
+  }
+}
+
+void DecodeETC1(const uint8_t *blocks, const vec2i &size, uint8_t *rgb) {
+  const int blocks_x = (size.x() + 3) / 4;
+  const int blocks_y = (size.y() + 3) / 4;
+  uint8_t pixels[4][4][3];
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      DecodeETC1Block(blocks, pixels);
+      blocks += 8;
+      // Blocks on the right and bottom edges may be partially outside of the
+      // image.
+      const int width = std::min(4, size.x() - bx * 4);
+      const int height = std::min(4, size.y() - by * 4);
+      for (int y = 0; y < height; y++) {
+        memcpy(rgb + ((by * 4 + y) * size.x() + bx * 4) * 3, pixels[y],
+               width * 3);
+      }
+    }
+  }
+}
+
+}  // namespace fpl
@@ -0,0 +1,62 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_COMPRESSED_TEXTURE_H
+#define FPL_COMPRESSED_TEXTURE_H
+
+#include "common.h"
+
+namespace fpl {
+
+using mathfu::vec2i;
+
+// GL internal formats of the compressed textures we know about. Spelled out
+// here since not all platform headers define them.
+enum CompressedTextureFormat {
+  kCompressedETC1RGB8 = 0x8D64,      // GL_ETC1_RGB8_OES
+  kCompressedRGB8ETC2 = 0x9274,      // GL_COMPRESSED_RGB8_ETC2
+  kCompressedRGBA8ETC2EAC = 0x9278,  // GL_COMPRESSED_RGBA8_ETC2_EAC
+  kCompressedRGBAASTC4x4 = 0x93B0,   // GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+};
+
+// A 2D texture in a GPU compressed format, with its chain of mip levels, as
+// stored in a KTX file. Points into the file contents, which must outlive it.
+struct KTXTexture {
+  KTXTexture() : internal_format(0), size(mathfu::kZeros2i) {}
+
+  // Whether all mip levels down to 1x1 are present.
+  bool HasCompleteMipChain() const;
+
+  uint32_t internal_format;
+  vec2i size;
+  std::vector<const uint8_t *> levels;
+  std::vector<uint32_t> level_sizes;
+};
+
+// Reads a KTX file in 'data'. Only single, non-array 2D textures in a
+// compressed format are supported. Returns false if 'data' isn't one of
+// those, or is truncated.
+bool ParseKTX(const uint8_t *data, size_t size, KTXTexture *ktx);
+
+// Whether 'internal_format' has an alpha channel.
+bool CompressedFormatHasAlpha(uint32_t internal_format);
+
+// Decodes an ETC1 image of 'size' pixels (which need not be a multiple of the
+// 4x4 block size) to RGB888 pixels in 'rgb'. Used when the GPU can't sample
+// ETC1 itself.
+void DecodeETC1(const uint8_t *blocks, const vec2i &size, uint8_t *rgb);
+
+}  // namespace fpl
+
+#endif  // FPL_COMPRESSED_TEXTURE_H
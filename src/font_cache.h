@@ -0,0 +1,243 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FONT_CACHE_H
+#define FONT_CACHE_H
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "SDL_log.h"
+#include "common.h"
+
+namespace fpl {
+
+// Cache of objects FontManager generates for a string, such as FontBuffer and
+// FontTexture.
+// Entries are looked up with a 64 bit hash of the text, its size in pixels and
+// the font it was rendered with, so a lookup is a single O(1) hash map access
+// and doesn't allocate. The text is kept in the entry to detect hash
+// collisions.
+//
+// The cache is bounded by a memory budget. When an insertion exceeds the
+// budget, least recently used entries are evicted. Entries used in the current
+// rendering cycle (see Update()) are never evicted, since the caller may still
+// hold pointers to them, so the budget can be exceeded temporarily when one
+// frame references more than fits.
+template <typename T>
+class FontCache {
+ public:
+  FontCache()
+      : memory_budget_(0),
+        memory_(0),
+        counter_(0),
+        hits_(0),
+        misses_(0),
+        evictions_(0) {}
+
+  // Calculate the key of a string with a size in pixels rendered with a font.
+  // 'layout' distinguishes other layouts of the same string, e.g. in another
+  // script or direction.
+  static uint64_t Key(const char *text, const int32_t size,
+                      const uint32_t font_id, const uint32_t layout = 0) {
+    // 64 bit FNV-1a.
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = text; *p; ++p) {
+      hash = (hash ^ static_cast<uint8_t>(*p)) * 1099511628211ULL;
+    }
+    const uint32_t extra[] = {static_cast<uint32_t>(size), font_id, layout};
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(extra);
+    for (size_t i = 0; i < sizeof(extra); ++i) {
+      hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  // Look up an entry, marking it as used in the current rendering cycle.
+  // Returns nullptr if the entry is not in the cache.
+  T *Find(const uint64_t key, const char *text) {
+    auto it = map_.find(key);
+    if (it == map_.end() || it->second->text != text) {
+      misses_++;
+      return nullptr;
+    }
+    hits_++;
+    auto entry = it->second;
+    entry->last_used_counter = counter_;
+    lru_.splice(lru_.end(), lru_, entry);
+    return entry->value.get();
+  }
+
+  // Returns if an entry is in the cache, without marking it as used or
+  // counting a hit or a miss.
+  bool Contains(const uint64_t key, const char *text) const {
+    auto it = map_.find(key);
+    return it != map_.end() && it->second->text == text;
+  }
+
+  // Insert an entry that takes `memory` bytes, evicting least recently used
+  // entries to fit the memory budget.
+  // An entry with the same key (i.e. a hash collision) is replaced.
+  T *Insert(const uint64_t key, const char *text, std::unique_ptr<T> value,
+            const size_t memory) {
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+      Erase(it->second);
+    }
+    Entry entry;
+    entry.key = key;
+    entry.text = text;
+    entry.value = std::move(value);
+    entry.memory = memory;
+    entry.last_used_counter = counter_;
+    lru_.push_back(std::move(entry));
+    map_[key] = std::prev(lru_.end());
+    memory_ += memory;
+    Evict();
+    return lru_.back().value.get();
+  }
+
+  // Start a new rendering cycle. Entries not used since the last call become
+  // candidates for eviction.
+  void Update() {
+    counter_++;
+    Evict();
+  }
+
+  // Remove all entries.
+  void Clear() {
+    map_.clear();
+    lru_.clear();
+    memory_ = 0;
+  }
+
+  // Setter/Getter of the memory budget in bytes. 0 means unlimited.
+  size_t memory_budget() const { return memory_budget_; }
+  void set_memory_budget(const size_t budget) {
+    memory_budget_ = budget;
+    Evict();
+  }
+
+  // Memory used by cached entries in bytes.
+  size_t memory() const { return memory_; }
+
+  // Number of cached entries.
+  size_t size() const { return map_.size(); }
+
+  // Usage stats.
+  uint32_t hits() const { return hits_; }
+  uint32_t misses() const { return misses_; }
+  uint32_t evictions() const { return evictions_; }
+  void ResetStats() {
+    hits_ = 0;
+    misses_ = 0;
+    evictions_ = 0;
+  }
+
+  // Dump the cache usage to the log.
+  void Status(const char *name) const {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "%s: %d entries, %d / %d bytes, hit: %d / %d, evicted: %d",
+                name, static_cast<int>(size()), static_cast<int>(memory_),
+                static_cast<int>(memory_budget_), hits_, hits_ + misses_,
+                evictions_);
+  }
+
+ private:
+  struct Entry {
+    uint64_t key;
+    std::string text;
+    std::unique_ptr<T> value;
+    size_t memory;
+    uint32_t last_used_counter;
+  };
+  typedef typename std::list<Entry>::iterator iterator;
+
+  void Erase(iterator entry) {
+    memory_ -= entry->memory;
+    map_.erase(entry->key);
+    lru_.erase(entry);
+  }
+
+  // Evict least recently used entries until the cache fits in the budget.
+  void Evict() {
+    while (memory_budget_ && memory_ > memory_budget_ && !lru_.empty() &&
+           lru_.front().last_used_counter != counter_) {
+      Erase(lru_.begin());
+      evictions_++;
+    }
+  }
+
+  size_t memory_budget_;
+  size_t memory_;
+
+  // A time counter of the cache, incremented in each rendering cycle.
+  uint32_t counter_;
+
+  uint32_t hits_;
+  uint32_t misses_;
+  uint32_t evictions_;
+
+  // Entries in least recently used order, the front is evicted first.
+  std::list<Entry> lru_;
+
+  // Map from a key to an entry in lru_.
+  std::unordered_map<uint64_t, iterator> map_;
+};
+
+// Tracks strings FontManager hands to its text thread, by their cache key.
+// A string is pending from when it's queued until its result is back, and
+// failed if the result didn't fit the glyph cache. A failure is reported once,
+// so the caller can make room and try again, rather than the string being
+// queued over and over.
+class TextJobTracker {
+ public:
+  // Mark a string as pending. Returns false if it already is.
+  bool Queue(const uint64_t key) { return pending_.insert(key).second; }
+
+  // Mark a pending string as done.
+  void Finish(const uint64_t key) { pending_.erase(key); }
+
+  // Mark a pending string as done, but failed.
+  void Fail(const uint64_t key) {
+    pending_.erase(key);
+    failed_.insert(key);
+  }
+
+  // Returns if the string failed, and forgets about the failure.
+  bool TakeFailure(const uint64_t key) { return failed_.erase(key) != 0; }
+
+  // Forget about all failures, e.g. once the glyph cache has been flushed.
+  void ClearFailures() { failed_.clear(); }
+
+  // Forget about all strings.
+  void Clear() {
+    pending_.clear();
+    failed_.clear();
+  }
+
+  bool pending(const uint64_t key) const { return pending_.count(key) != 0; }
+
+ private:
+  std::unordered_set<uint64_t> pending_;
+  std::unordered_set<uint64_t> failed_;
+};
+
+}  // namespace fpl
+
+#endif  // FONT_CACHE_H
@@ -27,6 +27,13 @@
 
 namespace fpl {
 
+// Direction and script strings are laid out in, and the key of that layout for
+// the shaped text cache.
+static const hb_direction_t kTextDirection = HB_DIRECTION_LTR;
+static const hb_script_t kTextScript = HB_SCRIPT_LATIN;
+static const uint32_t kTextLayout =
+    static_cast<uint32_t>(kTextScript) ^ static_cast<uint32_t>(kTextDirection);
+
 // Singleton object of FreeType&Harfbuzz.
 FT_Library *FontManager::ft_;
 hb_buffer_t *FontManager::harfbuzz_buf_;
@@ -34,24 +41,44 @@ hb_buffer_t *FontManager::harfbuzz_buf_;
 FontManager::FontManager()
     : renderer_(nullptr),
       face_initialized_(false),
+      font_id_(0),
       current_atlas_revision_(0),
-      current_pass_(0) {
+      current_pass_(0),
+      distance_field_(false),
+      async_(false),
+      text_thread_(nullptr),
+      placeholder_buffer_(new FontBuffer()) {
   Initialize();
 
   // Initialize glyph cache.
   glyph_cache_.reset(new GlyphCache<uint8_t>(
-      mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight)));
+      mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight),
+      kGlyphCacheMaxPages));
+
+  buffer_cache_.set_memory_budget(kFontBufferCacheBudget);
+  texture_cache_.set_memory_budget(kFontTextureCacheBudget);
+  shaped_text_cache_.set_memory_budget(kShapedTextCacheBudget);
 }
 
-FontManager::FontManager(const mathfu::vec2i &cache_size)
+FontManager::FontManager(const mathfu::vec2i &cache_size,
+                         const int32_t max_pages)
     : renderer_(nullptr),
       face_initialized_(false),
+      font_id_(0),
       current_atlas_revision_(0),
-      current_pass_(0) {
+      current_pass_(0),
+      distance_field_(false),
+      async_(false),
+      text_thread_(nullptr),
+      placeholder_buffer_(new FontBuffer()) {
   Initialize();
 
   // Initialize glyph cache.
-  glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size));
+  glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size, max_pages));
+
+  buffer_cache_.set_memory_budget(kFontBufferCacheBudget);
+  texture_cache_.set_memory_budget(kFontTextureCacheBudget);
+  shaped_text_cache_.set_memory_budget(kShapedTextCacheBudget);
 }
 
 FontManager::~FontManager() { Close(); }
@@ -81,68 +108,232 @@ void FontManager::Terminate() {
 }
 
 FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
-  // Adjust y size if the size selector is set.
-  int32_t converted_ysize = ConvertSize(ysize);
-  float scale = ysize / static_cast<float>(converted_ysize);
-
   // Check cache if we already have a FontBuffer generated.
-  auto it = map_buffers_.find(text);
-  if (it != map_buffers_.end()) {
-    auto t = it->second.find(ysize);
-    if (t != it->second.end()) {
-      // Update current pass.
-      if (current_pass_ != kRenderPass) {
-        t->second->set_pass(current_pass_);
-      }
-
-      // Update UV of the buffer
-      auto ret = UpdateUV(converted_ysize, t->second.get());
-      return ret;
+  auto key = FontCache<FontBuffer>::Key(text, static_cast<int32_t>(ysize),
+                                        font_id_);
+  auto cached = buffer_cache_.Find(key, text);
+  if (cached != nullptr) {
+    // Update current pass.
+    if (current_pass_ != kRenderPass) {
+      cached->set_pass(current_pass_);
     }
+
+    // Update UV of the buffer
+    return UpdateUV(GlyphSize(ConvertSize(ysize)), cached);
   }
 
   // Otherwise, create new FontBuffer.
+  if (text_thread_ != nullptr) {
+    // The string the text thread created didn't fit the glyph cache. Report
+    // it like the synchronous path does, so the caller can flush and retry.
+    if (text_job_tracker_.TakeFailure(key)) return nullptr;
+
+    // Let the text thread create it, and render nothing in the meantime.
+    QueueTextJob(key, text, ysize);
+    placeholder_buffer_->set_size(vec2i(0, static_cast<int32_t>(ysize)));
+    if (current_pass_ != kRenderPass) {
+      placeholder_buffer_->set_pass(current_pass_);
+    }
+    return placeholder_buffer_.get();
+  }
+
+  TextJob job;
+  InitTextJob(key, text, ysize, &job);
+  auto shaped = GetShapedText(text, job.converted_ysize);
+  auto buffer = CreateBuffer(job, *shaped);
+  if (!buffer) return nullptr;
 
+  // Insert the created entry to the cache.
+  auto memory = buffer->memory();
+  return buffer_cache_.Insert(key, text, std::move(buffer), memory);
+}
+
+void FontManager::PrefetchBuffer(const char *text, const float ysize) {
+  if (text_thread_ == nullptr) {
+    GetBuffer(text, ysize);
+    return;
+  }
+  auto key = FontCache<FontBuffer>::Key(text, static_cast<int32_t>(ysize),
+                                        font_id_);
+  if (!buffer_cache_.Contains(key, text)) {
+    QueueTextJob(key, text, ysize);
+  }
+}
+
+void FontManager::InitTextJob(const uint64_t key, const char *text,
+                              const float ysize, TextJob *job) {
+  job->key = key;
+  job->text = text;
+  job->ysize = ysize;
+  // Adjust y size if the size selector is set.
+  job->converted_ysize = ConvertSize(ysize);
+  job->glyph_size = GlyphSize(job->converted_ysize);
+  job->distance_field = distance_field_;
+  job->font_id = font_id_;
+}
+
+void FontManager::ShapeText(FT_Face face, hb_font_t *font, hb_buffer_t *buf,
+                            const char *text, const int32_t ysize,
+                            ShapedText *shaped) {
   // Set freetype settings.
-  FT_Set_Pixel_Sizes(face_, 0, converted_ysize);
+  FT_Set_Pixel_Sizes(face, 0, ysize);
 
   // Layout text.
-  auto string_width = LayoutText(text) * scale;
+  shaped->string_width = LayoutText(font, buf, text);
 
   // Retrieve layout info.
   uint32_t glyph_count;
-  hb_glyph_info_t *glyph_info =
-      hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
+  hb_glyph_info_t *glyph_info = hb_buffer_get_glyph_infos(buf, &glyph_count);
   hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+      hb_buffer_get_glyph_positions(buf, &glyph_count);
+  shaped->glyphs.resize(glyph_count);
+  for (size_t i = 0; i < glyph_count; ++i) {
+    shaped->glyphs[i].code_point = glyph_info[i].codepoint;
+    shaped->glyphs[i].x_advance = glyph_pos[i].x_advance;
+    shaped->glyphs[i].y_advance = glyph_pos[i].y_advance;
+  }
+
+  // Cleanup buffer contents.
+  hb_buffer_clear_contents(buf);
+}
+
+void FontManager::RasterizeGlyphs(FT_Face face, TextJob *job) {
+  FT_Set_Pixel_Sizes(face, 0, job->glyph_size);
+  for (auto &glyph : job->shaped->glyphs) {
+    // Strings are short, so a linear search for repeated glyphs is fine.
+    bool rendered = false;
+    for (auto &image : job->images) {
+      if (image.code_point == glyph.code_point) {
+        rendered = true;
+        break;
+      }
+    }
+    if (rendered) continue;
+
+    TextJob::Image image;
+    image.code_point = glyph.code_point;
+    image.offset = job->image_data.size();
+    vec2i size, offset;
+    if (!RasterizeGlyph(face, glyph.code_point, job->distance_field,
+                        &job->image_data, &size, &offset)) {
+      // Leave it to CreateBuffer(), which reports the error.
+      continue;
+    }
+    image.width = size.x();
+    image.height = size.y();
+    image.left = offset.x();
+    image.top = offset.y();
+    job->images.push_back(image);
+  }
+}
+
+const ShapedText *FontManager::GetShapedText(const char *text,
+                                             const int32_t ysize) {
+  auto key = FontCache<ShapedText>::Key(text, ysize, font_id_, kTextLayout);
+  auto cached = shaped_text_cache_.Find(key, text);
+  if (cached != nullptr) return cached;
+
+  std::unique_ptr<ShapedText> shaped(new ShapedText());
+  ShapeText(face_, harfbuzz_font_, harfbuzz_buf_, text, ysize, shaped.get());
+  auto memory = shaped->memory();
+  return shaped_text_cache_.Insert(key, text, std::move(shaped), memory);
+}
+
+bool FontManager::RasterizeGlyph(FT_Face face, const uint32_t code_point,
+                                 const bool distance_field,
+                                 std::vector<uint8_t> *image, vec2i *size,
+                                 vec2i *offset) {
+  // Load glyph using harfbuzz layout information.
+  // Note that harfbuzz takes care of ligatures.
+  FT_Error err;
+  if ((err = FT_Load_Glyph(face, code_point, FT_LOAD_RENDER))) {
+    // Error. This could happen typically the loaded font does not support
+    // particular glyph.
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't load glyph %c FT_Error:%d\n",
+                 code_point, err);
+    return false;
+  }
+
+  FT_GlyphSlot g = face->glyph;
+  auto start = image->size();
+  if (distance_field) {
+    // Cache the distance field, with room for the distance outside of the
+    // glyph.
+    *size = vec2i(g->bitmap.width + kDistanceFieldSpread * 2,
+                  g->bitmap.rows + kDistanceFieldSpread * 2);
+    *offset = vec2i(g->bitmap_left - kDistanceFieldSpread,
+                    g->bitmap_top + kDistanceFieldSpread);
+    image->resize(start + size->x() * size->y());
+    GenerateDistanceField(g->bitmap.buffer, g->bitmap.width, g->bitmap.rows,
+                          g->bitmap.pitch, kDistanceFieldSpread,
+                          image->data() + start);
+  } else {
+    *size = vec2i(g->bitmap.width, g->bitmap.rows);
+    *offset = vec2i(g->bitmap_left, g->bitmap_top);
+    image->resize(start + size->x() * size->y());
+    for (int32_t y = 0; y < size->y(); ++y) {
+      memcpy(image->data() + start + y * size->x(),
+             &g->bitmap.buffer[y * g->bitmap.pitch], size->x());
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<FontBuffer> FontManager::CreateBuffer(
+    const TextJob &job, const ShapedText &shaped) {
+  float scale = job.ysize / static_cast<float>(job.converted_ysize);
+  auto string_width = shaped.string_width * scale;
+
+  // Scale to apply to glyphs cached at the glyph size.
+  float glyph_scale = job.ysize / static_cast<float>(job.glyph_size);
+
+  // Store glyphs the text thread rasterized.
+  for (auto &image : job.images) {
+    CacheGlyph(image.code_point, job.glyph_size, &job.image_data[image.offset],
+               vec2i(image.width, image.height),
+               vec2i(image.left, image.top));
+  }
+
+  // Set freetype settings for glyphs that still need to be rasterized.
+  FT_Set_Pixel_Sizes(face_, 0, job.glyph_size);
 
   // Create FontBuffer with derived string length.
-  std::unique_ptr<FontBuffer> buffer(new FontBuffer(glyph_count));
+  std::unique_ptr<FontBuffer> buffer(
+      new FontBuffer(static_cast<uint32_t>(shaped.glyphs.size())));
 
   // Initialize font metrics parameters.
-  int32_t base_line = ysize * face_->ascender / face_->units_per_EM;
-  FontMetrics initial_metrics(base_line, 0, base_line, base_line - ysize, 0);
+  int32_t base_line = job.ysize * face_->ascender / face_->units_per_EM;
+  FontMetrics initial_metrics(base_line, 0, base_line, base_line - job.ysize,
+                              0);
+
+  // Base line in the units AddVertices() scales by glyph_scale.
+  int32_t glyph_base_line = base_line;
+  if (job.distance_field) {
+    glyph_base_line = job.glyph_size * face_->ascender / face_->units_per_EM;
+  }
 
   mathfu::vec2 pos(mathfu::kZeros2f);
-  FT_GlyphSlot glyph = face_->glyph;
 
-  for (size_t i = 0; i < glyph_count; ++i) {
-    auto code_point = glyph_info[i].codepoint;
-    auto cache = GetCachedEntry(code_point, converted_ysize);
+  for (size_t i = 0; i < shaped.glyphs.size(); ++i) {
+    auto code_point = shaped.glyphs[i].code_point;
+    auto cache = GetCachedEntry(code_point, job.glyph_size);
     if (cache == nullptr) {
-      // Cleanup buffer contents.
-      hb_buffer_clear_contents(harfbuzz_buf_);
       return nullptr;
     }
 
     // Add the code point to the buffer. This information is used when
     // re-fetching UV information when the texture atlas is updated.
     buffer->get_code_points()->push_back(code_point);
+    buffer->get_pages()->push_back(cache->get_page());
 
     // Calculate internal/external leading value and expand a buffer if
     // necessary.
+    // Distance field glyphs are padded and at a different size, which doesn't
+    // match the metrics.
     FontMetrics new_metrics;
-    if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
+    if (!job.distance_field &&
+        UpdateMetrics(cache->get_offset().y(), cache->get_size().y(),
+                      initial_metrics, &new_metrics)) {
       initial_metrics = new_metrics;
     }
 
@@ -157,7 +348,7 @@ FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
     // glyph size & glyph cache entry information.
 
     // Update vertices.
-    buffer->AddVertices(pos, base_line, scale, *cache);
+    buffer->AddVertices(pos, glyph_base_line, glyph_scale, *cache);
 
     // Update UV.
     buffer->UpdateUV(i, cache->get_uv());
@@ -166,12 +357,13 @@ FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
     buffer->set_revision(glyph_cache_->get_revision());
 
     // Advance positions.
-    pos += mathfu::vec2(glyph_pos[i].x_advance, -glyph_pos[i].y_advance) *
+    pos += mathfu::vec2(shaped.glyphs[i].x_advance,
+                        -shaped.glyphs[i].y_advance) *
            scale / kFreeTypeUnit;
   }
 
   // Setup size.
-  buffer->set_size(vec2i(string_width, ysize));
+  buffer->set_size(vec2i(string_width, job.ysize));
 
   // Setup font metrics.
   buffer->set_metrics(initial_metrics);
@@ -181,17 +373,9 @@ FontBuffer *FontManager::GetBuffer(const char *text, const float ysize) {
     buffer->set_pass(current_pass_);
   }
 
-  // Cleanup buffer contents.
-  hb_buffer_clear_contents(harfbuzz_buf_);
-
   // Verify the buffer.
   assert(buffer->Verify());
-
-  // Insert the created entry to the hash map.
-  auto insert =
-      map_buffers_[text].insert(std::pair<int32_t, std::unique_ptr<FontBuffer>>(
-          ysize, std::move(buffer)));
-  return insert.first->second.get();
+  return buffer;
 }
 
 FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
@@ -212,8 +396,9 @@ FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
         return nullptr;
       }
 
-      // Update UV.
+      // Update UV and page.
       buffer->UpdateUV(i, cache->get_uv());
+      (*buffer->get_pages())[i] = cache->get_page();
 
       // Update revision.
       buffer->set_revision(glyph_cache_->get_revision());
@@ -228,26 +413,19 @@ FontTexture *FontManager::GetTexture(const char *text,
   int32_t ysize = ConvertSize(original_ysize);
 
   // Check cache if we already have a texture.
-  auto it = map_textures_.find(text);
-  if (it != map_textures_.end()) {
-    auto t = it->second.find(ysize);
-    if (t != it->second.end()) return t->second.get();
-  }
+  auto key = FontCache<FontTexture>::Key(text, ysize, font_id_);
+  auto cached = texture_cache_.Find(key, text);
+  if (cached != nullptr) return cached;
 
   // Otherwise, create new texture.
 
-  // Set freetype settings.
-  FT_Set_Pixel_Sizes(face_, 0, ysize);
-
   // Layout text.
-  auto string_width = LayoutText(text);
+  auto shaped = GetShapedText(text, ysize);
+  auto string_width = shaped->string_width;
+  auto &glyphs = shaped->glyphs;
 
-  // Retrieve layout info.
-  uint32_t glyph_count;
-  hb_glyph_info_t *glyph_info =
-      hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
-  hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+  // Set freetype settings.
+  FT_Set_Pixel_Sizes(face_, 0, ysize);
 
   // Calculate texture size. The texture may be expanded later depending on
   // glyph sizes.
@@ -267,12 +445,12 @@ FontTexture *FontManager::GetTexture(const char *text,
   mathfu::vec2 pos(kGlyphPadding, kGlyphPadding);
   FT_GlyphSlot glyph = face_->glyph;
 
-  for (size_t i = 0; i < glyph_count; ++i) {
+  for (size_t i = 0; i < glyphs.size(); ++i) {
     FT_Error err;
 
     // Load glyph using harfbuzz layout information.
     // Note that harfbuzz takes care of ligatures.
-    if ((err = FT_Load_Glyph(face_, glyph_info[i].codepoint, FT_LOAD_RENDER))) {
+    if ((err = FT_Load_Glyph(face_, glyphs[i].code_point, FT_LOAD_RENDER))) {
       // Error. This could happen typically the loaded font does not support
       // particular glyph.
       SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't load glyph %c FT_Error:%d\n",
@@ -283,7 +461,8 @@ FontTexture *FontManager::GetTexture(const char *text,
     // Calculate internal/external leading value and expand a buffer if
     // necessary.
     FontMetrics new_metrics;
-    if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
+    if (UpdateMetrics(glyph->bitmap_top, glyph->bitmap.rows, initial_metrics,
+                      &new_metrics)) {
       if (new_metrics.total() != initial_metrics.total()) {
         // Expand buffer and update height if necessary.
         if (ExpandBuffer(width, height, initial_metrics, new_metrics, &image)) {
@@ -308,7 +487,7 @@ FontTexture *FontManager::GetTexture(const char *text,
     }
 
     // Advance positions.
-    pos += mathfu::vec2(glyph_pos[i].x_advance, -glyph_pos[i].y_advance) /
+    pos += mathfu::vec2(glyphs[i].x_advance, -glyphs[i].y_advance) /
            kFreeTypeUnit;
   }
 
@@ -326,13 +505,9 @@ FontTexture *FontManager::GetTexture(const char *text,
   // Setup font metrics.
   tex->set_metrics(initial_metrics);
 
-  // Cleanup buffer contents.
-  hb_buffer_clear_contents(harfbuzz_buf_);
-
-  // Put to the dic.
-  map_textures_[text][ysize].reset(tex);
-
-  return tex;
+  // Put to the cache.
+  return texture_cache_.Insert(key, text, std::unique_ptr<FontTexture>(tex),
+                               sizeof(*tex) + tex->gpu_memory());
 }
 
 bool FontManager::ExpandBuffer(const int32_t width, const int32_t height,
@@ -388,7 +563,7 @@ bool FontManager::Open(const char *font_name) {
   assert(!face_initialized_);
 
   // Load the font file of assets.
-  if (!LoadFile(font_name, &font_data_)) {
+  if (!font_data_.Open(font_name)) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't load font reource: %s\n",
                  font_name);
     return false;
@@ -397,8 +572,7 @@ bool FontManager::Open(const char *font_name) {
   // Open the font.
   FT_Error err;
   if ((err = FT_New_Memory_Face(
-           *ft_, reinterpret_cast<const unsigned char *>(&font_data_[0]),
-           font_data_.size(), 0, &face_))) {
+           *ft_, font_data_.data(), font_data_.size(), 0, &face_))) {
     // Failed to open font.
     SDL_LogError(SDL_LOG_CATEGORY_ERROR,
                  "Failed to initialize font:%s FT_Error:%d\n", font_name, err);
@@ -412,27 +586,36 @@ bool FontManager::Open(const char *font_name) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR,
                  "Failed to initialize harfbuzz layout information:%s\n",
                  font_name);
-    font_data_.clear();
+    font_data_.Close();
     FT_Done_Face(face_);
     return false;
   }
 
+  font_id_++;
   face_initialized_ = true;
+
+  if (async_) {
+    StartTextThread();
+  }
   return true;
 }
 
 bool FontManager::Close() {
   if (!face_initialized_) return false;
 
-  map_textures_.clear();
+  StopTextThread();
+
+  texture_cache_.Clear();
+
+  buffer_cache_.Clear();
 
-  map_buffers_.clear();
+  shaped_text_cache_.Clear();
 
   hb_font_destroy(harfbuzz_font_);
 
   FT_Done_Face(face_);
 
-  font_data_.clear();
+  font_data_.Close();
 
   face_initialized_ = false;
 
@@ -442,62 +625,93 @@ bool FontManager::Close() {
 void FontManager::StartLayoutPass() {
   // Reset pass.
   current_pass_ = 0;
+
+  // Strings used in the previous frame can now be evicted.
+  buffer_cache_.Update();
+  texture_cache_.Update();
+  shaped_text_cache_.Update();
+
+  // Add strings the text thread created since the last layout pass.
+  FinishTextJobs();
 }
 
 void FontManager::UpdatePass(const bool start_subpass) {
   // Increment a cycle counter in glyph cache.
   glyph_cache_->Update();
 
-  if (glyph_cache_->get_dirty_state() && current_pass_ <= 0) {
-    auto rect = glyph_cache_->get_dirty_rect();
-    atlas_texture_.get()->Set(0);
-
-    // In OpenGL ES2.0, width and pitch of the src buffer needs to match. So
-    // that we are updating entire row at once.
-    // TODO: Optimize glTexSubImage2D call in ES3.0 capable platform.
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rect.y(),
-                    glyph_cache_.get()->get_size().x(), rect.w() - rect.y(),
-                    GL_LUMINANCE, GL_UNSIGNED_BYTE,
-                    glyph_cache_.get()->get_buffer() +
-                        glyph_cache_.get()->get_size().x() * rect.y());
-    current_atlas_revision_ = glyph_cache_->get_revision();
-    glyph_cache_->set_dirty_state(false);
-  }
+  if (current_pass_ <= 0) UpdateAtlasTextures();
 
   if (start_subpass) {
     if (current_pass_ > 0) {
       SDL_LogError(SDL_LOG_CATEGORY_ERROR,
                    "Multiple subpasses in one rendering pass is not supported. "
-                   "When this happens, increase the glyph cache size not to "
-                   "flush the atlas texture multiple times in one rendering "
-                   "pass.");
+                   "When this happens, increase the glyph cache size or page "
+                   "count not to flush the atlas texture multiple times in "
+                   "one rendering pass.");
     }
     glyph_cache_->Flush();
     current_atlas_revision_ = glyph_cache_->get_revision();
     current_pass_++;
+
+    // Strings that didn't fit may now.
+    text_job_tracker_.ClearFailures();
   } else {
     // Reset pass.
     current_pass_ = kRenderPass;
   }
 }
 
-uint32_t FontManager::LayoutText(const char *text) {
+void FontManager::UpdateAtlasTextures() {
+  current_atlas_revision_ = glyph_cache_->get_revision();
+  if (!atlas_dirty()) return;
+  for (int32_t i = 0; i < glyph_cache_->get_num_pages(); ++i) {
+    if (i >= static_cast<int32_t>(atlas_textures_.size())) {
+      // The page was added to the cache since the last update.
+      CreateAtlasTexture(i);
+    } else if (glyph_cache_->get_dirty_state(i)) {
+      // Upload only the areas of the rows glyphs were stored in.
+      for (auto &rect : glyph_cache_->get_dirty_rects(i)) {
+        renderer_->UploadTextureRect(
+            atlas_textures_[i]->id(), glyph_cache_->get_buffer(i),
+            glyph_cache_->get_size(), kFormatLuminance, rect.xy(),
+            rect.zw() - rect.xy());
+      }
+      glyph_cache_->set_dirty_state(i, false);
+    }
+  }
+}
+
+void FontManager::CreateAtlasTexture(const int32_t page) {
+  assert(page == static_cast<int32_t>(atlas_textures_.size()));
+  auto texture = new Texture(*renderer_);
+  texture->LoadFromMemory(glyph_cache_->get_buffer(page),
+                          glyph_cache_->get_size(), kFormatLuminance, false);
+
+  // Disable mipmap for the atlas texture.
+  texture->Set(0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  atlas_textures_.push_back(std::unique_ptr<Texture>(texture));
+  glyph_cache_->set_dirty_state(page, false);
+}
+
+uint32_t FontManager::LayoutText(hb_font_t *font, hb_buffer_t *buf,
+                                 const char *text) {
   size_t length = strlen(text);
 
   // TODO: make harfbuzz settings (and other font settings) configurable.
   // Set harfbuzz settings.
-  hb_buffer_set_direction(harfbuzz_buf_, HB_DIRECTION_LTR);
-  hb_buffer_set_script(harfbuzz_buf_, HB_SCRIPT_LATIN);
-  hb_buffer_set_language(harfbuzz_buf_, hb_language_from_string(text, length));
+  hb_buffer_set_direction(buf, kTextDirection);
+  hb_buffer_set_script(buf, kTextScript);
+  hb_buffer_set_language(buf, hb_language_from_string(text, length));
 
   // Layout the text.
-  hb_buffer_add_utf8(harfbuzz_buf_, text, length, 0, length);
-  hb_shape(harfbuzz_font_, harfbuzz_buf_, nullptr, 0);
+  hb_buffer_add_utf8(buf, text, length, 0, length);
+  hb_shape(font, buf, nullptr, 0);
 
   // Retrieve layout info.
   uint32_t glyph_count;
   hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+      hb_buffer_get_glyph_positions(buf, &glyph_count);
 
   // Retrieve a width of the string.
   uint32_t string_width = 0;
@@ -509,22 +723,20 @@ uint32_t FontManager::LayoutText(const char *text) {
   return string_width;
 }
 
-bool FontManager::UpdateMetrics(const FT_GlyphSlot g,
+bool FontManager::UpdateMetrics(const int32_t top, const int32_t rows,
                                 const FontMetrics &current_metrics,
                                 FontMetrics *new_metrics) {
   // Calculate internal/external leading value and expand a buffer if
   // necessary.
-  if (g->bitmap_top > current_metrics.ascender() ||
-      static_cast<int32_t>(g->bitmap_top - g->bitmap.rows) <
-      current_metrics.descender()) {
+  if (top > current_metrics.ascender() ||
+      top - rows < current_metrics.descender()) {
     *new_metrics = current_metrics;
     new_metrics->set_internal_leading(
         std::max(current_metrics.internal_leading(),
-                 g->bitmap_top - current_metrics.ascender()));
+                 top - current_metrics.ascender()));
     new_metrics->set_external_leading(
         std::min(current_metrics.external_leading(),
-                 static_cast<int32_t>(g->bitmap_top - g->bitmap.rows
-                                      - current_metrics.descender())));
+                 top - rows - current_metrics.descender()));
     new_metrics->set_base_line(new_metrics->internal_leading() +
                                new_metrics->ascender());
 
@@ -538,34 +750,254 @@ const GlyphCacheEntry *FontManager::GetCachedEntry(const uint32_t code_point,
   auto cache = glyph_cache_->Find(code_point, ysize);
 
   if (cache == nullptr) {
-    // Load glyph using harfbuzz layout information.
-    // Note that harfbuzz takes care of ligatures.
-    FT_Error err;
-    if ((err = FT_Load_Glyph(face_, code_point, FT_LOAD_RENDER))) {
-      // Error. This could happen typically the loaded font does not support
-      // particular glyph.
-      SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't load glyph %c FT_Error:%d\n",
-                   code_point, err);
+    glyph_buffer_.clear();
+    vec2i size, offset;
+    if (!RasterizeGlyph(face_, code_point, distance_field_, &glyph_buffer_,
+                        &size, &offset)) {
       return nullptr;
     }
+    cache = CacheGlyph(code_point, ysize, glyph_buffer_.data(), size, offset);
+  }
+  return cache;
+}
 
-    // Store the glyph to cache.
-    FT_GlyphSlot g = face_->glyph;
-    GlyphCacheEntry entry;
-    entry.set_code_point(code_point);
-    entry.set_size(vec2i(g->bitmap.width, g->bitmap.rows));
-    entry.set_offset(vec2i(g->bitmap_left, g->bitmap_top));
-    cache = glyph_cache_->Set(g->bitmap.buffer, ysize, entry);
+const GlyphCacheEntry *FontManager::CacheGlyph(const uint32_t code_point,
+                                               const int32_t ysize,
+                                               const uint8_t *image,
+                                               const vec2i &size,
+                                               const vec2i &offset) {
+  // Store the glyph to cache.
+  GlyphCacheEntry entry;
+  entry.set_code_point(code_point);
+  entry.set_size(size);
+  entry.set_offset(offset);
+  auto cache = glyph_cache_->Set(image, ysize, entry);
+  if (cache == nullptr) {
+    // Glyph cache need to be flushed.
+    // Returning nullptr here for a retry.
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Glyph cache is full. Need to flush and re-create.\n");
+  }
+  return cache;
+}
 
-    if (cache == nullptr) {
-      // Glyph cache need to be flushed.
-      // Returning nullptr here for a retry.
-      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                  "Glyph cache is full. Need to flush and re-create.\n");
-      return nullptr;
+bool FontManager::SetDistanceField(const bool enable) {
+  if (enable == distance_field_) return true;
+  if (enable &&
+      (renderer_ == nullptr || !renderer_->supports_standard_derivatives())) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "Distance field glyphs need standard derivatives support.\n");
+    return false;
+  }
+  distance_field_ = enable;
+
+  // Cached glyphs and buffers were created for the other mode.
+  glyph_cache_->Flush();
+  current_atlas_revision_ = glyph_cache_->get_revision();
+  buffer_cache_.Clear();
+  return true;
+}
+
+void FontManager::SetAsync(const bool enable) {
+  async_ = enable;
+  if (!face_initialized_) return;
+  if (enable) {
+    StartTextThread();
+  } else {
+    StopTextThread();
+  }
+}
+
+bool FontManager::StartTextThread() {
+  if (text_thread_ != nullptr) return true;
+
+  // Open the font again for the text thread.
+  FT_Error err;
+  if ((err = FT_Init_FreeType(&text_ft_))) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "Can't initialize freetype. FT_Error:%d\n", err);
+    return false;
+  }
+  if ((err = FT_New_Memory_Face(text_ft_, font_data_.data(), font_data_.size(),
+                                0, &text_face_))) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                 "Failed to initialize font for text thread FT_Error:%d\n",
+                 err);
+    FT_Done_FreeType(text_ft_);
+    return false;
+  }
+  text_harfbuzz_font_ = hb_ft_font_create(text_face_, NULL);
+  text_harfbuzz_buf_ = hb_buffer_create();
+
+  text_thread_stop_ = false;
+  text_mutex_ = SDL_CreateMutex();
+  text_semaphore_ = SDL_CreateSemaphore(0);
+  text_thread_ = SDL_CreateThread(TextThread, "FontManager text", this);
+  if (text_thread_ == nullptr) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't create text thread: %s\n",
+                 SDL_GetError());
+    SDL_DestroySemaphore(text_semaphore_);
+    SDL_DestroyMutex(text_mutex_);
+    hb_buffer_destroy(text_harfbuzz_buf_);
+    hb_font_destroy(text_harfbuzz_font_);
+    FT_Done_Face(text_face_);
+    FT_Done_FreeType(text_ft_);
+    return false;
+  }
+  return true;
+}
+
+void FontManager::StopTextThread() {
+  if (text_thread_ == nullptr) return;
+
+  SDL_LockMutex(text_mutex_);
+  text_thread_stop_ = true;
+  SDL_UnlockMutex(text_mutex_);
+  SDL_SemPost(text_semaphore_);
+  SDL_WaitThread(text_thread_, nullptr);
+  text_thread_ = nullptr;
+
+  SDL_DestroySemaphore(text_semaphore_);
+  SDL_DestroyMutex(text_mutex_);
+  hb_buffer_destroy(text_harfbuzz_buf_);
+  hb_font_destroy(text_harfbuzz_font_);
+  FT_Done_Face(text_face_);
+  FT_Done_FreeType(text_ft_);
+
+  // Unfinished strings are created again on demand.
+  text_jobs_.clear();
+  finished_text_jobs_.clear();
+  text_job_tracker_.Clear();
+}
+
+void FontManager::QueueTextJob(const uint64_t key, const char *text,
+                               const float ysize) {
+  if (!text_job_tracker_.Queue(key)) return;
+
+  std::unique_ptr<TextJob> job(new TextJob());
+  InitTextJob(key, text, ysize, job.get());
+
+  // Only rasterize the string on the text thread if it's been shaped before.
+  auto shaped_key = FontCache<ShapedText>::Key(text, job->converted_ysize,
+                                               font_id_, kTextLayout);
+  auto shaped = shaped_text_cache_.Find(shaped_key, text);
+  if (shaped != nullptr) {
+    job->shaped.reset(new ShapedText(*shaped));
+  }
+
+  SDL_LockMutex(text_mutex_);
+  text_jobs_.push_back(std::move(job));
+  SDL_UnlockMutex(text_mutex_);
+  SDL_SemPost(text_semaphore_);
+}
+
+void FontManager::FinishTextJobs() {
+  if (text_thread_ == nullptr) return;
+
+  std::deque<std::unique_ptr<TextJob>> finished;
+  SDL_LockMutex(text_mutex_);
+  finished.swap(finished_text_jobs_);
+  SDL_UnlockMutex(text_mutex_);
+
+  for (auto &job : finished) {
+    // Drop strings created for a mode that changed since they were queued.
+    if (job->distance_field != distance_field_) {
+      text_job_tracker_.Finish(job->key);
+      continue;
+    }
+
+    // Share the shaped string with the cache.
+    auto shaped_key = FontCache<ShapedText>::Key(
+        job->text.c_str(), job->converted_ysize, font_id_, kTextLayout);
+    auto shaped = shaped_text_cache_.Find(shaped_key, job->text.c_str());
+    if (shaped == nullptr) {
+      auto memory = job->shaped->memory();
+      shaped = shaped_text_cache_.Insert(shaped_key, job->text.c_str(),
+                                         std::move(job->shaped), memory);
+    }
+
+    auto buffer = CreateBuffer(*job, *shaped);
+    if (!buffer) {
+      text_job_tracker_.Fail(job->key);
+      continue;
+    }
+    text_job_tracker_.Finish(job->key);
+    auto memory = buffer->memory();
+    buffer_cache_.Insert(job->key, job->text.c_str(), std::move(buffer),
+                         memory);
+  }
+}
+
+int FontManager::TextThread(void *data) {
+  static_cast<FontManager *>(data)->TextWorker();
+  return 0;
+}
+
+void FontManager::TextWorker() {
+  for (;;) {
+    SDL_SemWait(text_semaphore_);
+
+    std::unique_ptr<TextJob> job;
+    SDL_LockMutex(text_mutex_);
+    if (!text_thread_stop_ && !text_jobs_.empty()) {
+      job = std::move(text_jobs_.front());
+      text_jobs_.pop_front();
+    }
+    SDL_UnlockMutex(text_mutex_);
+    if (!job) return;
+
+    if (!job->shaped) {
+      job->shaped.reset(new ShapedText());
+      ShapeText(text_face_, text_harfbuzz_font_, text_harfbuzz_buf_,
+                job->text.c_str(), job->converted_ysize, job->shaped.get());
+    }
+    RasterizeGlyphs(text_face_, job.get());
+
+    SDL_LockMutex(text_mutex_);
+    finished_text_jobs_.push_back(std::move(job));
+    SDL_UnlockMutex(text_mutex_);
+  }
+}
+
+void FontManager::GenerateDistanceField(const uint8_t *bitmap,
+                                        const int32_t width,
+                                        const int32_t height,
+                                        const int32_t pitch,
+                                        const int32_t spread, uint8_t *dest) {
+  // A pixel is inside the glyph if its coverage is at least half.
+  auto inside = [&](int32_t x, int32_t y) {
+    return x >= 0 && y >= 0 && x < width && y < height &&
+           bitmap[y * pitch + x] >= 128;
+  };
+
+  // For each pixel, search the nearest pixel on the other side of the edge
+  // within the spread. Glyphs are small, so a brute force search is fast
+  // enough, and it's only done once per glyph.
+  const int32_t dest_width = width + spread * 2;
+  const int32_t dest_height = height + spread * 2;
+  const int32_t max_distance_sq = spread * spread;
+  for (int32_t y = 0; y < dest_height; ++y) {
+    for (int32_t x = 0; x < dest_width; ++x) {
+      auto sx = x - spread;
+      auto sy = y - spread;
+      auto is_inside = inside(sx, sy);
+      auto distance_sq = max_distance_sq;
+      for (int32_t dy = -spread; dy <= spread; ++dy) {
+        for (int32_t dx = -spread; dx <= spread; ++dx) {
+          auto d = dx * dx + dy * dy;
+          if (d < distance_sq && inside(sx + dx, sy + dy) != is_inside) {
+            distance_sq = d;
+          }
+        }
+      }
+
+      // The edge lies half way between the two pixels.
+      auto distance = sqrtf(static_cast<float>(distance_sq)) - 0.5f;
+      if (!is_inside) distance = -distance;
+      dest[y * dest_width + x] = static_cast<uint8_t>(mathfu::Clamp(
+          128.0f + distance * 127.0f / spread, 0.0f, 255.0f));
     }
   }
-  return cache;
 }
 
 int32_t FontManager::ConvertSize(const int32_t original_ysize) {
@@ -602,4 +1034,120 @@ void FontBuffer::UpdateUV(const int32_t index, const vec4 &uv) {
   vertices_[index * 4 + 3].uv_ = uv.zw();
 }
 
+TextBatch::~TextBatch() {
+  if (vbo_) GL_CALL(glDeleteBuffers(1, &vbo_));
+  if (ibo_) GL_CALL(glDeleteBuffers(1, &ibo_));
+}
+
+void TextBatch::Add(const FontBuffer &buffer,
+                    const std::vector<std::unique_ptr<Texture>> &atlases,
+                    const vec3 &pos, const vec4 &color) {
+  auto src_vertices = buffer.get_vertices();
+  auto src_pages = buffer.get_pages();
+
+  uint8_t packed_color[4];
+  for (int i = 0; i < 4; ++i) {
+    packed_color[i] = static_cast<uint8_t>(
+        mathfu::Clamp(color[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+
+  Page *page = nullptr;
+  for (size_t glyph = 0; glyph < src_pages->size(); ++glyph) {
+    auto atlas = atlases[(*src_pages)[glyph]].get();
+
+    // Find the page of the atlas, unless it's the same as the last glyph's.
+    // Indices are 16 bit, so a page that would overflow them is followed by
+    // another page for the same atlas.
+    if (page == nullptr || page->atlas != atlas ||
+        page->vertices.size() + FontBuffer::kVerticesPerCodePoint > 0x10000) {
+      page = nullptr;
+      for (size_t i = 0; i < num_pages_; ++i) {
+        if (pages_[i].atlas == atlas &&
+            pages_[i].vertices.size() + FontBuffer::kVerticesPerCodePoint <=
+                0x10000) {
+          page = &pages_[i];
+          break;
+        }
+      }
+      if (page == nullptr) {
+        if (num_pages_ == pages_.size()) pages_.push_back(Page());
+        page = &pages_[num_pages_++];
+        page->atlas = atlas;
+        page->vertices.clear();
+        page->indices.clear();
+      }
+    }
+
+    auto base_vertex = static_cast<uint16_t>(page->vertices.size());
+    auto src = &(*src_vertices)[glyph * FontBuffer::kVerticesPerCodePoint];
+    for (int32_t i = 0; i < FontBuffer::kVerticesPerCodePoint; ++i) {
+      Vertex vertex;
+      vertex.position = vec3(src[i].position_) + pos;
+      vertex.uv = src[i].uv_;
+      memcpy(vertex.color, packed_color, sizeof(packed_color));
+      page->vertices.push_back(vertex);
+    }
+    const uint16_t kIndices[] = {0, 1, 2, 1, 2, 3};
+    for (auto index : kIndices) {
+      page->indices.push_back(base_vertex + index);
+    }
+  }
+}
+
+void TextBatch::Render(Renderer &renderer, Shader *shader) {
+  if (empty()) return;
+
+  // Size the buffers to fit all pages, and upload them.
+  size_t vertices_size = 0;
+  size_t indices_size = 0;
+  for (size_t i = 0; i < num_pages_; ++i) {
+    vertices_size += pages_[i].vertices.size() * sizeof(Vertex);
+    indices_size += pages_[i].indices.size() * sizeof(uint16_t);
+  }
+  MeshPool::Unbind();
+  if (!vbo_) GL_CALL(glGenBuffers(1, &vbo_));
+  if (!ibo_) GL_CALL(glGenBuffers(1, &ibo_));
+  // Respecifying the storage every frame orphans the previous one, so the
+  // driver doesn't have to wait for draws still reading from it.
+  vbo_size_ = std::max(vbo_size_, vertices_size);
+  ibo_size_ = std::max(ibo_size_, indices_size);
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo_));
+  GL_CALL(
+      glBufferData(GL_ARRAY_BUFFER, vbo_size_, nullptr, GL_DYNAMIC_DRAW));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_));
+  GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, ibo_size_, nullptr,
+                       GL_DYNAMIC_DRAW));
+  size_t vertex_offset = 0;
+  size_t index_offset = 0;
+  for (size_t i = 0; i < num_pages_; ++i) {
+    auto &page = pages_[i];
+    auto size = page.vertices.size() * sizeof(Vertex);
+    GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, vertex_offset, size,
+                            page.vertices.data()));
+    vertex_offset += size;
+    size = page.indices.size() * sizeof(uint16_t);
+    GL_CALL(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, index_offset, size,
+                            page.indices.data()));
+    index_offset += size;
+  }
+
+  // Draw each page.
+  static const Attribute kFormat[] = {kPosition3f, kTexCoord2f, kColor4ub,
+                                      kEND};
+  shader->Set(renderer);
+  vertex_offset = 0;
+  index_offset = 0;
+  for (size_t i = 0; i < num_pages_; ++i) {
+    auto &page = pages_[i];
+    page.atlas->Set(0);
+    Mesh::RenderArray(GL_TRIANGLES, static_cast<int>(page.indices.size()),
+                      kFormat, sizeof(Vertex), vbo_, vertex_offset, ibo_,
+                      index_offset);
+    vertex_offset += page.vertices.size() * sizeof(Vertex);
+    index_offset += page.indices.size() * sizeof(uint16_t);
+  }
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+  num_pages_ = 0;
+}
+
 }  // namespace fpl
@@ -15,9 +15,14 @@
 #ifndef FONT_MANAGER_H
 #define FONT_MANAGER_H
 
+#include "asset_file.h"
 #include "renderer.h"
+#include "font_cache.h"
 #include "glyph_cache.h"
 #include "common.h"
+#include "mesh.h"
+
+#include <string>
 
 // Forward decls for FreeType & Harfbuzz
 typedef struct FT_LibraryRec_ *FT_Library;
@@ -43,6 +48,97 @@ const int32_t kFreeTypeUnit = 64;
 const int32_t kGlyphCacheWidth = 1024;
 const int32_t kGlyphCacheHeight = 1024;
 
+// Glyph size in pixels and spread of the distance in pixels at that size, used
+// to rasterize glyphs in distance field mode (see SetDistanceField()).
+const int32_t kDistanceFieldGlyphSize = 32;
+const int32_t kDistanceFieldSpread = 4;
+
+// Default maximum number of glyph cache pages, each a separate atlas texture
+// of the size above.
+const int32_t kGlyphCacheMaxPages = 4;
+
+// Default memory budgets of the FontBuffer, FontTexture and ShapedText caches
+// in bytes.
+const size_t kFontBufferCacheBudget = 256 * 1024;
+const size_t kFontTextureCacheBudget = 2 * 1024 * 1024;
+const size_t kShapedTextCacheBudget = 128 * 1024;
+
+// A string shaped by HarfBuzz at a size in pixels.
+// FontManager caches them, so that GetBuffer() and GetTexture() of the same
+// string, and rebuilding a FontBuffer, don't shape it again.
+struct ShapedText {
+  // Glyph of the shaped string, with advances in FreeType units.
+  struct Glyph {
+    uint32_t code_point;
+    int32_t x_advance;
+    int32_t y_advance;
+  };
+
+  ShapedText() : string_width(0) {}
+
+  // Memory taken up by the string in bytes.
+  size_t memory() const {
+    return sizeof(*this) + glyphs.capacity() * sizeof(Glyph);
+  }
+
+  // Width of the string in pixels.
+  uint32_t string_width;
+
+  std::vector<Glyph> glyphs;
+};
+
+// Text batch class
+// Collects the glyphs of many FontBuffers rendered in a frame, and draws them
+// with one draw call per atlas texture from a vertex buffer that is reused
+// across frames.
+// Since drawing is deferred until Render(), the caller needs to render the
+// batch before the contents of an atlas texture it refers to change, e.g.
+// before starting a sub pass with FontManager::StartRenderPass().
+class TextBatch {
+ public:
+  TextBatch() : vbo_(0), ibo_(0), vbo_size_(0), ibo_size_(0), num_pages_(0) {}
+  ~TextBatch();
+
+  // Add glyphs of the buffer to the batch, offset by 'pos' and tinted with
+  // 'color'. The glyphs are sampled from 'atlases', indexed by the glyph cache
+  // page of each glyph (see FontManager::atlas_textures()).
+  void Add(const FontBuffer &buffer,
+           const std::vector<std::unique_ptr<Texture>> &atlases,
+           const vec3 &pos, const vec4 &color);
+
+  // Draw all glyphs added since the last call using 'shader', and empty the
+  // batch. The shader takes the color from the aColor attribute.
+  void Render(Renderer &renderer, Shader *shader);
+
+  // Returns true if nothing was added since the last Render().
+  bool empty() const { return num_pages_ == 0; }
+
+ private:
+  struct Vertex {
+    mathfu::vec3_packed position;
+    mathfu::vec2_packed uv;
+    uint8_t color[4];
+  };
+
+  // Glyphs from a single atlas texture, drawn in a single call.
+  // Pages are reused across frames to keep their allocations.
+  struct Page {
+    Texture *atlas;
+    std::vector<Vertex> vertices;
+    std::vector<uint16_t> indices;
+  };
+
+  // Vertex and index buffer holding all pages while rendering.
+  GLuint vbo_;
+  GLuint ibo_;
+  size_t vbo_size_;
+  size_t ibo_size_;
+
+  // Pages in use are the first num_pages_ entries.
+  std::vector<Page> pages_;
+  size_t num_pages_;
+};
+
 // FontManager manages font rendering with OpenGL utilizing freetype
 // and harfbuzz as a glyph rendering and layout back end.
 //
@@ -50,14 +146,17 @@ const int32_t kGlyphCacheHeight = 1024;
 // An application can use the generated texture for a text rendering.
 //
 // The class is not threadsafe, it's expected to be only used from
-// within OpenGL rendering thread.
+// within OpenGL rendering thread. In async mode (see SetAsync()), it shapes
+// and rasterizes strings on its own worker thread.
 class FontManager {
  public:
   FontManager();
-  // Constructor with a cache size in pixels.
+  // Constructor with a cache page size in pixels and a maximum number of
+  // pages.
   // The given size is rounded up to nearest power of 2 internally to be used as
   // an OpenGL texture sizes.
-  FontManager(const mathfu::vec2i &cache_size);
+  FontManager(const mathfu::vec2i &cache_size,
+              const int32_t max_pages = kGlyphCacheMaxPages);
   ~FontManager();
 
   // Open font face, TTF, OT fonts are supported.
@@ -79,21 +178,38 @@ class FontManager {
   // Returns nullptr if the string does not fit in the glyph cache.
   // When this happens, caller may flush the glyph cache with
   // FlushAndUpdate() call and re-try the GetBuffer() call.
+  // In async mode, a string not in the cache is queued to the text thread and
+  // an empty placeholder buffer is returned until the string is ready, which
+  // is usually the next layout pass. If it then doesn't fit, the next call
+  // returns nullptr.
   FontBuffer *GetBuffer(const char *text, const float ysize);
 
+  // Request a string to be shaped and rasterized ahead of time, e.g. for the
+  // next screen of a menu, so that GetBuffer() finds it in the cache.
+  // In async mode, this queues the string to the text thread and returns
+  // immediately. Otherwise, it's the same as GetBuffer().
+  void PrefetchBuffer(const char *text, const float ysize);
+
+  // Enable or disable async mode.
+  // In async mode, HarfBuzz shaping and FreeType rasterization of strings
+  // requested with GetBuffer() or PrefetchBuffer() run on a worker thread, so
+  // new text doesn't stall the frame. Finished strings are added to the cache
+  // in StartLayoutPass(), and their glyphs are uploaded to the atlas
+  // textures in the render pass as usual.
+  void SetAsync(const bool enable);
+
+  // Returns if async mode is enabled.
+  bool async() const { return async_; }
+
   // Set renderer. Renderer is used to create a texture instance.
   void SetRenderer(Renderer &renderer) {
     renderer_ = &renderer;
 
-    // Initialize the font atlas texture.
-    atlas_texture_.reset(new Texture(renderer));
-    atlas_texture_.get()->LoadFromMemory(glyph_cache_->get_buffer(),
-                                         glyph_cache_->get_size(),
-                                         kFormatLuminance, false);
-
-    // Disable mipmap for the atlas texture.
-    atlas_texture_.get()->Set(0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // Initialize the font atlas textures.
+    atlas_textures_.clear();
+    for (int32_t i = 0; i < glyph_cache_->get_num_pages(); ++i) {
+      CreateAtlasTexture(i);
+    }
   }
 
   // Returns if a font has been loaded.
@@ -121,8 +237,35 @@ class FontManager {
   // a render pass.
   void StartRenderPass() { UpdatePass(false); }
 
-  // Getter of the font atlas texture.
-  Texture *GetAtlasTexture() { return atlas_texture_.get(); }
+  // Create the atlas textures of pages added to the glyph cache, and upload
+  // the glyphs stored since the last upload. StartRenderPass() does this too,
+  // call it to render glyphs cached after that, e.g. by GetBuffer() calls in
+  // the render pass. Render the TextBatch first, as the upload may overwrite
+  // glyphs of the FontBuffers added to it.
+  void UpdateAtlasTextures();
+
+  // Returns true if the atlas textures don't match the glyph cache contents,
+  // i.e. UpdateAtlasTextures() has something to do.
+  bool atlas_dirty() const {
+    return glyph_cache_->get_num_pages() !=
+               static_cast<int32_t>(atlas_textures_.size()) ||
+           glyph_cache_->get_dirty_state();
+  }
+
+  // Getter of the font atlas texture of a glyph cache page.
+  // Glyphs of a FontBuffer may be spread over multiple pages, see
+  // FontBuffer::get_pages().
+  Texture *GetAtlasTexture(const int32_t page = 0) {
+    return atlas_textures_[page].get();
+  }
+
+  // Getter of the font atlas textures, indexed by glyph cache page.
+  const std::vector<std::unique_ptr<Texture>> &atlas_textures() const {
+    return atlas_textures_;
+  }
+
+  // Getter of the batch that collects FontBuffers to render them together.
+  TextBatch &text_batch() { return text_batch_; }
 
   // The user can supply a size selector function to adjust glyph sizes when
   // storing a glyph cache entry.
@@ -136,6 +279,45 @@ class FontManager {
     size_selector_.swap(selector);
   }
 
+  // Enable or disable distance field mode for GetBuffer().
+  // In this mode, each glyph is rasterized once at kDistanceFieldGlyphSize as
+  // a signed distance field, and that cache entry is scaled to any requested
+  // size. Text then needs to be rendered with a shader that reconstructs the
+  // edges from the distance, such as "shaders/font_batched" compiled with
+  // kShaderFeatureDistanceField.
+  // Changing the mode flushes the glyph cache.
+  // That shader needs derivatives, so this returns false and stays in bitmap
+  // mode if the renderer doesn't support them, or hasn't been set yet.
+  bool SetDistanceField(const bool enable);
+
+  // Returns if distance field mode is enabled.
+  bool distance_field() const { return distance_field_; }
+
+  // Set memory budgets in bytes of the caches used by GetBuffer() and
+  // GetTexture(). 0 means unlimited.
+  // Strings not used in the current layout pass are evicted in least recently
+  // used order when a cache exceeds its budget.
+  void set_buffer_cache_budget(const size_t budget) {
+    buffer_cache_.set_memory_budget(budget);
+  }
+  void set_texture_cache_budget(const size_t budget) {
+    texture_cache_.set_memory_budget(budget);
+  }
+  void set_shaped_text_cache_budget(const size_t budget) {
+    shaped_text_cache_.set_memory_budget(budget);
+  }
+
+  // Getters of the caches, e.g. to query hit/miss stats, or the fill ratio
+  // and eviction rate of the glyph cache.
+  const FontCache<FontBuffer> &buffer_cache() const { return buffer_cache_; }
+  const FontCache<FontTexture> &texture_cache() const {
+    return texture_cache_;
+  }
+  const FontCache<ShapedText> &shaped_text_cache() const {
+    return shaped_text_cache_;
+  }
+  const GlyphCache<uint8_t> &glyph_cache() const { return *glyph_cache_; }
+
  private:
   // Pass indicating rendering pass.
   static const int32_t kRenderPass = -1;
@@ -155,14 +337,76 @@ class FontManager {
                            const FontMetrics &new_metrics,
                            std::unique_ptr<uint8_t[]> *image);
 
-  // Layout text and update harfbuzz_buf_.
+  // A string for the text thread to create a FontBuffer for, and the results
+  // of shaping it and rasterizing its glyphs.
+  struct TextJob {
+    // Rasterized glyph image, stored at 'offset' in 'image_data'.
+    struct Image {
+      uint32_t code_point;
+      int32_t width;
+      int32_t height;
+      int32_t left;
+      int32_t top;
+      size_t offset;
+    };
+
+    uint64_t key;
+    std::string text;
+    float ysize;
+    int32_t converted_ysize;
+    int32_t glyph_size;
+    bool distance_field;
+    uint32_t font_id;
+
+    // The shaped string at converted_ysize. Taken from the cache when the job
+    // is queued, if it's there, otherwise the text thread shapes it.
+    std::unique_ptr<ShapedText> shaped;
+    std::vector<Image> images;
+    std::vector<uint8_t> image_data;
+  };
+
+  // Layout text and update the harfbuzz buffer.
   // Returns the width of the text layout in pixels.
-  uint32_t LayoutText(const char *text);
-
-  // Calculate internal/external leading value and expand a buffer if
-  // necessary.
+  static uint32_t LayoutText(hb_font_t *font, hb_buffer_t *buf,
+                             const char *text);
+
+  // Setup a job for a string with current settings.
+  void InitTextJob(const uint64_t key, const char *text, const float ysize,
+                   TextJob *job);
+
+  // Shape a string at a size in pixels with the given face.
+  // The function only touches the given FreeType & Harfbuzz instances, so the
+  // text thread calls it with its own.
+  static void ShapeText(FT_Face face, hb_font_t *font, hb_buffer_t *buf,
+                        const char *text, const int32_t ysize,
+                        ShapedText *shaped);
+
+  // Render the glyphs of a job's shaped string into the job.
+  static void RasterizeGlyphs(FT_Face face, TextJob *job);
+
+  // Retrieve a shaped string from the cache, shaping it if it's not there.
+  const ShapedText *GetShapedText(const char *text, const int32_t ysize);
+
+  // Render a glyph of the face's current size, appending the image to
+  // 'image'. In distance field mode the image is a distance field, padded by
+  // kDistanceFieldSpread on each side.
+  // Returns false if the font doesn't have the glyph.
+  static bool RasterizeGlyph(FT_Face face, const uint32_t code_point,
+                             const bool distance_field,
+                             std::vector<uint8_t> *image, vec2i *size,
+                             vec2i *offset);
+
+  // Create a FontBuffer for the string of a job, shaped at its converted
+  // size. Glyphs missing from the glyph cache are taken from the job's
+  // images, or rasterized if it has none.
+  // Returns nullptr if the glyphs don't fit in the glyph cache.
+  std::unique_ptr<FontBuffer> CreateBuffer(const TextJob &job,
+                                           const ShapedText &shaped);
+
+  // Calculate internal/external leading value of a glyph with the given top
+  // bearing and height, and expand a buffer if necessary.
   // Returns true if the size of metrics has been changed.
-  bool UpdateMetrics(const FT_GlyphSlot glyph,
+  bool UpdateMetrics(const int32_t top, const int32_t rows,
                      const FontMetrics &current_metrics,
                      FontMetrics *new_metrics);
 
@@ -177,6 +421,28 @@ class FontManager {
   const GlyphCacheEntry *GetCachedEntry(const uint32_t code_point,
                                         const int32_t y_size);
 
+  // Store a rasterized glyph image in the glyph cache.
+  // Returns nullptr if the glyph doesn't fit into the cache.
+  const GlyphCacheEntry *CacheGlyph(const uint32_t code_point,
+                                    const int32_t ysize, const uint8_t *image,
+                                    const vec2i &size, const vec2i &offset);
+
+  // Start and stop the text thread used in async mode.
+  // The thread has its own FreeType & Harfbuzz instances of the opened font,
+  // since FreeType faces can't be used from multiple threads.
+  bool StartTextThread();
+  void StopTextThread();
+
+  // Queue a string to the text thread, unless it's queued already.
+  void QueueTextJob(const uint64_t key, const char *text, const float ysize);
+
+  // Add strings the text thread finished to the cache.
+  void FinishTextJobs();
+
+  // Entry point of the text thread.
+  static int TextThread(void *data);
+  void TextWorker();
+
   // Update font manager, check glyph cache if the texture atlas needs to be
   // updated.
   // If start_subpass == true,
@@ -189,6 +455,22 @@ class FontManager {
   // Returns nullptr if one of UV values couldn't be updated.
   FontBuffer *UpdateUV(const int32_t ysize, FontBuffer *buffer);
 
+  // Create the atlas texture of a glyph cache page, uploading its contents.
+  void CreateAtlasTexture(const int32_t page);
+
+  // Returns the size glyphs of a converted size are rasterized at.
+  int32_t GlyphSize(const int32_t converted_ysize) const {
+    return distance_field_ ? kDistanceFieldGlyphSize : converted_ysize;
+  }
+
+  // Generate a signed distance field of a glyph bitmap into 'dest'.
+  // 'dest' is 'spread' pixels larger than the bitmap on each side. The edge
+  // maps to 128, values rise to 255 at 'spread' pixels inside the glyph and
+  // fall to 0 at 'spread' pixels outside.
+  static void GenerateDistanceField(const uint8_t *bitmap, const int32_t width,
+                                    const int32_t height, const int32_t pitch,
+                                    const int32_t spread, uint8_t *dest);
+
   // Convert requested glyph size using SizeSelector if it's set.
   int32_t ConvertSize(const int32_t size);
 
@@ -204,24 +486,25 @@ class FontManager {
 
   // Opened font file data.
   // The file needs to be kept open until FreeType finishes using the file.
-  std::string font_data_;
+  AssetFile font_data_;
 
   // flag indicating if a font file has loaded.
   bool face_initialized_;
 
+  // Id of the opened font, part of the cache keys.
+  // Incremented each time a font is opened.
+  uint32_t font_id_;
+
   // Texture cache for a rendered string image.
-  // Using the std::string & its' vertical size in pixels (int32_t) as keys.
-  // The map is used for GetTexture() API.
-  std::unordered_map<std::string,
-                     std::unordered_map<int32_t, std::unique_ptr<FontTexture>>>
-      map_textures_;
+  // The cache is used for GetTexture() API.
+  FontCache<FontTexture> texture_cache_;
 
   // Cache for a texture atlas + vertex array rendering.
-  // Using the std:;string & its' vertical size in pixels (int32_t) as keys.
-  // The map is used for GetBuffer() API.
-  std::unordered_map<std::string,
-                     std::unordered_map<int32_t, std::unique_ptr<FontBuffer>>>
-      map_buffers_;
+  // The cache is used for GetBuffer() API.
+  FontCache<FontBuffer> buffer_cache_;
+
+  // Cache of shaped strings, used by both of the APIs above.
+  FontCache<ShapedText> shaped_text_cache_;
 
   // Singleton instance of Freetype library.
   static FT_Library *ft_;
@@ -235,8 +518,8 @@ class FontManager {
   // Current atlas texture's contents revision.
   uint32_t current_atlas_revision_;
 
-  // Unique pointer to a font atlas texture.
-  std::unique_ptr<Texture> atlas_texture_;
+  // Font atlas textures, one per glyph cache page.
+  std::vector<std::unique_ptr<Texture>> atlas_textures_;
 
   // Current pass counter.
   // Current implementation only supports up to 2 passes in a rendering cycle.
@@ -244,6 +527,41 @@ class FontManager {
 
   // Size selector function object used to adjust a glyph size.
   std::function<int32_t(const int32_t)> size_selector_;
+
+  // Flag indicating if glyphs are cached as distance fields.
+  bool distance_field_;
+
+  // Buffer a glyph is rasterized in before caching.
+  std::vector<uint8_t> glyph_buffer_;
+
+  // Flag indicating if strings are created on the text thread.
+  bool async_;
+
+  // The text thread and its own FreeType & Harfbuzz instances.
+  SDL_Thread *text_thread_;
+  FT_Library text_ft_;
+  FT_Face text_face_;
+  hb_font_t *text_harfbuzz_font_;
+  hb_buffer_t *text_harfbuzz_buf_;
+
+  // Jobs waiting for the text thread and jobs it finished.
+  // Both queues and text_thread_stop_ are protected by text_mutex_, and
+  // text_semaphore_ counts queued jobs.
+  std::deque<std::unique_ptr<TextJob>> text_jobs_;
+  std::deque<std::unique_ptr<TextJob>> finished_text_jobs_;
+  bool text_thread_stop_;
+  SDL_mutex *text_mutex_;
+  SDL_semaphore *text_semaphore_;
+
+  // Strings queued to the text thread and not yet in the cache, and those
+  // that didn't fit.
+  TextJobTracker text_job_tracker_;
+
+  // Empty buffer returned by GetBuffer() while a string is being created.
+  std::unique_ptr<FontBuffer> placeholder_buffer_;
+
+  // Batch of strings to render.
+  TextBatch text_batch_;
 };
 
 // Font texture class inherits Texture publicly.
@@ -380,13 +698,14 @@ class FontBuffer {
   static const int32_t kIndiciesPerCodePoint = 6;
   static const int32_t kVerticesPerCodePoint = 4;
 
-  FontBuffer() : revision_(0) {}
+  FontBuffer() : revision_(0), pass_(0) {}
 
   // Constructor with a buffer sizse.
-  FontBuffer(uint32_t size) : revision_(0) {
+  FontBuffer(uint32_t size) : revision_(0), pass_(0) {
     indices_.reserve(size * kIndiciesPerCodePoint);
     vertices_.reserve(size * kVerticesPerCodePoint);
     code_points_.reserve(size);
+    pages_.reserve(size);
   }
   ~FontBuffer() {}
 
@@ -406,6 +725,10 @@ class FontBuffer {
   std::vector<uint32_t> *get_code_points() { return &code_points_; }
   const std::vector<uint32_t> *get_code_points() const { return &code_points_; }
 
+  // Getter of the glyph cache pages array, the page of each code point.
+  std::vector<int32_t> *get_pages() { return &pages_; }
+  const std::vector<int32_t> *get_pages() const { return &pages_; }
+
   // Getter/Setter of the size of the string.
   const vec2i &get_size() const { return size_; }
   void set_size(const vec2i &size) { size_ = size; }
@@ -433,10 +756,19 @@ class FontBuffer {
   // bottom right of UV value s wz component of the vector.
   void UpdateUV(const int32_t index, const vec4 &uv);
 
+  // Memory used by the buffer in bytes.
+  size_t memory() const {
+    return sizeof(*this) + indices_.capacity() * sizeof(uint16_t) +
+           vertices_.capacity() * sizeof(FontVertex) +
+           code_points_.capacity() * sizeof(uint32_t) +
+           pages_.capacity() * sizeof(int32_t);
+  }
+
   // Verify sizes of arrays used in the buffer are correct.
   bool Verify() {
     assert(vertices_.size() == code_points_.size() * kVerticesPerCodePoint);
     assert(indices_.size() == code_points_.size() * kIndiciesPerCodePoint);
+    assert(pages_.size() == code_points_.size());
     return true;
   }
 
@@ -458,6 +790,9 @@ class FontBuffer {
   // entries when the glyph cache is flushed.
   std::vector<uint32_t> code_points_;
 
+  // Glyph cache pages holding the code points.
+  std::vector<int32_t> pages_;
+
   // Size of the string in pixels.
   vec2i size_;
 
@@ -0,0 +1,82 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "frustum.h"
+
+namespace fpl {
+
+void FrustumCuller::Begin(const mat4 &view_projection) {
+  // Gribb & Hartmann: each plane is the last row of the matrix plus or minus
+  // one of the others.
+  const mat4 &m = view_projection;
+  const vec4 row[4] = {vec4(m(0, 0), m(0, 1), m(0, 2), m(0, 3)),
+                       vec4(m(1, 0), m(1, 1), m(1, 2), m(1, 3)),
+                       vec4(m(2, 0), m(2, 1), m(2, 2), m(2, 3)),
+                       vec4(m(3, 0), m(3, 1), m(3, 2), m(3, 3))};
+  for (int i = 0; i < 3; i++) {
+    planes_[i * 2] = row[3] + row[i];
+    planes_[i * 2 + 1] = row[3] - row[i];
+  }
+  for (int i = 0; i < 6; i++) {
+    planes_[i] /= planes_[i].xyz().Length();
+  }
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  radius_.clear();
+  count_ = 0;
+  num_visible_ = 0;
+}
+
+int FrustumCuller::AddSphere(const vec3 &center, float radius) {
+  x_.push_back(center.x());
+  y_.push_back(center.y());
+  z_.push_back(center.z());
+  radius_.push_back(radius);
+  return count_++;
+}
+
+void FrustumCuller::Cull() {
+  // Pad to a multiple of 4 so the loop below needs no remainder handling.
+  const size_t padded_count = (count_ + 3) & ~3;
+  x_.resize(padded_count, 0.0f);
+  y_.resize(padded_count, 0.0f);
+  z_.resize(padded_count, 0.0f);
+  radius_.resize(padded_count, 0.0f);
+  visible_.resize(padded_count);
+
+  num_visible_ = 0;
+  for (size_t i = 0; i < padded_count; i += 4) {
+    const vec4 x(x_[i], x_[i + 1], x_[i + 2], x_[i + 3]);
+    const vec4 y(y_[i], y_[i + 1], y_[i + 2], y_[i + 3]);
+    const vec4 z(z_[i], z_[i + 1], z_[i + 2], z_[i + 3]);
+    const vec4 radius(radius_[i], radius_[i + 1], radius_[i + 2],
+                      radius_[i + 3]);
+    // A sphere is outside if it's entirely behind any of the planes.
+    bool inside[4] = {true, true, true, true};
+    for (int p = 0; p < 6; p++) {
+      const vec4 &plane = planes_[p];
+      const vec4 distance = x * plane.x() + y * plane.y() + z * plane.z() +
+                            vec4(plane.w()) + radius;
+      for (int j = 0; j < 4; j++) inside[j] = inside[j] && distance[j] >= 0.0f;
+    }
+    for (int j = 0; j < 4; j++) {
+      visible_[i + j] = inside[j];
+      if (inside[j] && static_cast<int>(i) + j < count_) num_visible_++;
+    }
+  }
+}
+
+}  // namespace fpl
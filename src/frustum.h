@@ -0,0 +1,70 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_FRUSTUM_H
+#define FPL_FRUSTUM_H
+
+#include "common.h"
+
+namespace fpl {
+
+using mathfu::mat4;
+using mathfu::vec3;
+using mathfu::vec4;
+
+// Tests batches of bounding spheres against a view frustum, to find out which
+// objects can be skipped when rendering.
+// Spheres are stored in structure-of-arrays layout, and tested four at a time
+// with vector math.
+class FrustumCuller {
+ public:
+  FrustumCuller() : count_(0), num_visible_(0) {}
+
+  // Extracts the six frustum planes from 'view_projection', which takes world
+  // space to clip space. Forgets all spheres of the previous batch.
+  void Begin(const mat4 &view_projection);
+
+  // Adds a sphere to the batch. Returns its index, to query visible() with.
+  int AddSphere(const vec3 &center, float radius);
+
+  // Tests all spheres added since Begin().
+  void Cull();
+
+  // Whether the sphere at 'index' is at least partially inside the frustum.
+  // Only valid after Cull().
+  bool visible(int index) const { return visible_[index] != 0; }
+
+  // Statistics of the last Cull().
+  int num_visible() const { return num_visible_; }
+  int num_culled() const { return count_ - num_visible_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(FrustumCuller);
+
+  // Normalized planes, (a, b, c, d) such that a * x + b * y + c * z + d is the
+  // distance of point (x, y, z) to the plane, positive on the inside.
+  vec4 planes_[6];
+  // Sphere centers and radii, padded to a multiple of 4.
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> z_;
+  std::vector<float> radius_;
+  std::vector<uint8_t> visible_;
+  int count_;
+  int num_visible_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_FRUSTUM_H
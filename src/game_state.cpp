@@ -1088,6 +1088,7 @@ void GameState::PopulateScene(SceneDescription* scene) {
   scene->Clear();
   // Camera.
   scene->set_camera(CameraMatrix());
+  scene->set_camera_position(camera_.Position());
   AddParticlesToScene(scene);
   sceneobject_component_.PopulateScene(scene);
 
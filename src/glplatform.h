@@ -44,7 +44,9 @@
 #include <GL/gl.h>
 #include <GL/glext.h>
 #ifdef _WIN32
-#define GLBASEEXTS GLEXT(PFNGLACTIVETEXTUREARBPROC, glActiveTexture)
+#define GLBASEEXTS                                \
+  GLEXT(PFNGLACTIVETEXTUREARBPROC, glActiveTexture) \
+  GLEXT(PFNGLCOMPRESSEDTEXIMAGE2DPROC, glCompressedTexImage2D)
 #else
 #define GLBASEEXTS
 #endif
@@ -86,6 +88,7 @@
   GLEXT(PFNGLUNIFORMMATRIX4FVARBPROC, glUniformMatrix4fv)                 \
   GLEXT(PFNGLUNIFORMMATRIX4FVARBPROC /*type*/, glUniformMatrix3x4fv)      \
   GLEXT(PFNGLBINDATTRIBLOCATIONARBPROC, glBindAttribLocation)             \
+  GLEXT(PFNGLVERTEXATTRIB4FARBPROC, glVertexAttrib4f)                     \
   GLEXT(PFNGLGETACTIVEUNIFORMARBPROC, glGetActiveUniform)                 \
   GLEXT(PFNGLGENERATEMIPMAPEXTPROC, glGenerateMipmap)
 
@@ -96,6 +99,70 @@ GLEXTS
 #endif
 #endif
 
+// Optional functionality, which comes from extensions or newer GL versions,
+// depending on the platform. Renderer::Initialize looks these up only when the
+// driver advertises support, and leaves them nullptr otherwise, so always check
+// before use. They have an "FPL" suffix so as not to clash with prototypes
+// some platform headers declare under the original names.
+#if defined(_WIN32)
+#define GL_APIENTRY_FPL APIENTRY
+#elif defined(GL_APIENTRY)
+#define GL_APIENTRY_FPL GL_APIENTRY
+#else
+#define GL_APIENTRY_FPL
+#endif
+typedef void(GL_APIENTRY_FPL *PFNGLGENVERTEXARRAYSFPLPROC)(GLsizei n,
+                                                           GLuint *arrays);
+typedef void(GL_APIENTRY_FPL *PFNGLBINDVERTEXARRAYFPLPROC)(GLuint array);
+typedef void(GL_APIENTRY_FPL *PFNGLDELETEVERTEXARRAYSFPLPROC)(
+    GLsizei n, const GLuint *arrays);
+typedef void(GL_APIENTRY_FPL *PFNGLDRAWELEMENTSINSTANCEDFPLPROC)(
+    GLenum mode, GLsizei count, GLenum type, const void *indices,
+    GLsizei primcount);
+typedef void(GL_APIENTRY_FPL *PFNGLVERTEXATTRIBDIVISORFPLPROC)(GLuint index,
+                                                               GLuint divisor);
+typedef void(GL_APIENTRY_FPL *PFNGLGETPROGRAMBINARYFPLPROC)(
+    GLuint program, GLsizei buffer_size, GLsizei *length,
+    GLenum *binary_format, void *binary);
+typedef void(GL_APIENTRY_FPL *PFNGLPROGRAMBINARYFPLPROC)(GLuint program,
+                                                         GLenum binary_format,
+                                                         const void *binary,
+                                                         GLsizei length);
+typedef void(GL_APIENTRY_FPL *PFNGLPROGRAMPARAMETERIFPLPROC)(GLuint program,
+                                                             GLenum pname,
+                                                             GLint value);
+typedef void(GL_APIENTRY_FPL *PFNGLMAXSHADERCOMPILERTHREADSFPLPROC)(
+    GLuint count);
+#define GLOPTEXTS                                                              \
+  GLOPTEXT(PFNGLGENVERTEXARRAYSFPLPROC, glGenVertexArraysFPL)                  \
+  GLOPTEXT(PFNGLBINDVERTEXARRAYFPLPROC, glBindVertexArrayFPL)                  \
+  GLOPTEXT(PFNGLDELETEVERTEXARRAYSFPLPROC, glDeleteVertexArraysFPL)            \
+  GLOPTEXT(PFNGLDRAWELEMENTSINSTANCEDFPLPROC, glDrawElementsInstancedFPL)      \
+  GLOPTEXT(PFNGLVERTEXATTRIBDIVISORFPLPROC, glVertexAttribDivisorFPL)          \
+  GLOPTEXT(PFNGLGETPROGRAMBINARYFPLPROC, glGetProgramBinaryFPL)                \
+  GLOPTEXT(PFNGLPROGRAMBINARYFPLPROC, glProgramBinaryFPL)                      \
+  GLOPTEXT(PFNGLPROGRAMPARAMETERIFPLPROC, glProgramParameteriFPL)              \
+  GLOPTEXT(PFNGLMAXSHADERCOMPILERTHREADSFPLPROC,                               \
+           glMaxShaderCompilerThreadsFPL)
+
+#define GLOPTEXT(type, name) extern type name;
+GLOPTEXTS
+#undef GLOPTEXT
+
+// Enums used with the optional functions above, which older headers lack.
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+
 // Define a GL_CALL macro to wrap each (void-returning) OpenGL call.
 // This logs GL error when LOG_GL_ERRORS below is defined.
 #if defined(_DEBUG) || DEBUG == 1
@@ -18,6 +18,7 @@
 #include <map>
 #include <unordered_map>
 #include <list>
+#include <vector>
 
 #include "SDL_log.h"
 #include "common.h"
@@ -25,30 +26,33 @@
 
 namespace fpl {
 
-// The glyph cache maintains a list of GlyphCacheRow. Each row has a fixed sizes
-// of height, which is determined at a row creation time. A row can include
-// multiple GlyphCacheEntry with a same or smaller height and they can have
-// variable width. In a row,
-// GlyphCacheEntry are stored from left to right in the order of registration
-// and won't be evicted per entry, but entire row is flushed when necessary to
-// make a room for new GlyphCacheEntry.
+// The glyph cache maintains a list of GlyphCacheRow, shelves that each span
+// the width of a page. Each row has a fixed height, which is determined when
+// glyphs are first stored in it. A row can include multiple GlyphCacheEntry
+// with a same or smaller height and they can have variable width.
+// Each row tracks the free spans between its glyphs, and glyphs are evicted
+// one at a time, merging their space with adjacent free spans. A row that
+// becomes empty is merged with adjacent empty rows, so its space can be split
+// into rows of other heights again.
 // The purpose of this design is to cache as many glyphs and to achieve high
 // caching perfomance estimating same size of glphys tends to be stored in a
 // cache at same time. (e.g. Caching a string in a same size.)
 //
+// The cache consists of one or more pages of the same size, each backing its
+// own atlas texture and having its own rows. When a glyph doesn't fit any
+// page, a new page is added up to a maximum, before glyphs start being
+// evicted. This way, a large set of glyphs (e.g. CJK text, or many sizes)
+// doesn't need to flush the whole cache.
+//
 // When looking up a cached entry, the API looks up unordered_map which is O(1)
 // operation.
 // If there is no cached entry for given code point, the caller needs to invoke
 // Set() API to fill in a cache.
 // Set() operation takes
-// O(log N (N=# of rows)) when there is a room in the cache for the request,
-// + O(N (N=# of rows)) to look up and evict least recently used row with
-// sufficient height.
-
-// Enable tracking stats in Debug build.
-#ifdef _DEBUG
-#define GLYPH_CACHE_STATS (1)
-#endif
+// O(P R (P=# of pages, R=# of rows)) to find free space for the request,
+// + O(log N (N=# of glyphs)) per evicted glyph when there is none. Glyphs are
+// kept in LRU lists per row height, so the least recently used glyph that
+// can make room is at the front of one of the lists.
 
 // Forward decl.
 template <typename T>
@@ -66,18 +70,30 @@ const int32_t kGlyphCachePaddingY = 1;
 // Cache entry for a glyph.
 class GlyphCacheEntry {
  public:
-  // Typedef for cache entry map's iterator.
-  typedef std::unordered_map<
-      uint64_t, std::unique_ptr<GlyphCacheEntry>>::iterator iterator;
+  // Typedef for cache row list's iterator.
   typedef std::list<GlyphCacheRow>::iterator iterator_row;
 
-  GlyphCacheEntry() : code_point_(0), size_(0, 0), offset_(0, 0) {}
+  // Typedef for LRU lists of cache entries, keyed by row height.
+  typedef std::map<int32_t, std::list<GlyphCacheEntry*>> lru_map;
+
+  GlyphCacheEntry()
+      : code_point_(0),
+        page_(0),
+        size_(0, 0),
+        offset_(0, 0),
+        key_(0),
+        x_pos_(0),
+        reserved_width_(0),
+        last_used_counter_(0) {}
 
   // Setter/Getter of code point.
   // Code point is an entry in a font file, not a direct transform of Unicode.
   uint32_t get_code_point() const { return code_point_; }
   void set_code_point(const uint32_t code_point) { code_point_ = code_point; }
 
+  // Getter of the cache page the glyph is stored in.
+  int32_t get_page() const { return page_; }
+
   // Setter/Getter of cache entry size.
   mathfu::vec2i get_size() const { return size_; }
   void set_size(const mathfu::vec2i& size) { size_ = size; }
@@ -99,6 +115,9 @@ class GlyphCacheEntry {
   // Code point of the glyph.
   uint32_t code_point_;
 
+  // Cache page of the glyph.
+  int32_t page_;
+
   // Cache entry sizes.
   mathfu::vec2i size_;
 
@@ -108,11 +127,24 @@ class GlyphCacheEntry {
   // Glyph image's UV in the texture atlas.
   mathfu::vec4 uv_;
 
+  // Key of the entry in the look-up map.
+  uint64_t key_;
+
+  // Horizontal position and width of the area reserved in the row, including
+  // padding.
+  int32_t x_pos_;
+  int32_t reserved_width_;
+
+  // Last used counter value of the entry. The value is used to determine
+  // if the entry can be evicted from the cache.
+  uint32_t last_used_counter_;
+
   // Iterator to the row entry.
-  GlyphCacheEntry::iterator_row it_row;
+  iterator_row it_row;
 
-  // Iterator to the row LRU entry.
-  std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row_;
+  // Iterators to the LRU list of the entry and to its place in the list.
+  lru_map::iterator it_lru_list_;
+  std::list<GlyphCacheEntry*>::iterator it_lru_;
 };
 
 // Single row in a cache. A row correspond to a horizontal slice of a texture.
@@ -120,8 +152,9 @@ class GlyphCacheEntry {
 // 16, the row corresponds to 256x16 pixels of the overall texture.)
 //
 // One cache row contains multiple GlyphCacheEntry with a same or smaller
-// height. GlyphCacheEntry entries are stored from left to right and not evicted
-// per glyph, but entire row at once for a performance reason.
+// height. A new GlyphCacheEntry is stored in the leftmost free span of the row
+// that is wide enough, and the span of an evicted one is merged with adjacent
+// free spans.
 // GlyphCacheRow is an internal class for GlyphCache.
 class GlyphCacheRow {
  public:
@@ -135,36 +168,75 @@ class GlyphCacheRow {
   }
   ~GlyphCacheRow() {}
 
-  // Initialize the row width and height.
+  // Initialize the row width and height, making it empty.
   void Initialize(const int32_t y_pos, const mathfu::vec2i& size) {
-    last_used_counter_ = 0;
     y_pos_ = y_pos;
-    remaining_width_ = size.x();
     size_ = size;
+    free_spans_.clear();
+    free_spans_[0] = size.x();
     cached_entries_.clear();
   }
 
   // Check if the row has a room for a requested width and height.
   bool DoesFit(const mathfu::vec2i& size) const {
-    return !(size.x() > remaining_width_ || size.y() > size_.y());
+    if (size.y() > size_.y()) return false;
+    for (auto& span : free_spans_) {
+      if (span.second >= size.x()) return true;
+    }
+    return false;
   }
 
-  // Reserve an area in the row.
-  int32_t Reserve(const GlyphCacheEntry::iterator it,
-                  const mathfu::vec2i& size) {
+  // Reserve an area in the leftmost free span that fits.
+  // Returns the horizontal position of the area.
+  int32_t Reserve(GlyphCacheEntry* entry, const mathfu::vec2i& size) {
     assert(DoesFit(size));
 
-    // Update row info.
-    int32_t pos = size_.x() - remaining_width_;
-    remaining_width_ -= size.x();
-    cached_entries_.push_back(it);
+    auto it = free_spans_.begin();
+    while (it->second < size.x()) ++it;
+    auto pos = it->first;
+    auto width = it->second;
+    free_spans_.erase(it);
+    if (width > size.x()) {
+      free_spans_[pos + size.x()] = width - size.x();
+    }
+    cached_entries_[pos] = entry;
     return pos;
   }
 
-  // Setter/Getter of last used counter.
-  uint32_t get_last_used_counter() const { return last_used_counter_; }
-  void set_last_used_counter(const uint32_t counter) {
-    last_used_counter_ = counter;
+  // Release an area reserved by Reserve(), merging it with adjacent free
+  // spans.
+  // Returns the position and width of the merged free span.
+  std::pair<int32_t, int32_t> Release(const int32_t pos, const int32_t width) {
+    cached_entries_.erase(pos);
+
+    auto start = pos;
+    auto end = pos + width;
+    auto next = free_spans_.lower_bound(pos);
+    if (next != free_spans_.end() && next->first == end) {
+      end += next->second;
+      next = free_spans_.erase(next);
+    }
+    if (next != free_spans_.begin()) {
+      auto prev = std::prev(next);
+      if (prev->first + prev->second == start) {
+        start = prev->first;
+        free_spans_.erase(prev);
+      }
+    }
+    free_spans_[start] = end - start;
+    return std::make_pair(start, end - start);
+  }
+
+  // Returns the entry reserved at a position, or nullptr.
+  GlyphCacheEntry* GetEntryAt(const int32_t pos) const {
+    auto it = cached_entries_.find(pos);
+    return it != cached_entries_.end() ? it->second : nullptr;
+  }
+
+  // Returns the rightmost entry reserved before a position, or nullptr.
+  GlyphCacheEntry* GetEntryBefore(const int32_t pos) const {
+    auto it = cached_entries_.lower_bound(pos);
+    return it != cached_entries_.begin() ? std::prev(it)->second : nullptr;
   }
 
   // Setter/Getter of row size.
@@ -178,16 +250,6 @@ class GlyphCacheRow {
   // Getter of cached glyphs.
   int32_t get_num_glyphs() const { return cached_entries_.size(); }
 
-  // Setter/Getter of iterator to row LRU.
-  const std::list<GlyphCacheEntry::iterator_row>::iterator get_it_lru_row()
-      const {
-    return it_lru_row_;
-  }
-  void set_it_lru_row(
-      const std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row) {
-    it_lru_row_ = it_lru_row;
-  }
-
   // Setter/Getter of iterator to row height map.
   std::multimap<int32_t, GlyphCacheEntry::iterator_row>::iterator
   get_it_row_height_map() const {
@@ -198,36 +260,46 @@ class GlyphCacheRow {
     it_row_height_map_ = it_row_height_map;
   }
 
-  // Getter of cached glyph entries.
-  std::vector<GlyphCacheEntry::iterator>& get_cached_entries() {
-    return cached_entries_;
-  }
-
  private:
-  // Last used counter value of the entry. The value is used to determine
-  // if the entry can be evicted from the cache.
-  uint32_t last_used_counter_;
-
-  // Remaining width of the row.
-  // As new contents are added to the row, remaining width decreases.
-  int32_t remaining_width_;
-
   // Size of the row.
   mathfu::vec2i size_;
 
   // Vertical position of the row in the entire cache buffer.
   uint32_t y_pos_;
 
-  // Iterator to the row LRU list.
-  std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row_;
+  // Free spans of the row.
+  // Key: horizontal position of the span. Value: width of the span.
+  // Adjacent free spans are always merged.
+  std::map<int32_t, int32_t> free_spans_;
 
   // Iterator to the row height map.
   std::multimap<int32_t, GlyphCacheEntry::iterator_row>::iterator
       it_row_height_map_;
 
   // Tracking cached entries in the row.
-  // When flushing the row, entries in the map is removed using the vector.
-  std::vector<GlyphCacheEntry::iterator> cached_entries_;
+  // Key: horizontal position of the entry.
+  std::map<int32_t, GlyphCacheEntry*> cached_entries_;
+};
+
+// Usage statistics of a GlyphCache, see GlyphCache::get_stats().
+struct GlyphCacheStats {
+  GlyphCacheStats()
+      : lookups(0), hits(0), stores(0), evictions(0), set_fails(0),
+        flushes(0) {}
+
+  // Number of Find() calls, and how many of them found the glyph.
+  int32_t lookups;
+  int32_t hits;
+
+  // Number of glyphs stored by Set(), and glyphs evicted to make room.
+  int32_t stores;
+  int32_t evictions;
+
+  // Number of Set() calls that found no room in the cache.
+  int32_t set_fails;
+
+  // Number of Flush() calls.
+  int32_t flushes;
 };
 
 template <typename T>
@@ -236,26 +308,18 @@ class GlyphCache {
   // Constructor with parameters.
   // width: width of the glyph cache texture. Rounded up to power of 2.
   // height: height of the glyph cache texture. Rounded up to power of 2.
-  GlyphCache(const mathfu::vec2i& size)
-      : counter_(0), revision_(0), dirty_(false) {
+  // max_pages: maximum number of pages the cache grows to before it starts
+  // evicting glyphs. Each page has the size above.
+  GlyphCache(const mathfu::vec2i& size, const int32_t max_pages = 1)
+      : counter_(0), revision_(0), max_pages_(max_pages), glyph_area_(0) {
+    assert(max_pages >= 1);
+
     // Round up cache sizes to power of 2.
     size_.x() = mathfu::RoundUpToPowerOf2(size.x());
     size_.y() = mathfu::RoundUpToPowerOf2(size.y());
 
-    // Allocate the glyph cache buffer.
-    // A buffer format can be 8/32 bpp (32 bpp is mostly used for Emoji).
-    buffer_.reset(new T[size_.x() * size_.y()]);
-
-    // Clearing allocated buffer.
-    const int32_t kCacheClearValue = 0x0;
-    memset(buffer_.get(), kCacheClearValue, size_.x() * size_.y() * sizeof(T));
-
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
-
-#ifdef GLYPH_CACHE_STATS
-    ResetStats();
-#endif
+    // Start with a single page, further pages are added on demand.
+    AddPage();
   }
   ~GlyphCache(){};
 
@@ -263,25 +327,12 @@ class GlyphCache {
   // Return value: A pointer to a cached glyph entry.
   // nullptr if not found.
   const GlyphCacheEntry* Find(const uint32_t code_point, const int32_t y_size) {
-#ifdef GLYPH_CACHE_STATS
-    // Update debug variable.
-    stats_lookup_++;
-#endif
-    auto it =
-        map_entries_.find(static_cast<uint64_t>(code_point) << 32 | y_size);
+    stats_.lookups++;
+    auto it = map_entries_.find(Key(code_point, y_size));
     if (it != map_entries_.end()) {
       // Found an entry!
-
-      // Mark the row as being used in current cycle.
-      it->second->it_row->set_last_used_counter(counter_);
-
-      // Update row LRU entry. The row is now most recently used.
-      lru_row_.splice(lru_row_.end(), lru_row_, it->second->it_lru_row_);
-
-#ifdef GLYPH_CACHE_STATS
-      // Update debug variable.
-      stats_hit_++;
-#endif
+      Touch(it->second.get());
+      stats_.hits++;
       return it->second.get();
     }
 
@@ -291,26 +342,24 @@ class GlyphCache {
   }
 
   // Set an entry to the cache.
+  // The entry is stored in the first page with free space for it. When there
+  // is none, a new page is added, up to max_pages. After that, the least
+  // recently used glyphs that are not used in current cycle are evicted to
+  // make room for it.
   // Return value: true if caching succeeded. false if there is no room in the
   // cache for a requested entry.
   // Returns a pointer to inserted entry.
   const GlyphCacheEntry* Set(const T* const image, const int32_t y_size,
                              const GlyphCacheEntry& entry) {
     // Lookup entries if the entry is already stored in the cache.
-    auto p = Find(entry.get_code_point(), y_size);
-#ifdef GLYPH_CACHE_STATS
-    // Adjust debug variable.
-    stats_lookup_--;
-#endif
-    if (p) {
+    auto it = map_entries_.find(Key(entry.get_code_point(), y_size));
+    if (it != map_entries_.end()) {
+      auto p = it->second.get();
       // Make sure cached entry has same properties.
       // The cache only support one entry per a glyph code point for now.
       assert(p->get_size().x() == entry.get_size().x());
       assert(p->get_size().y() == entry.get_size().y());
-#ifdef GLYPH_CACHE_STATS
-      // Adjust debug variable.
-      stats_hit_--;
-#endif
+      Touch(p);
       return p;
     }
 
@@ -321,127 +370,72 @@ class GlyphCache {
     int32_t req_height = ((entry.get_size().y() + kGlyphCachePaddingY +
                            (kGlyphCacheHeightRound - 1)) &
                           ~(kGlyphCacheHeightRound - 1));
-
-    // Look up the row map to retrieve a row iterator to start with.
-    auto it = map_row_.lower_bound(req_height);
-    while (it != map_row_.end()) {
-      if (it->second->DoesFit(mathfu::vec2i(req_width, req_height))) {
-        break;
-      }
-      it++;
-    }
-
-    GlyphCacheEntry* ret;
-    if (it != map_row_.end()) {
-      // Found sufficient space in the buffer.
-      auto it_row = it->second;
-
-      if (it_row->get_num_glyphs() == 0) {
-        // Putting first entry to the row.
-        // In this case, we create new empty row to track rest of free space.
-        auto original_height = it_row->get_size().y();
-        auto original_y_pos = it_row->get_y_pos();
-
-        if (original_height - req_height >= kGlyphCacheHeightRound) {
-          // Create new row for free space.
-          it_row->set_size(mathfu::vec2i(size_.x(), req_height));
-
-          // Update row height map key as well.
-          map_row_.erase(it_row->get_it_row_height_map());
-          auto it_map =
-              map_row_.insert(std::pair<int32_t, GlyphCacheEntry::iterator_row>(
-                  req_height, it_row));
-          it_row->set_it_row_height_map(it_map);
-
-          InsertNewRow(original_y_pos + req_height,
-                       mathfu::vec2i(size_.x(), original_height - req_height),
-                       list_row_.end());
+    auto req_size = mathfu::vec2i(req_width, req_height);
+
+    // Look up the row map of each page to retrieve a row iterator to start
+    // with.
+    for (size_t i = 0; i < pages_.size(); ++i) {
+      auto& page = *pages_[i];
+      for (auto it = page.map_row.lower_bound(req_height);
+           it != page.map_row.end(); ++it) {
+        if (it->second->DoesFit(req_size)) {
+          return Store(static_cast<int32_t>(i), it->second, image, y_size,
+                       entry, req_size);
         }
       }
+    }
 
-      // Create new entry in the look-up map.
-      auto pair = map_entries_.insert(
-          std::pair<uint64_t, std::unique_ptr<GlyphCacheEntry>>(
-              static_cast<uint64_t>(entry.get_code_point()) << 32 | y_size,
-              std::unique_ptr<GlyphCacheEntry>(new GlyphCacheEntry(entry))));
-      auto it_entry = pair.first;
-      ret = it_entry->second.get();
-
-      // Reserve a region in the row.
-      auto pos = mathfu::vec2i(
-          it_row->Reserve(it_entry, mathfu::vec2i(req_width, req_height)),
-          it_row->get_y_pos());
-
-      // Store given image into the buffer.
-      CopyImage(pos, image, it_entry->second.get());
-
-      // Update UV of the entry.
-      auto p = mathfu::vec4(
-          mathfu::vec2(pos) / mathfu::vec2(size_),
-          mathfu::vec2(pos + entry.get_size()) / mathfu::vec2(size_));
-      ret->set_uv(p);
-
-      // Establish links.
-      ret->it_row = it_row;
-      ret->it_lru_row_ = it_row->get_it_lru_row();
-
-      // Update row LRU entry.
-      lru_row_.splice(lru_row_.end(), lru_row_, it_row->get_it_lru_row());
-      it_row->set_last_used_counter(counter_);
-    } else {
-      // Couldn't find sufficient row entry nor free space to create new row.
-
-      // Try to find a row that is not used in current cycle and has enough
-      // height from LRU list.
-      for (auto row : lru_row_) {
-        if (row->get_last_used_counter() == counter_) {
-          // The row is being used in current rendering cycle.
-          // We can not evict the row.
-          continue;
-        }
-        if (row->get_size().y() >= req_height) {
-          // Now flush & initialize the row.
-          FlushRow(row);
-          row->Initialize(row->get_y_pos(), row->get_size());
+    // Couldn't find sufficient row entry nor free space to create new row.
+    // Grow the cache if it's allowed to.
+    if (static_cast<int32_t>(pages_.size()) < max_pages_) {
+      AddPage();
+      return Set(image, y_size, entry);
+    }
 
-          // Call the function recursively.
-          return Set(image, y_size, entry);
-        }
-      }
-#ifdef GLYPH_CACHE_STATS
-      stats_set_fail_++;
-#endif
-      // TODO: Try to flush multiple rows and merge them to free up space.
-      // TODO: Evaluate re-allocate solution.
-      // Now we don't have any space in the cache.
-      // It's caller's responsivility to recover from the situation.
-      // Possible work arounds are:
-      // - Draw glyphs with current glyph cache contents and then flush them,
-      // start new caching.
-      // - Just increase cache size.
-      return nullptr;
+    // Evict glyphs that are not used in current cycle from rows with enough
+    // height. Failing that, empty rows that are too low so they can be merged.
+    auto it_high_rows = lru_entries_.lower_bound(req_height);
+    auto p = EvictAndStore(it_high_rows, lru_entries_.end(), image, y_size,
+                           entry, req_size);
+    if (p == nullptr) {
+      p = EvictAndStore(lru_entries_.begin(), it_high_rows, image, y_size,
+                        entry, req_size);
+    }
+    if (p != nullptr) {
+      return p;
     }
 
-    return ret;
+    stats_.set_fails++;
+    // Now we don't have any space in the cache.
+    // It's caller's responsivility to recover from the situation.
+    // Possible work arounds are:
+    // - Draw glyphs with current glyph cache contents and then flush them,
+    // start new caching.
+    // - Just increase cache size or page count.
+    return nullptr;
   }
 
   // Flush all cache entries.
+  // Pages that have been added are kept, but emptied.
   bool Flush() {
-#ifdef GLYPH_CACHE_STATS
-    ResetStats();
-#endif
+    stats_.flushes++;
     map_entries_.clear();
-    lru_row_.clear();
-    list_row_.clear();
-    map_row_.clear();
+    lru_entries_.clear();
+    glyph_area_ = 0;
 
-    // Update cache revision.
-    revision_ = counter_;
+    for (auto& page : pages_) {
+      page->list_row.clear();
+      page->map_row.clear();
 
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
+      // Create first (empty) row entry.
+      InsertNewRow(page.get(), 0, size_, page->list_row.end());
+
+      page->dirty = false;
+      page->dirty_rects.clear();
+    }
 
-    dirty_ = false;
+    // Update cache revision.
+    revision_ = counter_;
 
     return true;
   }
@@ -452,130 +446,374 @@ class GlyphCache {
   // cache entries are full.
   void Update() { counter_++; }
 
-  // Debug API to show cache statistics.
+  // Log cache statistics and the rows of each page.
   void Status() {
-#ifdef GLYPH_CACHE_STATS
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cache size: %dx%d", size_.x(),
-                size_.y());
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cache hit: %d / %d", stats_hit_,
-                stats_lookup_);
-
-    auto total_glyph = 0;
-    for (auto row : list_row_) {
-      SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                  "Row start:%d height:%d glyphs:%d counter:%d",
-                  row.get_y_pos(), row.get_size().y(), row.get_num_glyphs(),
-                  row.get_last_used_counter());
-      total_glyph += row.get_num_glyphs();
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cache size: %dx%d, %d pages",
+                size_.x(), size_.y(), get_num_pages());
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cache hit: %d / %d",
+                stats_.hits, stats_.lookups);
+
+    for (size_t i = 0; i < pages_.size(); ++i) {
+      for (auto& row : pages_[i]->list_row) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Page:%d row start:%d height:%d glyphs:%d",
+                    static_cast<int>(i), row.get_y_pos(), row.get_size().y(),
+                    row.get_num_glyphs());
+      }
     }
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cached glyphs: %d", total_glyph);
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Row flush: %d",
-                stats_row_flush_);
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Set fail: %d", stats_set_fail_);
-#endif
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Cached glyphs: %d",
+                static_cast<int>(map_entries_.size()));
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Fill ratio: %.2f",
+                get_fill_ratio());
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Stored: %d Evicted: %d",
+                stats_.stores, stats_.evictions);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Set fail: %d Flush: %d",
+                stats_.set_fails, stats_.flushes);
+  }
+
+  // Getter of usage statistics, accumulated since construction or the last
+  // ResetStats() call.
+  const GlyphCacheStats& get_stats() const { return stats_; }
+  void ResetStats() { stats_ = GlyphCacheStats(); }
+
+  // Returns the fraction of the pages' area covered by cached glyph images.
+  float get_fill_ratio() const {
+    return static_cast<float>(glyph_area_) /
+           (static_cast<float>(size_.x()) * size_.y() * pages_.size());
+  }
+
+  // Returns the number of glyphs evicted per glyph stored. Values close to 1
+  // mean the cache is too small for the glyphs in use and keeps rasterizing
+  // them again.
+  float get_eviction_rate() const {
+    return stats_.stores
+               ? static_cast<float>(stats_.evictions) / stats_.stores
+               : 0.0f;
   }
 
   // Getter/Setter of the counter.
   uint32_t get_revision() const { return revision_; }
   void set_revision(const uint32_t revision) { revision_ = revision; }
 
-  // Getter/Setter of dirty state.
-  bool get_dirty_state() const { return dirty_; };
-  void set_dirty_state(const bool dirty) { dirty_ = dirty; }
+  // Getter of the number of pages in the cache.
+  int32_t get_num_pages() const { return static_cast<int32_t>(pages_.size()); }
 
-  // Getter of dirty rect.
-  const mathfu::vec4i& get_dirty_rect() const { return dirty_rect_; }
+  // Getter/Setter of dirty state of a page.
+  bool get_dirty_state(const int32_t page) const {
+    return pages_[page]->dirty;
+  };
+  void set_dirty_state(const int32_t page, const bool dirty) {
+    pages_[page]->dirty = dirty;
+    if (!dirty) pages_[page]->dirty_rects.clear();
+  }
 
-  // Getter of allocated glyph cache buffer.
-  const T* get_buffer() const { return buffer_.get(); }
+  // Returns if any page is dirty.
+  bool get_dirty_state() const {
+    for (auto& page : pages_) {
+      if (page->dirty) return true;
+    }
+    return false;
+  }
+
+  // Getter of dirty rect of a page.
+  const mathfu::vec4i& get_dirty_rect(const int32_t page) const {
+    return pages_[page]->dirty_rect;
+  }
+
+  // Getter of the dirty rects of a page, at most one per row, as the corners
+  // (x0, y0, x1, y1) of each. Together they cover the dirty rect, but only
+  // the areas glyphs were stored in.
+  const std::vector<mathfu::vec4i>& get_dirty_rects(const int32_t page) const {
+    return pages_[page]->dirty_rects;
+  }
+
+  // Getter of allocated glyph cache buffer of a page.
+  const T* get_buffer(const int32_t page = 0) const {
+    return pages_[page]->buffer.get();
+  }
 
   // Getter of the cache size.
   const mathfu::vec2i& get_size() const { return size_; }
 
  private:
-  // Insert new row to the row list with a given size.
-  // It tries to merge 2 rows if next row is also empty one.
-  void InsertNewRow(const int32_t y_pos, const mathfu::vec2i& size,
+  // A page of the cache. Each page corresponds to an atlas texture, and has
+  // its own rows.
+  struct Page {
+    // Cache buffer.
+    std::unique_ptr<T[]> buffer;
+
+    // list of rows in the page, from top to bottom.
+    std::list<GlyphCacheRow> list_row;
+
+    // Map to row entries to have O(log N) access to a row entry.
+    // Tracks iterator to list_row.
+    // Using multimap because multiple rows can have same row height.
+    // Key: height of the row. With the map, an API can have quick access to a
+    // row with a given height.
+    std::multimap<int32_t, GlyphCacheEntry::iterator_row> map_row;
+
+    // Flag indicates if the page is dirty. If it's dirty, corresponding font
+    // atlas texture needs to be uploaded.
+    bool dirty;
+
+    // Dirty region in the buffer.
+    mathfu::vec4i dirty_rect;
+
+    // Dirty regions of the rows in the buffer.
+    std::vector<mathfu::vec4i> dirty_rects;
+  };
+
+  // Key of an entry in the look-up map.
+  static uint64_t Key(const uint32_t code_point, const int32_t y_size) {
+    return static_cast<uint64_t>(code_point) << 32 | y_size;
+  }
+
+  // Mark an entry as being used in current cycle.
+  void Touch(GlyphCacheEntry* entry) {
+    entry->last_used_counter_ = counter_;
+
+    // Update LRU entry. The entry is now most recently used.
+    auto& lru = entry->it_lru_list_->second;
+    lru.splice(lru.end(), lru, entry->it_lru_);
+  }
+
+  // Allocate a new empty page.
+  void AddPage() {
+    std::unique_ptr<Page> page(new Page());
+
+    // Allocate the glyph cache buffer.
+    // A buffer format can be 8/32 bpp (32 bpp is mostly used for Emoji).
+    page->buffer.reset(new T[size_.x() * size_.y()]);
+
+    // Clearing allocated buffer.
+    const int32_t kCacheClearValue = 0x0;
+    memset(page->buffer.get(), kCacheClearValue,
+           size_.x() * size_.y() * sizeof(T));
+    page->dirty = false;
+
+    // Create first (empty) row entry.
+    InsertNewRow(page.get(), 0, size_, page->list_row.end());
+    pages_.push_back(std::move(page));
+  }
+
+  // Store an entry in a row with sufficient space.
+  const GlyphCacheEntry* Store(const int32_t page_index,
+                               const GlyphCacheEntry::iterator_row it_row,
+                               const T* const image, const int32_t y_size,
+                               const GlyphCacheEntry& entry,
+                               const mathfu::vec2i& req_size) {
+    auto page = pages_[page_index].get();
+    auto req_height = req_size.y();
+    if (it_row->get_num_glyphs() == 0) {
+      // Putting first entry to the row.
+      // In this case, we create new empty row below it to track rest of free
+      // space.
+      auto original_height = it_row->get_size().y();
+      auto original_y_pos = it_row->get_y_pos();
+
+      if (original_height - req_height >= kGlyphCacheHeightRound) {
+        // Create new row for free space.
+        ResizeRow(page, it_row, original_y_pos, req_height);
+        InsertNewRow(page, original_y_pos + req_height,
+                     mathfu::vec2i(size_.x(), original_height - req_height),
+                     std::next(it_row));
+      }
+    }
+
+    // Create new entry in the look-up map.
+    auto key = Key(entry.get_code_point(), y_size);
+    auto pair = map_entries_.insert(
+        std::pair<uint64_t, std::unique_ptr<GlyphCacheEntry>>(
+            key, std::unique_ptr<GlyphCacheEntry>(new GlyphCacheEntry(entry))));
+    auto ret = pair.first->second.get();
+
+    // Reserve a region in the row.
+    auto pos = mathfu::vec2i(it_row->Reserve(ret, req_size),
+                             it_row->get_y_pos());
+
+    // Store given image into the buffer.
+    CopyImage(page, pos, image, ret);
+
+    // Update UV of the entry.
+    auto p = mathfu::vec4(
+        mathfu::vec2(pos) / mathfu::vec2(size_),
+        mathfu::vec2(pos + entry.get_size()) / mathfu::vec2(size_));
+    ret->set_uv(p);
+
+    // Establish links.
+    ret->page_ = page_index;
+    ret->key_ = key;
+    ret->x_pos_ = pos.x();
+    ret->reserved_width_ = req_size.x();
+    ret->last_used_counter_ = counter_;
+    ret->it_row = it_row;
+
+    // Add the entry to the LRU list of its row height as most recently used.
+    auto it_list =
+        lru_entries_.insert(GlyphCacheEntry::lru_map::value_type(
+                                it_row->get_size().y(),
+                                std::list<GlyphCacheEntry*>())).first;
+    ret->it_lru_list_ = it_list;
+    ret->it_lru_ = it_list->second.insert(it_list->second.end(), ret);
+
+    glyph_area_ += entry.get_size().x() * entry.get_size().y();
+    stats_.stores++;
+    return ret;
+  }
+
+  // Evict glyphs not used in current cycle from the LRU lists in a range, least
+  // recently used first, until there is room for an entry in their row.
+  // Returns the stored entry, or nullptr if the lists run out of glyphs that
+  // can be evicted.
+  const GlyphCacheEntry* EvictAndStore(
+      const GlyphCacheEntry::lru_map::iterator begin,
+      const GlyphCacheEntry::lru_map::iterator end, const T* const image,
+      const int32_t y_size, const GlyphCacheEntry& entry,
+      const mathfu::vec2i& req_size) {
+    for (auto it_list = begin; it_list != end; ++it_list) {
+      auto& lru = it_list->second;
+      while (!lru.empty() && lru.front()->last_used_counter_ != counter_) {
+        auto page_index = lru.front()->page_;
+        auto row = lru.front()->it_row;
+        auto span = Evict(lru.front());
+
+        // Widen the freed span with adjacent glyphs that are not used in
+        // current cycle either, rather than evicting glyphs elsewhere.
+        while (span.second < req_size.x()) {
+          auto next = row->GetEntryAt(span.first + span.second);
+          auto prev = row->GetEntryBefore(span.first);
+          if (next != nullptr && next->last_used_counter_ != counter_) {
+            span = Evict(next);
+          } else if (prev != nullptr && prev->last_used_counter_ != counter_) {
+            span = Evict(prev);
+          } else {
+            break;
+          }
+        }
+
+        if (row->get_num_glyphs() == 0) {
+          row = MergeEmptyRow(pages_[page_index].get(), row);
+        }
+        if (row->DoesFit(req_size)) {
+          return Store(page_index, row, image, y_size, entry, req_size);
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  // Evict an entry from the cache.
+  // Returns the position and width of the free span in the row it leaves.
+  std::pair<int32_t, int32_t> Evict(GlyphCacheEntry* entry) {
+    auto row = entry->it_row;
+    auto span = row->Release(entry->x_pos_, entry->reserved_width_);
+    entry->it_lru_list_->second.erase(entry->it_lru_);
+    glyph_area_ -= entry->get_size().x() * entry->get_size().y();
+    map_entries_.erase(entry->key_);
+
+    // Update cache revision.
+    // It's setting revision equal to the current counter value so that it just
+    // change the revision once a rendering cycle even multiple glyphs are
+    // evicted in a cycle.
+    revision_ = counter_;
+
+    stats_.evictions++;
+    return span;
+  }
+
+  // Insert new row to the row list of a page with a given size, before 'pos'.
+  // It merges the rows if 'pos' is also an empty row.
+  void InsertNewRow(Page* page, const int32_t y_pos, const mathfu::vec2i& size,
                     const GlyphCacheEntry::iterator_row pos) {
     // First, check if we can merge the requested row with next row to free up
     // more spaces.
-    // New row is always inserted right after valid row entry. So we don't have
-    // to check previous row entry to merge.
-    if (pos != list_row_.end()) {
-      auto next_entry = std::next(pos);
-      if (next_entry->get_num_glyphs() == 0) {
-        // We can merge them.
-        mathfu::vec2i next_size = next_entry->get_size();
-        next_size.y() += size.y();
-        next_entry->set_y_pos(next_entry->get_y_pos() - size.y());
-        next_entry->set_size(next_size);
-        next_entry->set_last_used_counter(counter_);
-        return;
-      }
+    if (pos != page->list_row.end() && pos->get_num_glyphs() == 0) {
+      ResizeRow(page, pos, y_pos, pos->get_size().y() + size.y());
+      return;
     }
 
     // Insert new row.
-    auto it = list_row_.insert(pos, GlyphCacheRow(y_pos, size));
-    auto it_lru_row = lru_row_.insert(lru_row_.end(), it);
-    auto it_map = map_row_.insert(
+    auto it = page->list_row.insert(pos, GlyphCacheRow(y_pos, size));
+    auto it_map = page->map_row.insert(
         std::pair<int32_t, GlyphCacheEntry::iterator_row>(size.y(), it));
 
     // Update a link.
-    it->set_it_lru_row(it_lru_row);
     it->set_it_row_height_map(it_map);
   }
 
-  void FlushRow(const GlyphCacheEntry::iterator_row row) {
-    // Erase cached glyphs from look-up map.
-    for (auto entry : row->get_cached_entries()) {
-      map_entries_.erase(entry);
+  // Merge an empty row with adjacent empty rows.
+  // Returns the merged row.
+  GlyphCacheEntry::iterator_row MergeEmptyRow(
+      Page* page, const GlyphCacheEntry::iterator_row row) {
+    assert(row->get_num_glyphs() == 0);
+    auto y_pos = row->get_y_pos();
+    auto height = row->get_size().y();
+    if (row != page->list_row.begin()) {
+      auto prev = std::prev(row);
+      if (prev->get_num_glyphs() == 0) {
+        y_pos = prev->get_y_pos();
+        height += prev->get_size().y();
+        page->map_row.erase(prev->get_it_row_height_map());
+        page->list_row.erase(prev);
+      }
     }
+    auto next = std::next(row);
+    if (next != page->list_row.end() && next->get_num_glyphs() == 0) {
+      height += next->get_size().y();
+      page->map_row.erase(next->get_it_row_height_map());
+      page->list_row.erase(next);
+    }
+    ResizeRow(page, row, y_pos, height);
+    return row;
+  }
 
-    // Update cache revision.
-    // It's setting revision equal to the current counter value so that it just
-    // change the revision once a rendering cycle even multiple cache flush
-    // happens in a cycle.
-    revision_ = counter_;
-
-#ifdef GLYPH_CACHE_STATS
-    stats_row_flush_++;
-#endif
+  // Move an empty row or change its height, updating the row height map.
+  void ResizeRow(Page* page, const GlyphCacheEntry::iterator_row row,
+                 const int32_t y_pos, const int32_t height) {
+    row->Initialize(y_pos, mathfu::vec2i(size_.x(), height));
+    page->map_row.erase(row->get_it_row_height_map());
+    auto it_map = page->map_row.insert(
+        std::pair<int32_t, GlyphCacheEntry::iterator_row>(height, row));
+    row->set_it_row_height_map(it_map);
   }
 
-  // Copy glyph image into the buffer.
-  void CopyImage(const mathfu::vec2i& pos, const T* const image,
+  // Copy glyph image into the buffer of a page.
+  void CopyImage(Page* page, const mathfu::vec2i& pos, const T* const image,
                  const GlyphCacheEntry* entry) {
-    auto buffer = buffer_.get();
+    auto buffer = page->buffer.get();
     auto size = entry->get_size().x() * sizeof(T);
     for (int32_t y = 0; y < entry->get_size().y(); ++y) {
       memcpy(buffer + pos.x() + (pos.y() + y) * size_.x(),
              image + y * entry->get_size().x(), size);
     }
-    UpdateDirtyRect(mathfu::vec4i(pos, pos + entry->get_size()));
+    UpdateDirtyRect(page, mathfu::vec4i(pos, pos + entry->get_size()));
   }
 
-  // Update dirty rect.
-  void UpdateDirtyRect(const mathfu::vec4i& rect) {
-    if (!dirty_) {
+  // Update dirty rects of a page.
+  void UpdateDirtyRect(Page* page, const mathfu::vec4i& rect) {
+    if (!page->dirty) {
       // Initialize dirty rect.
-      dirty_rect_ = mathfu::vec4i(size_, mathfu::kZeros2i);
+      page->dirty_rect = mathfu::vec4i(size_, mathfu::kZeros2i);
     }
 
-    dirty_ = true;
-    dirty_rect_ =
-        mathfu::vec4i(mathfu::vec2i::Min(dirty_rect_.xy(), rect.xy()),
-                      mathfu::vec2i::Max(dirty_rect_.zw(), rect.zw()));
+    page->dirty = true;
+    page->dirty_rect = Union(page->dirty_rect, rect);
+
+    // Glyphs stored in a row start at its top, so that identifies the row.
+    for (auto& row_rect : page->dirty_rects) {
+      if (row_rect.y() == rect.y()) {
+        row_rect = Union(row_rect, rect);
+        return;
+      }
+    }
+    page->dirty_rects.push_back(rect);
   }
 
-#ifdef GLYPH_CACHE_STATS
-  void ResetStats() {
-    // Initialize debug variables.
-    stats_hit_ = 0;
-    stats_lookup_ = 0;
-    stats_row_flush_ = 0;
-    stats_set_fail_ = 0;
+  // Returns the smallest rect containing two rects.
+  static mathfu::vec4i Union(const mathfu::vec4i& a, const mathfu::vec4i& b) {
+    return mathfu::vec4i(mathfu::vec2i::Min(a.xy(), b.xy()),
+                         mathfu::vec2i::Max(a.zw(), b.zw()));
   }
-#endif
 
   // A time counter of the cache.
   // In each rendering cycle, the counter is incremented.
@@ -583,11 +821,11 @@ class GlyphCache {
   // cycle.
   uint32_t counter_;
 
-  // Size of the glyph cache. Rounded to power of 2.
+  // Size of a page of the glyph cache. Rounded to power of 2.
   mathfu::vec2i size_;
 
-  // Cache buffer;
-  std::unique_ptr<T> buffer_;
+  // Pages of the cache.
+  std::vector<std::unique_ptr<Page>> pages_;
 
   // Hash map to the cache entries
   // This map is the primary place to look up the cache entries.
@@ -596,18 +834,10 @@ class GlyphCache {
   // font file and not a Unicode value.
   std::unordered_map<uint64_t, std::unique_ptr<GlyphCacheEntry>> map_entries_;
 
-  // list of rows in the cache.
-  std::list<GlyphCacheRow> list_row_;
-
-  // LRU entries of the row. Tracks iterator to list_row_.
-  std::list<GlyphCacheEntry::iterator_row> lru_row_;
-
-  // Map to row entries to have O(log N) access to a row entry.
-  // Tracks iterator to list_row_.
-  // Using multimap because multiple rows can have same row height.
-  // Key: height of the row. With the map, an API can have quick access to a row
-  // with a given height.
-  std::multimap<int32_t, GlyphCacheEntry::iterator_row> map_row_;
+  // LRU lists of the cache entries of all pages, least recently used first.
+  // Key: height of the row the entries are in. Lists are kept when they
+  // become empty, so entries can hold iterators to them.
+  GlyphCacheEntry::lru_map lru_entries_;
 
   // Revision of the buffer.
   // Each time one or more cache entry is evicted, a revision of the cache is
@@ -618,20 +848,14 @@ class GlyphCache {
   // because existing entries are still valid in that case.
   uint32_t revision_;
 
-  // Flag indicates if the cache is dirty. If it's dirty, corresponding font
-  // atlas texture needs to be uploaded.
-  bool dirty_;
+  // Maximum number of pages.
+  int32_t max_pages_;
 
-  // Dirty region in the buffer.
-  mathfu::vec4i dirty_rect_;
+  // Total area of the cached glyph images in pixels.
+  int64_t glyph_area_;
 
-#ifdef GLYPH_CACHE_STATS
-  // Variables to track usage stats.
-  int32_t stats_lookup_;
-  int32_t stats_hit_;
-  int32_t stats_row_flush_;
-  int32_t stats_set_fail_;
-#endif
+  // Usage statistics.
+  GlyphCacheStats stats_;
 };
 
 }  // namespace fpl
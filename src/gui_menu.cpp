@@ -35,6 +35,15 @@ static inline size_t ArrayLength(const T* array) {
   return array == nullptr ? 0 : array->Length();
 }
 
+// Finds a material created by LoadAssets(), and gets its textures loading if
+// the menu's assets were loaded on demand.
+static Material* FindAndPrefetchMaterial(MaterialManager* matman,
+                                         const char* name) {
+  Material* material = matman->FindMaterial(name);
+  if (material) matman->Prefetch(material);
+  return material;
+}
+
 void GuiMenu::Setup(const UiGroup* menu_def, MaterialManager* matman) {
   ClearRecentSelections();
   if (menu_def == nullptr) {
@@ -58,11 +67,12 @@ void GuiMenu::Setup(const UiGroup* menu_def, MaterialManager* matman) {
     const size_t length_texture_normal = ArrayLength(button->texture_normal());
     for (size_t j = 0; j < length_texture_normal; j++) {
       const char* texture_name = TextureName(*button->texture_normal()->Get(j));
-      button_list_[i].set_up_material(j, matman->FindMaterial(texture_name));
+      button_list_[i].set_up_material(
+          j, FindAndPrefetchMaterial(matman, texture_name));
     }
     if (button->texture_pressed()) {
-      button_list_[i].set_down_material(
-          matman->FindMaterial(TextureName(*button->texture_pressed())));
+      button_list_[i].set_down_material(FindAndPrefetchMaterial(
+          matman, TextureName(*button->texture_pressed())));
     }
 
     const char* shader_name = (button->shader() == nullptr)
@@ -97,7 +107,7 @@ void GuiMenu::Setup(const UiGroup* menu_def, MaterialManager* matman) {
     std::vector<Material*> materials(num_textures);
     for (int j = 0; j < num_textures; ++j) {
       const char* material_name = TextureName(*image_def.texture()->Get(j));
-      materials[j] = matman->FindMaterial(material_name);
+      materials[j] = FindAndPrefetchMaterial(matman, material_name);
       if (materials[j] == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Static image '%s' not found", material_name);
@@ -118,8 +128,9 @@ void GuiMenu::Setup(const UiGroup* menu_def, MaterialManager* matman) {
 }
 
 // Force the material manager to load all the textures and shaders
-// used in the UI group.
-void GuiMenu::LoadAssets(const UiGroup* menu_def, MaterialManager* matman) {
+// used in the UI group, with the given priority (see AsyncLoadPriority).
+void GuiMenu::LoadAssets(const UiGroup* menu_def, MaterialManager* matman,
+                         int priority) {
   const size_t length_button_list = ArrayLength(menu_def->button_list());
   matman->LoadShader(menu_def->default_shader()->c_str());
   matman->LoadShader(menu_def->default_inactive_shader()->c_str());
@@ -128,10 +139,10 @@ void GuiMenu::LoadAssets(const UiGroup* menu_def, MaterialManager* matman) {
     const size_t length_texture_normal = ArrayLength(button->texture_normal());
     for (size_t j = 0; j < length_texture_normal; j++) {
       const char* texture_name = TextureName(*button->texture_normal()->Get(j));
-      matman->LoadMaterial(texture_name);
+      matman->LoadMaterial(texture_name, priority);
     }
     if (button->texture_pressed()) {
-      matman->LoadMaterial(TextureName(*button->texture_pressed()));
+      matman->LoadMaterial(TextureName(*button->texture_pressed()), priority);
     }
 
     if (button->shader() != nullptr) {
@@ -147,7 +158,8 @@ void GuiMenu::LoadAssets(const UiGroup* menu_def, MaterialManager* matman) {
     const StaticImageDef& image_def = *menu_def->static_image_list()->Get(i);
     const size_t length_texture = ArrayLength(image_def.texture());
     for (size_t j = 0; j < length_texture; ++j) {
-      matman->LoadMaterial(TextureName(*image_def.texture()->Get(j)));
+      matman->LoadMaterial(TextureName(*image_def.texture()->Get(j)),
+                           priority);
     }
     if (image_def.shader() != nullptr) {
       matman->LoadShader(image_def.shader()->c_str());
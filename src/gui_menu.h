@@ -46,7 +46,10 @@ class GuiMenu {
   void AdvanceFrame(WorldTime delta_time, InputSystem* input,
                     const vec2& window_size);
   void Setup(const UiGroup* menudef, MaterialManager* matman);
-  void LoadAssets(const UiGroup* menu_def, MaterialManager* matman);
+  // Menus loaded with kLoadPriorityOnDemand load their textures once Setup()
+  // is called for them.
+  void LoadAssets(const UiGroup* menu_def, MaterialManager* matman,
+                  int priority = kLoadPriorityNormal);
   void Render(Renderer* renderer);
   void AdvanceFrame(WorldTime delta_time);
   MenuSelection GetRecentSelection();
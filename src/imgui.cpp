@@ -65,6 +65,77 @@ class Group {
   vec4i margin_;
 };
 
+// Elements are identified by a hash of the id string the user specified, so
+// ids may be generated, e.g. in a loop, and don't need to outlive the GUI.
+typedef uint32_t ElementId;
+
+// Not the id of any element.
+const ElementId kNullId = 0;
+
+ElementId HashId(const char *id) {
+  // 32 bit FNV-1a.
+  uint32_t hash = 2166136261U;
+  for (const char *p = id; *p; ++p) {
+    hash = (hash ^ static_cast<uint8_t>(*p)) * 16777619U;
+  }
+  return hash;
+}
+
+// An element created in the layout pass.
+struct Element {
+  Element(const vec2i &_size, ElementId _id)
+      : size(_size), id(_id), interactive(false) {}
+
+  vec2i size;        // Minimum size computed by layout pass.
+  ElementId id;      // Hash of the id specified by the user.
+  bool interactive;  // Wants to respond to user input.
+};
+
+// Inter-frame persistent state of a GUI, owned by its Context.
+struct PersistentState {
+  PersistentState() : gamepad_focus(kNullId), keyboard_focus(kNullId) {
+    for (int i = 0; i < InputSystem::kMaxSimultanuousPointers; i++) {
+      pointer_element[i] = kNullId;
+    }
+  }
+
+  // For each pointer, the element id that last received a down event.
+  ElementId pointer_element[InputSystem::kMaxSimultanuousPointers];
+  // The element the gamepad is currently "over", simulates the mouse
+  // hovering over an element.
+  ElementId gamepad_focus;
+  // The element that last received an up event. Keystrokes should be
+  // directed to this element, e.g. for a text edit widget
+  ElementId keyboard_focus;
+
+  // Storage for the elements and the group stack of a frame. It is cleared,
+  // not freed, every frame, so a GUI stops allocating memory once it has run
+  // for a few frames.
+  std::vector<Element> elements;
+  std::vector<Group> group_stack;
+
+  // The layout of the last frame that ran a layout pass.
+  struct Layout {
+    Layout()
+        : retained(false),
+          hash(0),
+          canvas_size(mathfu::kZeros2i),
+          virtual_resolution(IMGUI_DEFAULT_VIRTUAL_RESOLUTION),
+          pixel_scale(1.0f) {}
+
+    // The next frame can skip its layout pass and use this one.
+    bool retained;
+    uint64_t hash;
+    vec2i canvas_size;
+    float virtual_resolution;
+    float pixel_scale;
+  } layout;
+};
+
+Context::Context() : state_(new PersistentState()) {}
+
+Context::~Context() {}
+
 // This holds transient state used while a GUI is being laid out / rendered.
 // It is intentionally hidden from the interface.
 // It is implemented as a singleton that the GUI element functions can access.
@@ -74,19 +145,14 @@ InternalState *state = nullptr;
 
 class InternalState : public Group {
  public:
-  struct Element {
-    Element(const vec2i &_size, const char *_id)
-        : size(_size), id(_id), interactive(false) {}
-
-    vec2i size;        // Minimum size computed by layout pass.
-    const char *id;    // Id specified by the user.
-    bool interactive;  // Wants to respond to user input.
-  };
-
-  InternalState(MaterialManager &matman, FontManager &fontman,
-                InputSystem &input)
+  InternalState(Context &context, MaterialManager &matman,
+                FontManager &fontman, InputSystem &input)
       : Group(true, ALIGN_TOPLEFT, 0, 0),
-        layout_pass_(true),
+        layout_pass_(!context.state_->layout.retained),
+        retained_(context.state_->layout.retained),
+        layout_hash_(kLayoutHashSeed),
+        elements_(context.state_->elements),
+        group_stack_(context.state_->group_stack),
         canvas_size_(matman.renderer().window_size()),
         virtual_resolution_(IMGUI_DEFAULT_VIRTUAL_RESOLUTION),
         matman_(matman),
@@ -94,9 +160,21 @@ class InternalState : public Group {
         fontman_(fontman),
         pointer_max_active_index_(-1),
         gamepad_has_focus_element(false),
-        gamepad_event(EVENT_HOVER) {
+        gamepad_event(EVENT_HOVER),
+        persistent_(*context.state_) {
     SetScale();
 
+    // In the steady state, the elements of the previous frame hold the layout
+    // we're going to render with.
+    if (retained_) {
+      canvas_size_ = persistent_.layout.canvas_size;
+      virtual_resolution_ = persistent_.layout.virtual_resolution;
+      pixel_scale_ = persistent_.layout.pixel_scale;
+    } else {
+      elements_.clear();
+    }
+    HashLayout(matman.renderer().window_size());
+
     // Cache the state of multiple pointers, so we have to do less work per
     // interactive element.
     pointer_max_active_index_ = 0;  // Mouse is always active.
@@ -119,6 +197,10 @@ class InternalState : public Group {
     assert(image_shader_);
     font_shader_ = matman_.LoadShader("shaders/font");
     assert(font_shader_);
+    font_batch_shader_ = matman_.LoadShader(
+        "shaders/font_batched",
+        fontman_.distance_field() ? kShaderFeatureDistanceField : 0);
+    assert(font_batch_shader_);
     color_shader_ = matman_.LoadShader("shaders/color");
     assert(color_shader_);
 
@@ -129,18 +211,6 @@ class InternalState : public Group {
 
   ~InternalState() { state = nullptr; }
 
-  bool EqualId(const char *id1, const char *id2) {
-    // We can do pointer compare, because we receive these ids from the user
-    // and then store them.
-    // We require the user to provide storage for the id as long as the GUI
-    // is active, which guarantees pointer identity.
-    // TODO: we either need to provide a way to clear persistent ids once a
-    // GUI goes away entirely, or tell users not ever pass a c_str().
-    // Better yet, replace this by hashes, as that makes generating ids in
-    // loops easier. Bit expensive though.
-    return id1 == id2;
-  }
-
   template <int D>
   mathfu::Vector<int, D> VirtualToPhysical(const mathfu::Vector<float, D> &v) {
     return mathfu::Vector<int, D>(v * pixel_scale_ + 0.5f);
@@ -169,10 +239,25 @@ class InternalState : public Group {
     return dest;
   }
 
+  // Accumulate an input of the layout into the layout hash. Called in the
+  // layout pass, and in the render pass of a frame that reuses the layout of
+  // the previous frame, to check it still matches.
+  template <typename T>
+  void HashLayout(const T &value) {
+    if (!layout_pass_ && !retained_) return;
+    // 64 bit FNV-1a, see FontCache::Key().
+    auto bytes = reinterpret_cast<const uint8_t *>(&value);
+    for (size_t i = 0; i < sizeof(T); i++) {
+      layout_hash_ = (layout_hash_ ^ bytes[i]) * 1099511628211ULL;
+    }
+  }
+
   // Determines placement for the UI as a whole inside the available space
   // (screen).
   void PositionUI(const vec2i &canvas_size, float virtual_resolution,
                   Alignment horizontal, Alignment vertical) {
+    HashLayout(canvas_size);
+    HashLayout(virtual_resolution);
     if (layout_pass_) {
       canvas_size_ = canvas_size;
       virtual_resolution_ = virtual_resolution;
@@ -192,7 +277,7 @@ class InternalState : public Group {
     // Update font manager if they need to upload font atlas texture.
     fontman_.StartRenderPass();
 
-    size_ = elements_[0].size;
+    if (elements_.size()) size_ = elements_[0].size;
 
     layout_pass_ = false;
     element_it_ = elements_.begin();
@@ -200,17 +285,35 @@ class InternalState : public Group {
     CheckGamePadNavigation();
   }
 
+  // Called at the end of the frame. Decides if the next frame can skip its
+  // layout pass: once two consecutive frames produced the same layout hash,
+  // the layout is considered static, and subsequent frames reuse it for as long
+  // as their render pass hashes to the same value.
+  // A frame that reuses the layout only finds out the layout changed at its
+  // end, so changed elements are positioned with the old layout (or skipped,
+  // like elements added by event handlers, see NextElement()) for one frame.
+  void FinishFrame() {
+    auto &layout = persistent_.layout;
+    layout.retained = layout_hash_ == layout.hash;
+    if (!retained_) {
+      layout.hash = layout_hash_;
+      layout.canvas_size = canvas_size_;
+      layout.virtual_resolution = virtual_resolution_;
+      layout.pixel_scale = pixel_scale_;
+    }
+  }
+
   // (render pass): retrieve the next corresponding cached element we
   // created in the layout pass. This is slightly more tricky than a straight
   // lookup because event handlers may insert/remove elements.
-  const Element *NextElement(const char *id) {
+  const Element *NextElement(ElementId id) {
     auto backup = element_it_;
     while (element_it_ != elements_.end()) {
       // This loop usually returns on the first iteration, the only time it
       // doesn't is if an event handler caused an element to removed.
       auto &element = *element_it_;
       ++element_it_;
-      if (EqualId(element.id, id)) return &element;
+      if (element.id == id) return &element;
     }
     // Didn't find this id at all, which means an event handler just caused
     // this element to be added, so we skip it.
@@ -219,7 +322,7 @@ class InternalState : public Group {
   }
 
   // (layout pass): create a new element.
-  void NewElement(const vec2i &size, const char *id) {
+  void NewElement(const vec2i &size, ElementId id) {
     elements_.push_back(Element(size, id));
   }
 
@@ -259,16 +362,19 @@ class InternalState : public Group {
   void Image(const char *texture_name, float ysize) {
     auto tex = matman_.FindTexture(texture_name);
     assert(tex);  // You need to have called LoadTexture before.
+    auto virtual_image_size =
+        vec2(tex->size().x() * ysize / tex->size().y(), ysize);
+    // Map the size to real screen pixels, rounding to the nearest int
+    // for pixel-aligned rendering.
+    auto size = VirtualToPhysical(virtual_image_size);
+    auto id = HashId(texture_name);
+    HashLayout(id);
+    HashLayout(size);
     if (layout_pass_) {
-      auto virtual_image_size =
-          vec2(tex->size().x() * ysize / tex->size().y(), ysize);
-      // Map the size to real screen pixels, rounding to the nearest int
-      // for pixel-aligned rendering.
-      auto size = VirtualToPhysical(virtual_image_size);
-      NewElement(size, texture_name);
+      NewElement(size, id);
       Extend(size);
     } else {
-      auto element = NextElement(texture_name);
+      auto element = NextElement(id);
       if (element) {
         auto position = Position(*element);
         tex->Set(0);
@@ -285,6 +391,7 @@ class InternalState : public Group {
 #ifdef USE_GLYPHCACHE
     auto size = VirtualToPhysical(vec2(0, ysize));
     auto buffer = fontman_.GetBuffer(text, size.y());
+    auto id = HashId(text);
     if (layout_pass_) {
       if (buffer == nullptr) {
         // Upload a texture & flush glyph cache
@@ -299,30 +406,40 @@ class InternalState : public Group {
                        "instead.\n", text, size.y());
         }
       }
-      NewElement(buffer->get_size(), text);
+      // Only the size of a label matters to the layout, see LabelElement().
+      HashLayout(buffer->get_size());
+      NewElement(buffer->get_size(), id);
       Extend(buffer->get_size());
     } else {
+      if (buffer == nullptr) {
+        // Only happens when reusing the previous layout, as the layout pass
+        // makes room in the glyph cache. Skip the label, the size hashed
+        // doesn't match any real one so the next frame runs a layout pass.
+        HashLayout(vec2i(-1, -1));
+        return;
+      }
+      HashLayout(buffer->get_size());
       // Check if texture atlas needs to be updated.
       if (buffer->get_pass() > 0) {
+        // Draw the text batched so far while the atlas still holds its glyphs.
+        RenderText();
         fontman_.StartRenderPass();
       }
 
-      auto element = NextElement(text);
+      auto element = LabelElement(id, buffer->get_size());
       if (element) {
         auto position = Position(*element);
-        fontman_.GetAtlasTexture()->Set(0);
-
-        font_shader_->Set(matman_.renderer());
-        font_shader_->SetUniform("pos_offset",
-                                 vec3(position.x(), position.y(), 0.f));
-
-        const Attribute kFormat[] = {kPosition3f, kTexCoord2f, kEND};
-        Mesh::RenderArray(
-            GL_TRIANGLES, buffer->get_indices()->size(), kFormat,
-            sizeof(FontVertex),
-            reinterpret_cast<const char *>(buffer->get_vertices()->data()),
-            buffer->get_indices()->data());
-
+        // A retained frame skips the layout pass, so a label whose text
+        // changed caches its glyphs here, after StartRenderPass() uploaded
+        // the atlas, possibly on a new page or over evicted glyphs of the
+        // labels batched so far. Draw those before uploading.
+        if (fontman_.atlas_dirty()) {
+          RenderText();
+          fontman_.UpdateAtlasTextures();
+        }
+        fontman_.text_batch().Add(*buffer, fontman_.atlas_textures(),
+                                  vec3(position.x(), position.y(), 0.f),
+                                  text_color_);
         Advance(element->size);
       }
     }
@@ -335,13 +452,15 @@ class InternalState : public Group {
     auto scale = static_cast<float>(size.y()) /
                  static_cast<float>(tex->metrics().ascender() -
                                     tex->metrics().descender());
+    auto image_size =
+        vec2i(tex->size().x() * (uv.z() - uv.x()) * scale, size.y());
+    auto id = HashId(text);
+    HashLayout(image_size);
     if (layout_pass_) {
-      auto image_size =
-          vec2i(tex->size().x() * (uv.z() - uv.x()) * scale, size.y());
-      NewElement(image_size, text);
+      NewElement(image_size, id);
       Extend(image_size);
     } else {
-      auto element = NextElement(text);
+      auto element = LabelElement(id, image_size);
       if (element) {
         auto position = Position(*element);
         tex->Set(0);
@@ -359,9 +478,26 @@ class InternalState : public Group {
 #endif
   }
 
+  // (render pass): retrieve the element of a label. When reusing the previous
+  // layout, a label whose text changed but not its size keeps its place, so
+  // e.g. a score counting up doesn't cause a layout pass.
+  const Element *LabelElement(ElementId id, const vec2i &size) {
+    if (retained_ && element_it_ != elements_.end() &&
+        element_it_->id != id && !element_it_->interactive &&
+        element_it_->size.x() == size.x() &&
+        element_it_->size.y() == size.y()) {
+      return &*element_it_++;
+    }
+    return NextElement(id);
+  }
+
   // An element that has sub-elements. Tracks its state in an instance of
   // Layout, that is pushed/popped from the stack as needed.
-  void StartGroup(bool vertical, Alignment align, int spacing, const char *id) {
+  void StartGroup(bool vertical, Alignment align, int spacing, ElementId id) {
+    HashLayout(vertical);
+    HashLayout(align);
+    HashLayout(spacing);
+    HashLayout(id);
     Group layout(vertical, align, spacing, elements_.size());
     group_stack_.push_back(*this);
     if (layout_pass_) {
@@ -384,6 +520,7 @@ class InternalState : public Group {
     // If you hit this assert, you have one too many EndGroup().
     assert(group_stack_.size());
 
+    HashLayout(group_stack_.size());
     auto size = size_;
     auto margin = margin_.xy() + margin_.zw();
     auto element_idx = element_idx_;
@@ -402,15 +539,17 @@ class InternalState : public Group {
 
   void SetMargin(const Margin &margin) {
     margin_ = VirtualToPhysical(margin.borders);
+    HashLayout(margin_);
   }
 
-  void RecordId(const char *id, int i) { persistent_.pointer_element[i] = id; }
-  bool SameId(const char *id, int i) {
-    return EqualId(id, persistent_.pointer_element[i]);
+  void RecordId(ElementId id, int i) { persistent_.pointer_element[i] = id; }
+  bool SameId(ElementId id, int i) {
+    return id == persistent_.pointer_element[i];
   }
 
   Event CheckEvent() {
     auto &element = elements_[element_idx_];
+    HashLayout(element_idx_);
     if (layout_pass_) {
       element.interactive = true;
     } else {
@@ -443,7 +582,7 @@ class InternalState : public Group {
       }
       // Generate hover events for the current element the gamepad is focused
       // on.
-      if (EqualId(persistent_.gamepad_focus, id)) {
+      if (persistent_.gamepad_focus == id) {
         gamepad_has_focus_element = true;
         return gamepad_event;
       }
@@ -476,7 +615,7 @@ class InternalState : public Group {
     // Now find the current element, and move to the next.
     if (dir) {
       for (auto &e : elements_) {
-        if (EqualId(e.id, persistent_.gamepad_focus)) {
+        if (e.id == persistent_.gamepad_focus) {
           persistent_.gamepad_focus =
               NextInteractiveElement(&e - &elements_[0], dir);
           break;
@@ -496,7 +635,7 @@ class InternalState : public Group {
     return dir;
   }
 
-  const char *NextInteractiveElement(int start, int direction) {
+  ElementId NextInteractiveElement(int start, int direction) {
     auto range = static_cast<int>(elements_.size());
     for (auto i = start;;) {
       i += direction;
@@ -507,7 +646,7 @@ class InternalState : public Group {
         i = -1;
       // Back where we started, either there's no interactive elements, or
       // the vector is empty.
-      if (i == start) return dummy_id();
+      if (i == start) return kNullId;
       if (elements_[i].interactive) return elements_[i].id;
     }
   }
@@ -519,12 +658,21 @@ class InternalState : public Group {
   // Set Label's text color.
   void SetTextColor(const vec4 &color) { text_color_ = color; }
 
-  static const char *dummy_id() { return "__null_id__"; }
+  // (render pass): draw all labels so far, in one call per atlas texture.
+  void RenderText() {
+    fontman_.text_batch().Render(matman_.renderer(), font_batch_shader_);
+  }
+
+  static const uint64_t kLayoutHashSeed = 14695981039346656037ULL;
 
   bool layout_pass_;
-  std::vector<Element> elements_;
+  // This frame has no layout pass, and renders with the previous layout.
+  bool retained_;
+  // Hash of everything the layout depends on, see HashLayout().
+  uint64_t layout_hash_;
+  std::vector<Element> &elements_;
   std::vector<Element>::const_iterator element_it_;
-  std::vector<Group> group_stack_;
+  std::vector<Group> &group_stack_;
   vec2i canvas_size_;
   float virtual_resolution_;
   float pixel_scale_;
@@ -534,6 +682,7 @@ class InternalState : public Group {
   FontManager &fontman_;
   Shader *image_shader_;
   Shader *font_shader_;
+  Shader *font_batch_shader_;
   Shader *color_shader_;
 
   // Widget properties.
@@ -544,38 +693,24 @@ class InternalState : public Group {
   bool gamepad_has_focus_element;
   Event gamepad_event;
 
-  // Intra-frame persistent state.
-  static struct PersistentState {
-    PersistentState() {
-      // This is effectively a global, so no memory allocation or other
-      // complex initialization here.
-      for (int i = 0; i < InputSystem::kMaxSimultanuousPointers; i++) {
-        pointer_element[i] = dummy_id();
-      }
-      gamepad_focus = keyboard_focus = dummy_id();
-    }
-
-    // For each pointer, the element id that last received a down event.
-    const char *pointer_element[InputSystem::kMaxSimultanuousPointers];
-    // The element the gamepad is currently "over", simulates the mouse
-    // hovering over an element.
-    const char *gamepad_focus;
-    // The element that last received an up event. Keystrokes should be
-    // directed to this element, e.g. for a text edit widget
-    const char *keyboard_focus;
-  } persistent_;
+  // Inter-frame persistent state, owned by the Context of this GUI.
+  PersistentState &persistent_;
 };
 
-InternalState::PersistentState InternalState::persistent_;
-
 void Run(MaterialManager &matman, FontManager &fontman, InputSystem &input,
          const std::function<void()> &gui_definition) {
+  static Context default_context;
+  Run(default_context, matman, fontman, input, gui_definition);
+}
+
+void Run(Context &context, MaterialManager &matman, FontManager &fontman,
+         InputSystem &input, const std::function<void()> &gui_definition) {
   // Create our new temporary state.
-  InternalState internal_state(matman, fontman, input);
+  InternalState internal_state(context, matman, fontman, input);
 
   // Run two passes, one for layout, one for rendering.
-  // First pass:
-  gui_definition();
+  // First pass, skipped when the layout of the previous frame is reused:
+  if (internal_state.layout_pass_) gui_definition();
 
   // Second pass:
   internal_state.StartRenderPass();
@@ -594,7 +729,11 @@ void Run(MaterialManager &matman, FontManager &fontman, InputSystem &input,
 
   gui_definition();
 
+  // Labels are batched, and drawn on top of everything else.
+  internal_state.RenderText();
+
   internal_state.CheckGamePadFocus();
+  internal_state.FinishFrame();
 }
 
 InternalState *Gui() {
@@ -609,7 +748,8 @@ void Image(const char *texture_name, float size) {
 void Label(const char *text, float size) { Gui()->Label(text, size); }
 
 void StartGroup(Layout layout, int spacing, const char *id) {
-  Gui()->StartGroup(IsVertical(layout), GetAlignment(layout), spacing, id);
+  Gui()->StartGroup(IsVertical(layout), GetAlignment(layout), spacing,
+                    HashId(id));
 }
 
 void EndGroup() { Gui()->EndGroup(); }
@@ -16,6 +16,7 @@
 #define FPL_IMGUI_H
 
 #include <functional>
+#include <memory>
 
 #include <material_manager.h>
 #include <font_manager.h>
@@ -26,14 +27,37 @@
 namespace fpl {
 namespace gui {
 
+struct PersistentState;
+
+// Holds the state of a GUI that persists between frames, such as its layout
+// and which element has focus. GUIs that are on screen at the same time, e.g.
+// a HUD per player in split-screen, each need their own Context.
+class Context {
+ public:
+  Context();
+  ~Context();
+
+ private:
+  friend class InternalState;
+  std::unique_ptr<PersistentState> state_;
+};
+
 // The core function that drives the GUI.
 // matman: the MaterialManager you want to use textures from.
 // gui_definition: a function that defines all GUI elements using the GUI
 // element construction functions.
 // It will be run twice, once for layout, once for rendering & events.
+// Once the layout is the same in two consecutive frames, the layout pass is
+// skipped and the previous layout reused, for as long as the elements, their
+// sizes and ids stay the same. A change is picked up with a frame of delay.
 void Run(MaterialManager &matman, FontManager &fontman, InputSystem &input,
          const std::function<void()> &gui_definition);
 
+// Same as above, for a GUI that keeps its state in `context` rather than in
+// the default Context used by the function above.
+void Run(Context &context, MaterialManager &matman, FontManager &fontman,
+         InputSystem &input, const std::function<void()> &gui_definition);
+
 // Event types returned by most interactive elements. These are flags because
 // multiple may occur during one frame, and thus should be tested using &.
 // For example, it is not uncommon for the value to be
@@ -112,6 +136,8 @@ void Label(const unsigned char *text, float ysize);
 // Create a group of elements with the given layout and intra-element spacing.
 // Start/end calls must be matched and may be nested to create more complex
 // layouts.
+// id: identifies the group for events. Ids are compared by their contents, so
+// they may be generated (e.g. "button%d" in a loop) in a temporary buffer.
 void StartGroup(Layout layout, int spacing = 0,
                 const char *id = "__group_id__");
 void EndGroup();
@@ -14,17 +14,79 @@
 
 #include "precompiled.h"
 #include "material.h"
+#include "compressed_texture.h"
 #include "renderer.h"
+#include "utilities.h"
 
 namespace fpl {
 
 void Texture::Load() {
-  data_ =
-      renderer_->LoadAndUnpackTexture(filename_.c_str(), &size_, &has_alpha_);
+  // Textures that ask for a specific format are left alone.
+  if (desired_ == kFormatAuto && LoadCompressed()) return;
+  std::string error;
+  data_ = Renderer::LoadAndUnpackTexture(filename_.c_str(), &size_,
+                                         &has_alpha_, &error);
   if (!data_) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "texture load: %s: %s",
-                 filename_.c_str(), renderer_->last_error().c_str());
+                 filename_.c_str(), error.c_str());
+    return;
   }
+  // Convert here on the loader thread, so that Finalize() only has to upload.
+  format_ = renderer_->UploadFormat(has_alpha_, desired_);
+  Renderer::ConvertTexture(data_, size_, format_);
+}
+
+bool Texture::LoadCompressed() {
+  // The asset pipeline optionally puts a KTX file next to the original.
+  const size_t ext_pos = filename_.find_last_of('.');
+  if (ext_pos == std::string::npos) return false;
+  const std::string ktx_filename = filename_.substr(0, ext_pos) + ".ktx";
+  // Most textures have none, which is not worth logging errors for.
+  if (!AssetFile::Exists(ktx_filename.c_str())) return false;
+  if (!compressed_file_.Open(ktx_filename.c_str())) return false;
+  KTXTexture ktx;
+  if (!ParseKTX(compressed_file_.data(), compressed_file_.size(), &ktx)) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "texture load: %s: unsupported KTX file",
+                 ktx_filename.c_str());
+    compressed_file_.Close();
+    return false;
+  }
+  size_ = ktx.size;
+  has_alpha_ = CompressedFormatHasAlpha(ktx.internal_format);
+
+  // Best case, the GPU samples the compressed data directly, straight from
+  // the file.
+  if (renderer_->SupportsCompressedFormat(ktx.internal_format)) return true;
+
+  // Otherwise decode it here, if we can. There's no decoder for the formats
+  // with alpha, those fall back to the original file.
+  if (ktx.internal_format != kCompressedETC1RGB8) {
+    compressed_file_.Close();
+    return false;
+  }
+  mip_levels_ = ktx.HasCompleteMipChain() ? static_cast<int>(ktx.levels.size())
+                                          : 0;
+  const int num_levels = std::max(mip_levels_, 1);
+  int num_pixels = 0;
+  for (int level = 0; level < num_levels; level++) {
+    num_pixels += std::max(size_.x() >> level, 1) *
+                  std::max(size_.y() >> level, 1);
+  }
+  data_ = static_cast<uint8_t *>(malloc(num_pixels * 3));
+  uint8_t *level_data = data_;
+  for (int level = 0; level < num_levels; level++) {
+    const vec2i level_size(std::max(size_.x() >> level, 1),
+                           std::max(size_.y() >> level, 1));
+    DecodeETC1(ktx.levels[level], level_size, level_data);
+    level_data += level_size.x() * level_size.y() * 3;
+  }
+  // The mip levels are back to back, so they can be converted as one long
+  // row of pixels.
+  format_ = renderer_->UploadFormat(false, kFormatAuto);
+  Renderer::ConvertTexture(data_, vec2i(num_pixels, 1), format_);
+  compressed_file_.Close();
+  return true;
 }
 
 void Texture::LoadFromMemory(const uint8_t *data, const vec2i size,
@@ -33,17 +95,77 @@ void Texture::LoadFromMemory(const uint8_t *data, const vec2i size,
   has_alpha_ = has_alpha;
   desired_ = format;
   id_ = renderer_->CreateTexture(data, size_, has_alpha_, desired_);
+  set_gpu_memory(Renderer::TextureMemory(
+      size_, renderer_->UploadFormat(has_alpha_, desired_)));
 }
 
 void Texture::Finalize() {
+  if (compressed_file_.is_open()) {
+    KTXTexture ktx;
+    ParseKTX(compressed_file_.data(), compressed_file_.size(),
+             &ktx);  // Validated by Load().
+    id_ = renderer_->UploadCompressedTexture(ktx);
+    compressed_file_.Close();
+    size_t bytes = 0;
+    const size_t num_levels = ktx.HasCompleteMipChain() ? ktx.levels.size() : 1;
+    for (size_t level = 0; level < num_levels; level++) {
+      bytes += ktx.level_sizes[level];
+    }
+    set_gpu_memory(bytes);
+  }
   if (data_) {
-    id_ = renderer_->CreateTexture(data_, size_, has_alpha_, desired_);
+    id_ = renderer_->UploadTexture(data_, size_, format_, mip_levels_);
+    set_gpu_memory(Renderer::TextureMemory(size_, format_, mip_levels_));
     free(data_);
     data_ = nullptr;
   }
+  FinishedLoading();
+}
+
+void Texture::FinishedLoading() {
+  queued_ = false;
+  load_failed_ = !id_;
+  if (load_failed_) set_gpu_memory(0);
+}
+
+void Texture::set_gpu_memory(size_t bytes) {
+  if (gpu_memory_total_) {
+    *gpu_memory_total_ = *gpu_memory_total_ - gpu_memory_ + bytes;
+  }
+  gpu_memory_ = bytes;
+}
+
+bool Texture::FinalizeSlice(size_t max_bytes) {
+  // Compressed textures and those with their own mip levels are small enough
+  // to upload in one go.
+  if (!data_ || mip_levels_) {
+    Finalize();
+    return true;
+  }
+  if (!upload_id_) {
+    upload_id_ = renderer_->AllocateTexture(size_, format_);
+    if (!upload_id_) {
+      free(data_);
+      data_ = nullptr;
+      FinishedLoading();
+      return true;
+    }
+  }
+  upload_row_ = renderer_->UploadTextureRows(upload_id_, data_, size_, format_,
+                                             upload_row_, max_bytes);
+  if (upload_row_ < size_.y()) return false;
+  id_ = upload_id_;
+  upload_id_ = 0;
+  upload_row_ = 0;
+  set_gpu_memory(Renderer::TextureMemory(size_, format_));
+  free(data_);
+  data_ = nullptr;
+  FinishedLoading();
+  return true;
 }
 
 void Texture::Set(size_t unit) {
+  used_ = true;
   GL_CALL(glActiveTexture(GL_TEXTURE0 + unit));
   GL_CALL(glBindTexture(GL_TEXTURE_2D, id_));
 }
@@ -52,6 +174,11 @@ void Texture::Delete() {
   if (id_) {
     GL_CALL(glDeleteTextures(1, &id_));
     id_ = 0;
+    set_gpu_memory(0);
+  }
+  if (upload_id_) {
+    GL_CALL(glDeleteTextures(1, &upload_id_));
+    upload_id_ = 0;
   }
 }
 
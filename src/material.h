@@ -15,6 +15,7 @@
 #ifndef FPL_MATERIAL_H
 #define FPL_MATERIAL_H
 
+#include "asset_file.h"
 #include "shader.h"
 #include "async_loader.h"
 
@@ -30,6 +31,19 @@ enum BlendMode {
   kBlendModeCount  // Must be at end.
 };
 
+// Optional features shaders are specialized on. A shader loaded with a
+// combination of these is compiled with a SHADER_* define for each (see
+// MaterialManager::LoadShader()), so it only pays for what it uses.
+enum ShaderFeature {
+  kShaderFeatureLighting = 1 << 0,   // SHADER_LIGHTING
+  kShaderFeatureNormalMap = 1 << 1,  // SHADER_NORMAL_MAP
+  kShaderFeatureAlphaTest = 1 << 2,  // SHADER_ALPHA_TEST
+  kShaderFeatureInstanced = 1 << 3,  // SHADER_INSTANCED
+  kShaderFeatureDistanceField = 1 << 4,  // SHADER_DISTANCE_FIELD
+
+  kShaderFeatureCombinations = 1 << 5  // Must be at end.
+};
+
 enum TextureFormat {
   kFormatAuto = 0,  // The default, picks based on loaded data.
   kFormat8888,
@@ -48,7 +62,17 @@ class Texture : public AsyncResource {
         size_(mathfu::kZeros2i),
         uv_(vec4(0.0f, 0.0f, 1.0f, 1.0f)),
         has_alpha_(false),
-        desired_(kFormatAuto) {}
+        desired_(kFormatAuto),
+        format_(kFormatAuto),
+        mip_levels_(0),
+        upload_id_(0),
+        upload_row_(0),
+        gpu_memory_(0),
+        gpu_memory_total_(nullptr),
+        used_(false),
+        queued_(false),
+        load_failed_(false),
+        last_used_frame_(0) {}
   Texture(Renderer &renderer)
       : AsyncResource(""),
         renderer_(&renderer),
@@ -56,13 +80,25 @@ class Texture : public AsyncResource {
         size_(mathfu::kZeros2i),
         uv_(vec4(0.0f, 0.0f, 1.0f, 1.0f)),
         has_alpha_(false),
-        desired_(kFormatAuto) {}
+        desired_(kFormatAuto),
+        format_(kFormatAuto),
+        mip_levels_(0),
+        upload_id_(0),
+        upload_row_(0),
+        gpu_memory_(0),
+        gpu_memory_total_(nullptr),
+        used_(false),
+        queued_(false),
+        load_failed_(false),
+        last_used_frame_(0) {}
   ~Texture() { Delete(); }
 
   virtual void Load();
   virtual void LoadFromMemory(const uint8_t *data, const vec2i size,
                               const TextureFormat format, const bool has_alpha);
   virtual void Finalize();
+  // Uploads textures with generated mip levels a few rows at a time.
+  virtual bool FinalizeSlice(size_t max_bytes);
 
   void Set(size_t unit);
   void Delete();
@@ -76,7 +112,22 @@ class Texture : public AsyncResource {
 
   void set_desired_format(TextureFormat format) { desired_ = format; }
 
+  // GPU memory taken up by id_, in bytes.
+  size_t gpu_memory() const { return gpu_memory_; }
+
  private:
+  friend class MaterialManager;
+
+  // Called once id_ is ready, or failed to become so.
+  void FinishedLoading();
+
+  // Sets gpu_memory_, and adjusts gpu_memory_total_ by the difference.
+  void set_gpu_memory(size_t bytes);
+
+  // Loads a GPU compressed version of this texture instead, if there is one.
+  // Returns false if there's none, or none this device can use.
+  bool LoadCompressed();
+
   Renderer *renderer_;
 
   GLuint id_;
@@ -84,11 +135,32 @@ class Texture : public AsyncResource {
   vec4 uv_;
   bool has_alpha_;
   TextureFormat desired_;
+  // The format data_ has been converted to by Load().
+  TextureFormat format_;
+  // Number of mip levels in data_, or 0 if they are to be generated.
+  int mip_levels_;
+  // A KTX file to be uploaded as is, instead of data_.
+  AssetFile compressed_file_;
+  // The texture FinalizeSlice() is uploading to, and the row it's up to.
+  // Becomes id_ once all rows are in.
+  GLuint upload_id_;
+  int upload_row_;
+  size_t gpu_memory_;
+  // Sum of gpu_memory_ of all textures of a MaterialManager, if any.
+  size_t *gpu_memory_total_;
+
+  // Residency bookkeeping for MaterialManager. Set() flags the texture as
+  // used, which MaterialManager turns into last_used_frame_ once per frame,
+  // loading the texture if it isn't resident.
+  bool used_;
+  bool queued_;
+  bool load_failed_;
+  unsigned int last_used_frame_;
 };
 
 class Material {
  public:
-  Material() : blend_mode_(kBlendModeOff) {}
+  Material() : blend_mode_(kBlendModeOff), shader_features_(0) {}
 
   void Set(Renderer &renderer);
 
@@ -100,11 +172,21 @@ class Material {
     blend_mode_ = blend_mode;
   }
 
+  // The ShaderFeature flags the material needs, from its lighting and
+  // normal_map flags and blend mode.
+  int shader_features() const { return shader_features_; }
+  void set_shader_features(int shader_features) {
+    assert(0 <= shader_features &&
+           shader_features < kShaderFeatureCombinations);
+    shader_features_ = shader_features;
+  }
+
   void DeleteTextures();
 
  private:
   std::vector<Texture *> textures_;
   BlendMode blend_mode_;
+  int shader_features_;
 };
 
 }  // namespace fpl
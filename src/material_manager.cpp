@@ -14,11 +14,18 @@
 
 #include "precompiled.h"
 #include "material_manager.h"
+#include "asset_file.h"
+#include "common.h"
 #include "materials_generated.h"
+#include "texture_atlas_generated.h"
 #include "utilities.h"
 
 namespace fpl {
 
+// Textures used within this many frames are never evicted, even when over
+// budget, so that ones drawn every so often don't get reloaded over and over.
+static const unsigned int kMinFramesBeforeEviction = 120;
+
 static_assert(kBlendModeOff == static_cast<BlendMode>(matdef::BlendMode_OFF) &&
                   kBlendModeTest ==
                       static_cast<BlendMode>(matdef::BlendMode_TEST) &&
@@ -34,78 +41,229 @@ T FindInMap(const std::map<std::string, T> &map, const char *name) {
   return it != map.end() ? it->second : 0;
 }
 
-Shader *MaterialManager::FindShader(const char *basename) {
-  return FindInMap(shader_map_, basename);
+// Shader variants are stored under their basename, followed by the
+// ShaderFeature flags they were compiled with, if any.
+static std::string ShaderVariantName(const char *basename, int features) {
+  std::string name = basename;
+  if (features) name += ":" + flatbuffers::NumToString(features);
+  return name;
 }
 
-Shader *MaterialManager::LoadShader(const char *basename) {
-  auto shader = FindShader(basename);
-  if (shader) return shader;
+Shader *MaterialManager::FindShader(const char *basename, int features) {
+  return FindInMap(shader_map_, ShaderVariantName(basename, features).c_str());
+}
+
+Shader *MaterialManager::StartCompilingShader(const char *basename,
+                                              int features) {
+  static const char *kFeatureDefines[] = {
+      "#define SHADER_LIGHTING\n", "#define SHADER_NORMAL_MAP\n",
+      "#define SHADER_ALPHA_TEST\n", "#define SHADER_INSTANCED\n",
+      "#define SHADER_DISTANCE_FIELD\n"};
+  static_assert(1 << PIE_ARRAYSIZE(kFeatureDefines) ==
+                    kShaderFeatureCombinations,
+                "Please add a define for each ShaderFeature.");
   std::string vs_file, ps_file;
   std::string filename = std::string(basename) + ".glslv";
   if (LoadFile(filename.c_str(), &vs_file)) {
     filename = std::string(basename) + ".glslf";
     if (LoadFile(filename.c_str(), &ps_file)) {
-      shader = renderer_.CompileAndLinkShader(vs_file.c_str(), ps_file.c_str());
-      if (shader) {
-        shader_map_[basename] = shader;
-      } else {
-        SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Shader Error:\n%s\n",
-                     renderer_.last_error().c_str());
+      std::string defines;
+      for (size_t i = 0; i < PIE_ARRAYSIZE(kFeatureDefines); i++) {
+        if (features & (1 << i)) defines += kFeatureDefines[i];
       }
-      return shader;
+      return renderer_.StartCompilingShader(vs_file.c_str(), ps_file.c_str(),
+                                            defines.c_str());
     }
   }
-  SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can\'t load shader: %s",
-               filename.c_str());
   renderer_.last_error() = "Couldn\'t load: " + filename;
   return nullptr;
 }
 
+void MaterialManager::StartLoadingShader(const char *basename, int features) {
+  const std::string name = ShaderVariantName(basename, features);
+  if (FindInMap(shader_map_, name.c_str()) ||
+      FindInMap(pending_shader_map_, name.c_str()))
+    return;
+  // Errors are reported once LoadShader() is called for it.
+  auto shader = StartCompilingShader(basename, features);
+  if (shader) pending_shader_map_[name] = shader;
+}
+
+Shader *MaterialManager::LoadShader(const char *basename, int features) {
+  const std::string name = ShaderVariantName(basename, features);
+  auto shader = FindInMap(shader_map_, name.c_str());
+  if (shader) return shader;
+  auto it = pending_shader_map_.find(name);
+  if (it != pending_shader_map_.end()) {
+    shader = it->second;
+    pending_shader_map_.erase(it);
+  } else {
+    shader = StartCompilingShader(basename, features);
+    if (!shader) {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can\'t load shader: %s",
+                   renderer_.last_error().c_str());
+      return nullptr;
+    }
+  }
+  if (!renderer_.FinishCompilingShader(shader)) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Shader Error:\n%s\n",
+                 renderer_.last_error().c_str());
+    delete shader;
+    return nullptr;
+  }
+  shader_map_[name] = shader;
+  return shader;
+}
+
 Texture *MaterialManager::FindTexture(const char *filename) {
   return FindInMap(texture_map_, filename);
 }
 
 Texture *MaterialManager::LoadTexture(const char *filename,
-                                      TextureFormat format) {
+                                      TextureFormat format, int priority) {
   auto tex = FindTexture(filename);
-  if (tex) return tex;
-  tex = new Texture(renderer_, filename);
-  tex->set_desired_format(format);
-  loader_.QueueJob(tex);
-  texture_map_[filename] = tex;
+  if (!tex) {
+    tex = new Texture(renderer_, filename);
+    tex->set_desired_format(format);
+    tex->gpu_memory_total_ = &texture_memory_;
+    texture_map_[filename] = tex;
+  }
+  // Textures loaded on demand before may be needed right away now.
+  if (priority != kLoadPriorityOnDemand) QueueTexture(tex, priority);
   return tex;
 }
 
-void MaterialManager::StartLoadingTextures() { loader_.StartLoading(); }
+void MaterialManager::QueueTexture(Texture *tex, int priority) {
+  if (tex->id() || tex->queued_ || tex->load_failed_) return;
+  tex->queued_ = true;
+  loader_.QueueJob(tex, priority);
+}
 
-bool MaterialManager::TryFinalize() { return loader_.TryFinalize(); }
+void MaterialManager::Prefetch(const Material *mat) {
+  for (auto it = mat->textures().begin(); it != mat->textures().end(); ++it) {
+    QueueTexture(*it, kLoadPriorityNormal);
+  }
+}
+
+void MaterialManager::UpdateResidency(int finalize_budget_ms) {
+  frame_++;
+  for (auto it = texture_map_.begin(); it != texture_map_.end(); ++it) {
+    Texture *tex = it->second;
+    if (!tex->used_) continue;
+    tex->used_ = false;
+    tex->last_used_frame_ = frame_;
+    QueueTexture(tex, kLoadPriorityNormal);
+  }
+  loader_.TryFinalize(finalize_budget_ms);
+  EvictTextures();
+}
+
+void MaterialManager::EvictTextures() {
+  if (!texture_memory_budget_ || texture_memory_ <= texture_memory_budget_)
+    return;
+  std::vector<Texture *> candidates;
+  for (auto it = texture_map_.begin(); it != texture_map_.end(); ++it) {
+    Texture *tex = it->second;
+    if (tex->id() && frame_ - tex->last_used_frame_ > kMinFramesBeforeEviction)
+      candidates.push_back(tex);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Texture *a, const Texture *b) {
+    return a->last_used_frame_ < b->last_used_frame_;
+  });
+  for (auto it = candidates.begin();
+       it != candidates.end() && texture_memory_ > texture_memory_budget_;
+       ++it) {
+    (*it)->Delete();
+  }
+}
+
+void MaterialManager::StartLoadingTextures(int num_threads) {
+  loader_.StartLoading(num_threads);
+}
+
+bool MaterialManager::TryFinalize(int budget_ms) {
+  return loader_.TryFinalize(budget_ms);
+}
 
 Material *MaterialManager::FindMaterial(const char *filename) {
   return FindInMap(material_map_, filename);
 }
 
-Material *MaterialManager::LoadMaterial(const char *filename) {
+Material *MaterialManager::LoadMaterial(const char *filename, int priority) {
   auto mat = FindMaterial(filename);
   if (mat) return mat;
-  std::string flatbuf;
-  if (LoadFile(filename, &flatbuf)) {
-    flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t *>(flatbuf.c_str()), flatbuf.length());
+  mat = CreateMaterial(filename, false, nullptr, priority);
+  if (mat) material_map_[filename] = mat;
+  return mat;
+}
+
+bool MaterialManager::LoadAtlas(const char *filename) {
+  AssetFile flatbuf;
+  if (!flatbuf.Open(filename)) return false;
+  flatbuffers::Verifier verifier(flatbuf.data(), flatbuf.size());
+  assert(atlasdef::VerifyTextureAtlasBuffer(verifier));
+  auto atlasdef = atlasdef::GetTextureAtlas(flatbuf.data());
+  std::vector<Texture *> pages;
+  for (auto it = atlasdef->pages()->begin(); it != atlasdef->pages()->end();
+       ++it) {
+    pages.push_back(LoadTexture(it->c_str()));
+  }
+  for (auto it = atlasdef->entries()->begin();
+       it != atlasdef->entries()->end(); ++it) {
+    assert(it->page() < pages.size());
+    auto uv = it->uv();
+    AtlasEntry &entry = atlas_map_[it->texture_filename()->c_str()];
+    entry.page = pages[it->page()];
+    entry.uv_rect = vec4(uv->left(), uv->top(), uv->right(), uv->bottom());
+  }
+  return true;
+}
+
+Material *MaterialManager::LoadAtlasedMaterial(const char *filename,
+                                               vec4 *uv_rect) {
+  auto it = atlased_material_map_.find(filename);
+  if (it != atlased_material_map_.end()) {
+    *uv_rect = it->second.second;
+    return it->second.first;
+  }
+  auto mat = CreateMaterial(filename, true, uv_rect, kLoadPriorityNormal);
+  if (mat) atlased_material_map_[filename] = std::make_pair(mat, *uv_rect);
+  return mat;
+}
+
+Material *MaterialManager::CreateMaterial(const char *filename, bool use_atlas,
+                                          vec4 *uv_rect, int priority) {
+  AssetFile flatbuf;
+  if (flatbuf.Open(filename)) {
+    flatbuffers::Verifier verifier(flatbuf.data(), flatbuf.size());
     assert(matdef::VerifyMaterialBuffer(verifier));
-    auto matdef = matdef::GetMaterial(flatbuf.c_str());
-    mat = new Material();
+    auto matdef = matdef::GetMaterial(flatbuf.data());
+    auto mat = new Material();
     mat->set_blend_mode(static_cast<BlendMode>(matdef->blendmode()));
+    assert(!matdef->normal_map() || matdef->lighting());
+    mat->set_shader_features(
+        (matdef->lighting() ? kShaderFeatureLighting : 0) |
+        (matdef->normal_map() ? kShaderFeatureNormalMap : 0) |
+        (mat->blend_mode() != kBlendModeOff ? kShaderFeatureAlphaTest : 0));
+    if (uv_rect) *uv_rect = vec4(0.0f, 0.0f, 1.0f, 1.0f);
     for (size_t i = 0; i < matdef->texture_filenames()->size(); i++) {
+      auto texture_filename = matdef->texture_filenames()->Get(i)->c_str();
+      if (use_atlas) {
+        auto entry = atlas_map_.find(texture_filename);
+        if (entry != atlas_map_.end()) {
+          if (i == 0) *uv_rect = entry->second.uv_rect;
+          mat->textures().push_back(entry->second.page);
+          continue;
+        }
+      }
       auto format =
           matdef->desired_format() && i < matdef->desired_format()->size()
               ? static_cast<TextureFormat>(matdef->desired_format()->Get(i))
               : kFormatAuto;
-      auto tex =
-          LoadTexture(matdef->texture_filenames()->Get(i)->c_str(), format);
-      mat->textures().push_back(tex);
+      mat->textures().push_back(
+          LoadTexture(texture_filename, format, priority));
     }
-    material_map_[filename] = mat;
     return mat;
   }
   renderer_.last_error() = std::string("Couldn\'t load: ") + filename;
@@ -114,12 +272,31 @@ Material *MaterialManager::LoadMaterial(const char *filename) {
 
 void MaterialManager::UnloadMaterial(const char *filename) {
   auto mat = FindMaterial(filename);
-  if (!mat) return;
-  mat->DeleteTextures();
-  material_map_.erase(filename);
+  if (mat) {
+    UnloadTextures(mat);
+    material_map_.erase(filename);
+  }
+  auto atlased = atlased_material_map_.find(filename);
+  if (atlased != atlased_material_map_.end()) {
+    UnloadTextures(atlased->second.first);
+    atlased_material_map_.erase(atlased);
+  }
+}
+
+void MaterialManager::UnloadTextures(Material *mat) {
   for (auto it = mat->textures().begin(); it != mat->textures().end(); ++it) {
+    // Atlas pages are shared by all materials in the atlas.
+    if (IsAtlasPage(*it)) continue;
+    (*it)->Delete();
     texture_map_.erase((*it)->filename());
   }
 }
 
+bool MaterialManager::IsAtlasPage(const Texture *tex) const {
+  for (auto it = atlas_map_.begin(); it != atlas_map_.end(); ++it) {
+    if (it->second.page == tex) return true;
+  }
+  return false;
+}
+
 }  // namespace fpl
@@ -23,41 +23,101 @@ namespace fpl {
 
 class MaterialManager {
  public:
-  MaterialManager(Renderer &renderer) : renderer_(renderer) {}
+  MaterialManager(Renderer &renderer)
+      : renderer_(renderer),
+        texture_memory_budget_(0),
+        texture_memory_(0),
+        frame_(0) {}
 
   // Returns a previously loaded shader object, or nullptr.
-  Shader *FindShader(const char *basename);
+  Shader *FindShader(const char *basename, int features = 0);
   // Loads a shader if it hasn't been loaded already, by appending .glslv
   // and .glslf to the basename, compiling and linking them.
+  // 'features' is a combination of ShaderFeature flags. Each combination is
+  // a separate variant of the shader, compiled with a SHADER_* define for
+  // each flag.
   // If this returns nullptr, the error can be found in Renderer::last_error().
-  Shader *LoadShader(const char *basename);
+  Shader *LoadShader(const char *basename, int features = 0);
+
+  // Starts compiling a shader that LoadShader() will be called for later,
+  // without waiting for it. Starting all shaders up front lets drivers that
+  // compile in the background work on them in parallel.
+  void StartLoadingShader(const char *basename, int features = 0);
 
   // Returns a previously created texture, or nullptr.
   Texture *FindTexture(const char *filename);
   // Queue's a texture for loading if it hasn't been loaded already.
   // Currently only supports TGA/WebP format files.
+  // Textures with a higher priority (see AsyncLoadPriority) are loaded first.
+  // With kLoadPriorityOnDemand, the texture isn't queued until it's first
+  // used or prefetched.
   // Returned texture isn't usable until TryFinalize() succeeds and the id
   // is non-zero.
   Texture *LoadTexture(const char *filename,
-                       TextureFormat format = kFormatAuto);
+                       TextureFormat format = kFormatAuto,
+                       int priority = kLoadPriorityNormal);
   // LoadTextures doesn't actually load anything, this will start the async
-  // loading of all files, and decompression.
-  void StartLoadingTextures();
+  // loading of all files, and decompression, on num_threads threads (0 picks
+  // a number suitable for this device).
+  void StartLoadingTextures(int num_threads = 0);
   // Call this repeatedly until it returns true, which signals all textures
-  // will have loaded, and turned into OpenGL textures.
+  // will have loaded, and turned into OpenGL textures. If budget_ms is
+  // non-zero, each call spends roughly at most that many milliseconds on
+  // uploading textures.
   // Textures with a 0 id will have failed to load.
-  bool TryFinalize();
+  bool TryFinalize(int budget_ms = 0);
+  // Whether all textures queued so far are ready, without finalizing any.
+  bool TexturesLoaded() { return loader_.Done(); }
+  // The fraction of textures requested so far that are ready to use, from 0
+  // to 1.
+  float LoadingProgress() { return loader_.Progress(); }
 
   // Returns a previously loaded material, or nullptr.
   Material *FindMaterial(const char *filename);
   // Loads a material, which is a compiled FlatBuffer file with
-  // root Material. This loads all resources contained there-in.
+  // root Material. This loads all resources contained there-in, with the
+  // given priority (see LoadTexture()).
   // If this returns nullptr, the error can be found in Renderer::last_error().
-  Material *LoadMaterial(const char *filename);
+  Material *LoadMaterial(const char *filename,
+                         int priority = kLoadPriorityNormal);
+
+  // Loads a texture atlas, which is a compiled FlatBuffer file with root
+  // TextureAtlas, and queues its pages for loading. Textures packed into the
+  // atlas will be substituted by their page in LoadAtlasedMaterial().
+  // Returns false if the atlas isn't present, in which case materials simply
+  // keep using their individual textures.
+  bool LoadAtlas(const char *filename);
+  // Like LoadMaterial(), but textures that are part of a loaded atlas are
+  // replaced by their atlas page, so that materials packed into the same
+  // atlas share textures. The part of the page occupied by the first texture
+  // is returned in 'uv_rect' as (left, top, right, bottom), which is
+  // (0, 0, 1, 1) if it isn't in an atlas. Geometry using this material must
+  // remap its texture coordinates into this rectangle.
+  Material *LoadAtlasedMaterial(const char *filename, vec4 *uv_rect);
+
+  // Queues the textures of 'mat' that aren't resident, such as those loaded
+  // on demand or evicted, ahead of them being used.
+  void Prefetch(const Material *mat);
+
+  // Call once per frame. Queues textures that were used while not resident,
+  // and finalizes loaded ones for up to finalize_budget_ms (see
+  // TryFinalize()). Then, if textures take up more GPU memory than the budget,
+  // deletes the least recently used ones until they fit. Deleted textures are
+  // loaded again when next used.
+  void UpdateResidency(int finalize_budget_ms);
+
+  // GPU memory textures may take up before UpdateResidency() evicts them, in
+  // bytes, or 0 for no limit.
+  void set_texture_memory_budget(size_t budget) {
+    texture_memory_budget_ = budget;
+  }
+  // GPU memory currently taken up by the textures of this manager.
+  size_t texture_memory() const { return texture_memory_; }
 
   // Deletes all OpenGL textures contained in this material, and removes the
   // textures and the material from material manager. Any subsequent requests
   // for these textures through Load*() will cause them to be loaded anew.
+  // Atlas pages stay loaded, since other materials in the atlas use them too.
   void UnloadMaterial(const char *filename);
 
   // Handy accessors, so you don't have to pass the renderer around too.
@@ -67,11 +127,38 @@ class MaterialManager {
  private:
   DISALLOW_COPY_AND_ASSIGN(MaterialManager);
 
+  // Where a texture ended up in an atlas.
+  struct AtlasEntry {
+    Texture *page;
+    vec4 uv_rect;
+  };
+
+  // Loads the .glslv and .glslf files for 'basename', and starts compiling
+  // the variant for 'features'. Returns nullptr if the files can't be loaded,
+  // with an error in renderer_.last_error().
+  Shader *StartCompilingShader(const char *basename, int features);
+  Material *CreateMaterial(const char *filename, bool use_atlas,
+                           vec4 *uv_rect, int priority);
+  // Deletes the textures of 'mat', except for atlas pages.
+  void UnloadTextures(Material *mat);
+  bool IsAtlasPage(const Texture *tex) const;
+  // Queues 'tex' unless it's resident or already queued.
+  void QueueTexture(Texture *tex, int priority);
+  void EvictTextures();
+
   Renderer &renderer_;
   std::map<std::string, Shader *> shader_map_;
+  // Shaders from StartLoadingShader() that LoadShader() hasn't finished yet.
+  std::map<std::string, Shader *> pending_shader_map_;
   std::map<std::string, Texture *> texture_map_;
   std::map<std::string, Material *> material_map_;
+  std::map<std::string, AtlasEntry> atlas_map_;
+  std::map<std::string, std::pair<Material *, vec4>> atlased_material_map_;
   AsyncLoader loader_;
+  size_t texture_memory_budget_;
+  size_t texture_memory_;
+  // Counts calls to UpdateResidency(), to tell when textures were last used.
+  unsigned int frame_;
 };
 
 }  // namespace fpl
@@ -14,6 +14,7 @@
 
 #include "precompiled.h"
 #include "mesh.h"
+#include "renderer.h"
 
 namespace fpl {
 
@@ -59,6 +60,39 @@ void Mesh::SetAttributes(GLuint vbo, const Attribute *attributes, int stride,
   }
 }
 
+void Mesh::SetInstanceAttributes(GLuint vbo, int stride, const char *buffer,
+                                 bool use_instance_color, GLuint divisor) {
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+  for (int i = 0; i < 3; i++) {
+    const GLuint location = kAttributeInstanceTransform + i;
+    GL_CALL(glEnableVertexAttribArray(location));
+    GL_CALL(glVertexAttribPointer(location, 4, GL_FLOAT, false, stride,
+                                  buffer + i * sizeof(vec4_packed)));
+    if (divisor) GL_CALL(glVertexAttribDivisorFPL(location, divisor));
+  }
+  if (use_instance_color) {
+    // The color follows the 3 transform rows in MeshInstance.
+    GL_CALL(glEnableVertexAttribArray(kAttributeColor));
+    GL_CALL(glVertexAttribPointer(kAttributeColor, 4, GL_FLOAT, false, stride,
+                                  buffer + 3 * sizeof(vec4_packed)));
+    if (divisor) GL_CALL(glVertexAttribDivisorFPL(kAttributeColor, divisor));
+  } else {
+    GL_CALL(glVertexAttrib4f(kAttributeColor, 1.0f, 1.0f, 1.0f, 1.0f));
+  }
+}
+
+void Mesh::UnSetInstanceAttributes(bool use_instance_color, GLuint divisor) {
+  for (int i = 0; i < 3; i++) {
+    const GLuint location = kAttributeInstanceTransform + i;
+    GL_CALL(glDisableVertexAttribArray(location));
+    if (divisor) GL_CALL(glVertexAttribDivisorFPL(location, 0));
+  }
+  if (use_instance_color) {
+    GL_CALL(glDisableVertexAttribArray(kAttributeColor));
+    if (divisor) GL_CALL(glVertexAttribDivisorFPL(kAttributeColor, 0));
+  }
+}
+
 void Mesh::UnSetAttributes(const Attribute *attributes) {
   for (;;) {
     switch (*attributes++) {
@@ -85,14 +119,29 @@ void Mesh::UnSetAttributes(const Attribute *attributes) {
 
 Mesh::Mesh(const void *vertex_data, int count, int vertex_size,
            const Attribute *format)
-    : vertex_size_(vertex_size), format_(format) {
+    : vertex_size_(vertex_size),
+      format_(format),
+      pool_(nullptr),
+      base_vertex_(0),
+      vertex_count_(count) {
+  MeshPool::Unbind();
   GL_CALL(glGenBuffers(1, &vbo_));
   GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo_));
   GL_CALL(glBufferData(GL_ARRAY_BUFFER, count * vertex_size, vertex_data,
                        GL_STATIC_DRAW));
 }
 
+Mesh::Mesh(MeshPool *pool, const void *vertex_data, int count)
+    : vertex_size_(pool->vertex_size()),
+      format_(pool->format()),
+      vbo_(0),
+      pool_(pool),
+      base_vertex_(pool->AddVertices(vertex_data, count)),
+      vertex_count_(count) {}
+
 Mesh::~Mesh() {
+  // Pooled meshes don't own any buffers.
+  if (pool_) return;
   GL_CALL(glDeleteBuffers(1, &vbo_));
   for (auto it = indices_.begin(); it != indices_.end(); ++it) {
     GL_CALL(glDeleteBuffers(1, &it->ibo));
@@ -104,14 +153,33 @@ void Mesh::AddIndices(const unsigned short *index_data, int count,
   indices_.push_back(Indices());
   auto &idxs = indices_.back();
   idxs.count = count;
+  idxs.mat = mat;
+  if (pool_) {
+    idxs.ibo = 0;
+    idxs.offset = pool_->AddIndices(index_data, count, base_vertex_);
+    return;
+  }
+  idxs.offset = 0;
+  MeshPool::Unbind();
   GL_CALL(glGenBuffers(1, &idxs.ibo));
   GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, idxs.ibo));
   GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(int), index_data,
                        GL_STATIC_DRAW));
-  idxs.mat = mat;
 }
 
 void Mesh::Render(Renderer &renderer, bool ignore_material) {
+  if (pool_) {
+    // The pool stays bound afterwards, so the next pooled mesh can skip all
+    // buffer and attribute setup.
+    pool_->Bind();
+    for (auto it = indices_.begin(); it != indices_.end(); ++it) {
+      if (!ignore_material) it->mat->Set(renderer);
+      GL_CALL(glDrawElements(GL_TRIANGLES, it->count, GL_UNSIGNED_SHORT,
+                             reinterpret_cast<const void *>(it->offset)));
+    }
+    return;
+  }
+  MeshPool::Unbind();
   SetAttributes(vbo_, format_, vertex_size_, nullptr);
   for (auto it = indices_.begin(); it != indices_.end(); ++it) {
     if (!ignore_material) it->mat->Set(renderer);
@@ -121,15 +189,100 @@ void Mesh::Render(Renderer &renderer, bool ignore_material) {
   UnSetAttributes(format_);
 }
 
+void Mesh::RenderInstanced(Renderer &renderer, bool use_instance_color,
+                           bool ignore_material) {
+  assert(pool_);
+  const int instance_count = static_cast<int>(pool_->instances_.size());
+  if (!instance_count) return;
+  if (!pool_->instance_vbo_) {
+    RenderExpandedInstances(renderer, use_instance_color, ignore_material);
+    return;
+  }
+  pool_->Bind();
+  SetInstanceAttributes(pool_->instance_vbo_, sizeof(MeshInstance), nullptr,
+                        use_instance_color, 1);
+  for (auto it = indices_.begin(); it != indices_.end(); ++it) {
+    if (!ignore_material) it->mat->Set(renderer);
+    GL_CALL(glDrawElementsInstancedFPL(
+        GL_TRIANGLES, it->count, GL_UNSIGNED_SHORT,
+        reinterpret_cast<const void *>(it->offset), instance_count));
+  }
+  UnSetInstanceAttributes(use_instance_color, 1);
+}
+
+void Mesh::RenderExpandedInstances(Renderer &renderer, bool use_instance_color,
+                                   bool ignore_material) {
+  const auto &instances = pool_->instances_;
+  auto &vertices = pool_->expanded_vertices_;
+  auto &indices = pool_->expanded_indices_;
+  // Every vertex gets a copy of the data of the instance it belongs to.
+  const int stride = static_cast<int>(vertex_size_ + sizeof(MeshInstance));
+  // Batches have to stay within the range of 16 bit indices.
+  const int max_batch_size = 0x10000 / vertex_count_;
+  const uint8_t *source_vertices =
+      &pool_->vertex_data_[base_vertex_ * vertex_size_];
+
+  MeshPool::Unbind();
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+  for (size_t first = 0; first < instances.size(); first += max_batch_size) {
+    const int batch_size = static_cast<int>(std::min(
+        instances.size() - first, static_cast<size_t>(max_batch_size)));
+    vertices.resize(batch_size * vertex_count_ * stride);
+    uint8_t *dest = vertices.data();
+    for (int i = 0; i < batch_size; i++) {
+      for (int v = 0; v < vertex_count_; v++) {
+        memcpy(dest, source_vertices + v * vertex_size_, vertex_size_);
+        memcpy(dest + vertex_size_, &instances[first + i],
+               sizeof(MeshInstance));
+        dest += stride;
+      }
+    }
+    const char *buffer = reinterpret_cast<const char *>(vertices.data());
+    SetAttributes(0, format_, stride, buffer);
+    SetInstanceAttributes(0, stride, buffer + vertex_size_, use_instance_color,
+                          0);
+    for (auto it = indices_.begin(); it != indices_.end(); ++it) {
+      // Our indices in the pool were rebased to base_vertex_.
+      const unsigned short *source_indices =
+          &pool_->index_data_[it->offset / sizeof(unsigned short)];
+      indices.resize(batch_size * it->count);
+      for (int i = 0; i < batch_size; i++) {
+        for (int j = 0; j < it->count; j++) {
+          indices[i * it->count + j] = static_cast<unsigned short>(
+              source_indices[j] - base_vertex_ + i * vertex_count_);
+        }
+      }
+      if (!ignore_material) it->mat->Set(renderer);
+      GL_CALL(glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()),
+                             GL_UNSIGNED_SHORT, indices.data()));
+    }
+    UnSetInstanceAttributes(use_instance_color, 0);
+    UnSetAttributes(format_);
+  }
+}
+
 void Mesh::RenderArray(GLenum primitive, int index_count,
                        const Attribute *format, int vertex_size,
                        const char *vertices, const unsigned short *indices) {
+  MeshPool::Unbind();
   SetAttributes(0, format, vertex_size, vertices);
   GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
   GL_CALL(glDrawElements(primitive, index_count, GL_UNSIGNED_SHORT, indices));
   UnSetAttributes(format);
 }
 
+void Mesh::RenderArray(GLenum primitive, int index_count,
+                       const Attribute *format, int vertex_size, GLuint vbo,
+                       size_t vertex_offset, GLuint ibo, size_t index_offset) {
+  MeshPool::Unbind();
+  SetAttributes(vbo, format, vertex_size,
+                reinterpret_cast<const char *>(vertex_offset));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
+  GL_CALL(glDrawElements(primitive, index_count, GL_UNSIGNED_SHORT,
+                         reinterpret_cast<const void *>(index_offset)));
+  UnSetAttributes(format);
+}
+
 void Mesh::RenderAAQuadAlongX(const vec3 &bottom_left, const vec3 &top_right,
                               const vec2 &tex_bottom_left,
                               const vec2 &tex_top_right) {
@@ -211,4 +364,107 @@ void Mesh::ComputeNormalsTangents(NormalMappedVertex *vertices,
   }
 }
 
+MeshPool *MeshPool::bound_pool_ = nullptr;
+
+MeshPool::MeshPool(int vertex_size, const Attribute *format)
+    : vertex_size_(vertex_size),
+      format_(format),
+      vertex_count_(0),
+      vbo_(0),
+      ibo_(0),
+      vao_(0),
+      instance_vbo_(0) {}
+
+MeshPool::~MeshPool() {
+  if (bound_pool_ == this) Unbind();
+  if (vao_) GL_CALL(glDeleteVertexArraysFPL(1, &vao_));
+  if (instance_vbo_) GL_CALL(glDeleteBuffers(1, &instance_vbo_));
+  if (vbo_) GL_CALL(glDeleteBuffers(1, &vbo_));
+  if (ibo_) GL_CALL(glDeleteBuffers(1, &ibo_));
+}
+
+int MeshPool::AddVertices(const void *vertex_data, int count) {
+  assert(!vbo_);
+  auto bytes = static_cast<const uint8_t *>(vertex_data);
+  vertex_data_.insert(vertex_data_.end(), bytes, bytes + count * vertex_size_);
+  const int base_vertex = vertex_count_;
+  vertex_count_ += count;
+  return base_vertex;
+}
+
+size_t MeshPool::AddIndices(const unsigned short *indices, int count,
+                            int base_vertex) {
+  assert(!ibo_);
+  // OpenGL ES 2 has no glDrawElementsBaseVertex, so rebase the indices here.
+  assert(vertex_count_ <= 0x10000);
+  const size_t offset = index_data_.size() * sizeof(unsigned short);
+  for (int i = 0; i < count; i++) {
+    index_data_.push_back(
+        static_cast<unsigned short>(indices[i] + base_vertex));
+  }
+  return offset;
+}
+
+void MeshPool::Finalize(const Renderer &renderer) {
+  assert(!vbo_ && !ibo_);
+  Unbind();
+  GL_CALL(glGenBuffers(1, &vbo_));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo_));
+  GL_CALL(glBufferData(GL_ARRAY_BUFFER, vertex_data_.size(),
+                       vertex_data_.data(), GL_STATIC_DRAW));
+  GL_CALL(glGenBuffers(1, &ibo_));
+  GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_));
+  GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                       index_data_.size() * sizeof(unsigned short),
+                       index_data_.data(), GL_STATIC_DRAW));
+
+  // Without instanced arrays, instances get expanded from the data in memory.
+  if (renderer.supports_instanced_arrays()) {
+    GL_CALL(glGenBuffers(1, &instance_vbo_));
+    std::vector<uint8_t>().swap(vertex_data_);
+    std::vector<unsigned short>().swap(index_data_);
+  }
+
+  // Record the attribute setup once, so Bind() is a single call.
+  if (renderer.supports_vertex_array_objects()) {
+    GL_CALL(glGenVertexArraysFPL(1, &vao_));
+    GL_CALL(glBindVertexArrayFPL(vao_));
+    Mesh::SetAttributes(vbo_, format_, vertex_size_, nullptr);
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_));
+    GL_CALL(glBindVertexArrayFPL(0));
+  }
+}
+
+void MeshPool::Bind() {
+  assert(vbo_);
+  if (bound_pool_ == this) return;
+  Unbind();
+  if (vao_) {
+    GL_CALL(glBindVertexArrayFPL(vao_));
+  } else {
+    Mesh::SetAttributes(vbo_, format_, vertex_size_, nullptr);
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_));
+  }
+  bound_pool_ = this;
+}
+
+void MeshPool::SetInstances(const MeshInstance *instances, int count) {
+  instances_.assign(instances, instances + count);
+  if (instance_vbo_ && count) {
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_));
+    GL_CALL(glBufferData(GL_ARRAY_BUFFER, count * sizeof(MeshInstance),
+                         instances, GL_STREAM_DRAW));
+  }
+}
+
+void MeshPool::Unbind() {
+  if (!bound_pool_) return;
+  if (bound_pool_->vao_) {
+    GL_CALL(glBindVertexArrayFPL(0));
+  } else {
+    Mesh::UnSetAttributes(bound_pool_->format_);
+  }
+  bound_pool_ = nullptr;
+}
+
 }  // namespace fpl
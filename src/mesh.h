@@ -15,6 +15,7 @@
 #ifndef FPL_MESH_H
 #define FPL_MESH_H
 
+#include "common.h"
 #include "material.h"
 
 namespace fpl {
@@ -24,6 +25,7 @@ using mathfu::vec3_packed;
 using mathfu::vec4_packed;
 
 class Renderer;
+class MeshPool;
 
 // An array of these enums defines the format of vertex data.
 enum Attribute {
@@ -46,20 +48,52 @@ struct NormalMappedVertex {
   vec4_packed tangent;
 };
 
+// Per-instance data for Mesh::RenderInstanced().
+struct MeshInstance {
+  MeshInstance() {}
+  MeshInstance(const mat4 &world_matrix, const vec4 &instance_color)
+      : color(instance_color) {
+    for (int i = 0; i < 3; i++) {
+      transform[i] = vec4(world_matrix(i, 0), world_matrix(i, 1),
+                          world_matrix(i, 2), world_matrix(i, 3));
+    }
+  }
+  // The top three rows of the object to world transform, which is assumed to
+  // be affine. Passing three rows rather than a mat4 keeps instanced shaders
+  // within the 8 vertex attributes OpenGL ES 2 guarantees.
+  vec4_packed transform[3];
+  vec4_packed color;
+};
+
 // A mesh instance contains a VBO and one or more IBO's.
 class Mesh {
  public:
   // Initialize a Mesh by creating one VBO, and no IBO's.
   Mesh(const void *vertex_data, int count, int vertex_size,
        const Attribute *format);
+  // Initialize a Mesh whose vertices (and indices, added below) live in
+  // 'pool' instead of buffers of its own. It uses the vertex format of the
+  // pool, and can't be rendered until the pool has been finalized.
+  Mesh(MeshPool *pool, const void *vertex_data, int count);
   ~Mesh();
 
   // Create one IBO to be part of this mesh. May be called more than once.
+  // For pooled meshes, this appends to the pool's IBO instead.
   void AddIndices(const unsigned short *indices, int count, Material *mat);
 
   // Render itself. Uniforms must have been set before calling this.
   void Render(Renderer &renderer, bool ignore_material = false);
 
+  // Render one copy of this mesh for each of the instances last passed to
+  // MeshPool::SetInstances(). Only works for pooled meshes. The shader gets
+  // the instance transform in aInstanceRow0..2 and, if 'use_instance_color'
+  // is set, the instance color in aColor (white otherwise).
+  // Uses instanced arrays when the driver supports them. Otherwise the
+  // instances are expanded into plain vertex data on the CPU, so that the same
+  // shaders work, and drawn with a single call all the same.
+  void RenderInstanced(Renderer &renderer, bool use_instance_color,
+                       bool ignore_material = false);
+
   // Get the material associated with the Nth IBO.
   Material *GetMaterial(int i) { return indices_[i].mat; }
 
@@ -70,6 +104,13 @@ class Mesh {
                           const Attribute *format, int vertex_size,
                           const char *vertices, const unsigned short *indices);
 
+  // Like the above, but with vertex and index data in the buffer objects 'vbo'
+  // and 'ibo', starting at the given byte offsets.
+  static void RenderArray(GLenum primitive, int index_count,
+                          const Attribute *format, int vertex_size, GLuint vbo,
+                          size_t vertex_offset, GLuint ibo,
+                          size_t index_offset);
+
   // Convenience method for rendering a Quad. bottom_left and top_right must
   // have their X coordinate be different, but either Y or Z can be the same.
   static void RenderAAQuadAlongX(const vec3 &bottom_left, const vec3 &top_right,
@@ -86,22 +127,100 @@ class Mesh {
     kAttributeNormal,
     kAttributeTangent,
     kAttributeTexCoord,
-    kAttributeColor
+    kAttributeColor,
+    // Rows of the instance transform, which take up 3 consecutive locations.
+    kAttributeInstanceTransform
   };
 
  private:
+  friend class MeshPool;
   static void SetAttributes(GLuint vbo, const Attribute *attributes,
                             int vertex_size, const char *buffer);
   static void UnSetAttributes(const Attribute *attributes);
+  // Sets up the instance transform and color attributes from MeshInstance
+  // structs found every 'stride' bytes in 'buffer' (an offset, if 'vbo' is
+  // non-zero).
+  static void SetInstanceAttributes(GLuint vbo, int stride, const char *buffer,
+                                    bool use_instance_color, GLuint divisor);
+  static void UnSetInstanceAttributes(bool use_instance_color, GLuint divisor);
+  void RenderExpandedInstances(Renderer &renderer, bool use_instance_color,
+                               bool ignore_material);
   struct Indices {
     int count;
     GLuint ibo;
+    // Byte offset of the indices in the IBO.
+    size_t offset;
     Material *mat;
   };
   std::vector<Indices> indices_;
   size_t vertex_size_;
   const Attribute *format_;
   GLuint vbo_;
+  MeshPool *pool_;
+  // Index of our first vertex in the pool's VBO.
+  int base_vertex_;
+  int vertex_count_;
+};
+
+// Holds the vertices and indices of many small static meshes in one shared
+// VBO and IBO, so that rendering them one after the other doesn't rebind
+// buffers or respecify vertex attributes in between. All meshes in a pool
+// have the same vertex format.
+// Meshes are added by constructing them with a pointer to the pool. Once all
+// are created, call Finalize() to upload everything in one go.
+class MeshPool {
+ public:
+  MeshPool(int vertex_size, const Attribute *format);
+  ~MeshPool();
+
+  // Creates the VBO and IBO from all meshes added so far, and, if the driver
+  // supports them, a vertex array object capturing the attribute setup.
+  // Meshes can't be added afterwards.
+  void Finalize(const Renderer &renderer);
+
+  // Binds the buffers and sets up vertex attributes, unless this pool is
+  // already bound. Mesh::Render() calls this for pooled meshes.
+  void Bind();
+
+  // Undoes Bind() of whichever pool is currently bound, if any. Anything that
+  // touches buffer bindings or vertex attributes calls this first.
+  static void Unbind();
+
+  // Sets the instances drawn by Mesh::RenderInstanced() for meshes in this
+  // pool, until the next call. The data is copied.
+  void SetInstances(const MeshInstance *instances, int count);
+
+  int vertex_size() const { return vertex_size_; }
+  const Attribute *format() const { return format_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MeshPool);
+  friend class Mesh;
+
+  // Appends vertices, returning the index of the first one.
+  int AddVertices(const void *vertex_data, int count);
+  // Appends indices relative to 'base_vertex', returning their byte offset.
+  size_t AddIndices(const unsigned short *indices, int count, int base_vertex);
+
+  int vertex_size_;
+  const Attribute *format_;
+  // Kept after Finalize() when the driver has no instanced arrays, since
+  // Mesh::RenderInstanced() then expands instances from them.
+  std::vector<uint8_t> vertex_data_;
+  std::vector<unsigned short> index_data_;
+  int vertex_count_;
+  GLuint vbo_;
+  GLuint ibo_;
+  GLuint vao_;
+
+  std::vector<MeshInstance> instances_;
+  // Holds instances_ when using instanced arrays.
+  GLuint instance_vbo_;
+  // Scratch space for expanding instances on the CPU.
+  std::vector<uint8_t> expanded_vertices_;
+  std::vector<unsigned short> expanded_indices_;
+
+  static MeshPool *bound_pool_;
 };
 
 }  // namespace fpl
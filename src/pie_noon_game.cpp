@@ -92,6 +92,18 @@ static const char kAssetsDir[] = "assets";
 
 static const char kConfigFileName[] = "config.bin";
 
+// Archive holding most assets, built by "build_assets.py archive". Optional:
+// if it isn't there, assets are loaded from individual files.
+static const char kAssetArchiveFileName[] = "assets.pak";
+
+// Atlas holding the character, stick and pie textures. Optional: if it isn't
+// there, cardboard uses the individual textures.
+static const char kCardboardAtlasFileName[] = "atlases/cardboard.bin";
+
+// Shader all cardboard is drawn with, in a variant for each combination of
+// ShaderFeature flags in use.
+static const char kCardboardShader[] = "shaders/cardboard";
+
 #ifdef ANDROID_CARDBOARD
 static const char kCardboardConfigFileName[] = "cardboard_config.bin";
 #endif
@@ -124,19 +136,29 @@ static inline const UiGroup* TitleScreenButtons(const Config& config) {
 /// appreciate if you left it in.
 static const char kVersion[] = "Pie Noon 1.1.0";
 
+// Identify the directory SDL_GetPrefPath() gives us for data kept between
+// runs, such as the shader cache.
+static const char kPrefPathOrganization[] = "Google";
+static const char kPrefPathApplication[] = "PieNoon";
+
 PieNoonGame::PieNoonGame()
     : state_(kUninitialized),
       state_entry_time_(0),
       matman_(renderer_),
+      cardboard_mesh_pool_(sizeof(NormalMappedVertex), kQuadMeshFormat),
       cardboard_fronts_(RenderableId_Count, nullptr),
       cardboard_backs_(RenderableId_Count, nullptr),
       stick_front_(nullptr),
       stick_back_(nullptr),
+      cardboard_shaders_(),
       shader_lit_textured_normal_(nullptr),
       shader_simple_shadow_(nullptr),
       shader_textured_(nullptr),
       shader_grayscale_(nullptr),
+      cardboard_bounds_(RenderableId_Count, mathfu::kZeros4f),
       shadow_mat_(nullptr),
+      populated_scene_index_(0),
+      populated_scene_valid_(false),
       prev_world_time_(0),
       debug_previous_states_(),
       full_screen_fader_(&renderer_),
@@ -165,7 +187,7 @@ PieNoonGame::~PieNoonGame() {
 }
 
 bool PieNoonGame::InitializeConfig() {
-  if (!LoadFile(kConfigFileName, &config_source_)) {
+  if (!config_source_.Open(kConfigFileName)) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "can't load config.bin\n");
     return false;
   }
@@ -174,7 +196,7 @@ bool PieNoonGame::InitializeConfig() {
 
 #ifdef ANDROID_CARDBOARD
 bool PieNoonGame::InitializeCardboardConfig() {
-  if (!LoadFile(kCardboardConfigFileName, &cardboard_config_source_)) {
+  if (!cardboard_config_source_.Open(kCardboardConfigFileName)) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "can't load %s\n",
                  kCardboardConfigFileName);
     return false;
@@ -203,6 +225,14 @@ bool PieNoonGame::InitializeRenderer() {
     return false;
   }
 
+  // Keep linked shaders around, so later runs can skip compiling them.
+  char* pref_path =
+      SDL_GetPrefPath(kPrefPathOrganization, kPrefPathApplication);
+  if (pref_path) {
+    renderer_.set_shader_cache_directory(pref_path);
+    SDL_free(pref_path);
+  }
+
   renderer_.color() = mathfu::kOnes4f;
   // Initialize the first frame as black.
   renderer_.ClearFrameBuffer(mathfu::kZeros4f);
@@ -211,8 +241,11 @@ bool PieNoonGame::InitializeRenderer() {
 
 // Initializes 'vertices' at the specified position, aligned up-and-down.
 // 'vertices' must be an array of length kQuadNumVertices.
+// Texture coordinates are mapped into 'uv_rect' (left, top, right, bottom), the
+// part of the texture that holds the image when it is packed into an atlas.
 static void CreateVerticalQuad(const vec3& offset, const vec2& geo_size,
                                const vec2& texture_coord_size,
+                               const vec4& uv_rect,
                                NormalMappedVertex* vertices) {
   const float half_width = geo_size[0] * 0.5f;
   const vec3 bottom_left = offset + vec3(-half_width, 0.0f, 0.0f);
@@ -228,10 +261,14 @@ static void CreateVerticalQuad(const vec3& offset, const vec2& geo_size,
   const vec2 coord_top_right(0.5f + coord_half_width,
                              1.0f - texture_coord_size[1]);
 
-  vertices[0].tc = coord_bottom_left;
-  vertices[1].tc = vec2(coord_top_right[0], coord_bottom_left[1]);
-  vertices[2].tc = vec2(coord_bottom_left[0], coord_top_right[1]);
-  vertices[3].tc = coord_top_right;
+  const vec2 uv_origin(uv_rect.x(), uv_rect.y());
+  const vec2 uv_scale(uv_rect.z() - uv_rect.x(), uv_rect.w() - uv_rect.y());
+  vertices[0].tc = uv_origin + coord_bottom_left * uv_scale;
+  vertices[1].tc =
+      uv_origin + vec2(coord_top_right[0], coord_bottom_left[1]) * uv_scale;
+  vertices[2].tc =
+      uv_origin + vec2(coord_bottom_left[0], coord_top_right[1]) * uv_scale;
+  vertices[3].tc = uv_origin + coord_top_right * uv_scale;
 
   Mesh::ComputeNormalsTangents(vertices, &kQuadIndices[0], kQuadNumVertices,
                                kQuadNumIndices);
@@ -249,8 +286,11 @@ Mesh* PieNoonGame::CreateVerticalQuadMesh(
   if (material_name == nullptr || material_name->c_str()[0] == '\0')
     return nullptr;
 
-  // Load the material from file, and check validity.
-  Material* material = matman_.LoadMaterial(material_name->c_str());
+  // Load the material from file, and check validity. If its texture was packed
+  // into the cardboard atlas, 'uv_rect' tells us where.
+  vec4 uv_rect;
+  Material* material =
+      matman_.LoadAtlasedMaterial(material_name->c_str(), &uv_rect);
   bool material_valid = material != nullptr && material->textures().size() > 0;
   if (!material_valid) return nullptr;
 
@@ -265,11 +305,10 @@ Mesh* PieNoonGame::CreateVerticalQuadMesh(
 
   // Initialize a vertex array in the requested position.
   NormalMappedVertex vertices[kQuadNumVertices];
-  CreateVerticalQuad(offset, geo_size, texture_coord_size, vertices);
+  CreateVerticalQuad(offset, geo_size, texture_coord_size, uv_rect, vertices);
 
   // Create mesh and add in quad indices.
-  Mesh* mesh = new Mesh(vertices, kQuadNumVertices, sizeof(NormalMappedVertex),
-                        kQuadMeshFormat);
+  Mesh* mesh = new Mesh(&cardboard_mesh_pool_, vertices, kQuadNumVertices);
   mesh->AddIndices(kQuadIndices, kQuadNumIndices, material);
   return mesh;
 }
@@ -288,11 +327,14 @@ bool PieNoonGame::InitializeRenderingAssets() {
     return false;
   }
 
-  // Force these textures to be queued up first, since we want to use them for
+  // Force these textures to be loaded first, since we want to use them for
   // the loading screen.
-  matman_.LoadMaterial(config.loading_material()->c_str());
-  matman_.LoadMaterial(config.loading_logo()->c_str());
-  matman_.LoadMaterial(config.fade_material()->c_str());
+  matman_.LoadMaterial(config.loading_material()->c_str(), kLoadPriorityHigh);
+  matman_.LoadMaterial(config.loading_logo()->c_str(), kLoadPriorityHigh);
+  matman_.LoadMaterial(config.fade_material()->c_str(), kLoadPriorityHigh);
+
+  // Cardboard meshes pick their textures from the atlas, when available.
+  matman_.LoadAtlas(kCardboardAtlasFileName);
 
   // Create a mesh for the front and back of each cardboard cutout.
   const vec3 front_z_offset(0.0f, 0.0f, config.cardboard_front_z_offset());
@@ -318,6 +360,32 @@ bool PieNoonGame::InitializeRenderingAssets() {
     cardboard_backs_[id] =
         CreateVerticalQuadMesh(renderable->cardboard_back(), back_offset,
                                pixel_bounds, pixel_to_world_scale);
+
+    // Bound the quads, and the stick that props them up, with a sphere.
+    const vec2 geo_size = pixel_bounds * vec2(pixel_to_world_scale);
+    vec3 bounds_min = offset + vec3(-0.5f * geo_size.x(), 0.0f,
+                                    std::min(config.cardboard_front_z_offset(),
+                                             config.cardboard_back_z_offset()));
+    vec3 bounds_max = offset + vec3(0.5f * geo_size.x(), geo_size.y(),
+                                    std::max(config.cardboard_front_z_offset(),
+                                             config.cardboard_back_z_offset()));
+    if (renderable->stick()) {
+      const vec2 stick_size =
+          LoadVec2(config.stick_bounds()) * vec2(config.pixel_to_world_scale());
+      const vec3 stick_min(-0.5f * stick_size.x(), config.stick_y_offset(),
+                           std::min(config.stick_front_z_offset(),
+                                    config.stick_back_z_offset()));
+      const vec3 stick_max(0.5f * stick_size.x(),
+                           config.stick_y_offset() + stick_size.y(),
+                           std::max(config.stick_front_z_offset(),
+                                    config.stick_back_z_offset()));
+      for (int i = 0; i < 3; ++i) {
+        bounds_min[i] = std::min(bounds_min[i], stick_min[i]);
+        bounds_max[i] = std::max(bounds_max[i], stick_max[i]);
+      }
+    }
+    cardboard_bounds_[id] = vec4((bounds_min + bounds_max) * 0.5f,
+                                 (bounds_max - bounds_min).Length() * 0.5f);
   }
 
   // We default to the invalid texture, so it has to exist.
@@ -325,6 +393,11 @@ bool PieNoonGame::InitializeRenderingAssets() {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't load backup texture.\n");
     return false;
   }
+  for (int id = 0; id < RenderableId_Count; ++id) {
+    if (!cardboard_fronts_[id]) {
+      cardboard_bounds_[id] = cardboard_bounds_[RenderableId_Invalid];
+    }
+  }
 
   // Create stick front and back meshes.
   const vec3 stick_front_offset(0.0f, config.stick_y_offset(),
@@ -338,16 +411,52 @@ bool PieNoonGame::InitializeRenderingAssets() {
                                        LoadVec2(config.stick_bounds()),
                                        config.pixel_to_world_scale());
 
-  // Load all shaders we use:
+  // All cardboard meshes have been created, so upload them in one go.
+  cardboard_mesh_pool_.Finalize(renderer_);
+
+  // The cardboard shader is specialized on the features each cardboard
+  // material needs, and on whether it's drawn instanced. Lone instances are
+  // drawn without instancing if instanced arrays aren't supported, see
+  // RenderCardboard().
+  std::vector<Mesh*> cardboard_meshes(cardboard_fronts_);
+  cardboard_meshes.insert(cardboard_meshes.end(), cardboard_backs_.begin(),
+                          cardboard_backs_.end());
+  cardboard_meshes.push_back(stick_front_);
+  cardboard_meshes.push_back(stick_back_);
+  bool cardboard_variants[kShaderFeatureCombinations] = {false};
+  for (auto it = cardboard_meshes.begin(); it != cardboard_meshes.end(); ++it) {
+    if (!*it) continue;
+    const int features = (*it)->GetMaterial(0)->shader_features();
+    cardboard_variants[features | kShaderFeatureInstanced] = true;
+    if (!renderer_.supports_instanced_arrays()) {
+      cardboard_variants[features] = true;
+    }
+  }
+
+  // Load all shaders we use. Compiling them all is started up front, so that
+  // drivers that compile in the background can work on them in parallel.
+  static const char* kShaderNames[] = {
+      "shaders/lit_textured_normal", "shaders/simple_shadow",
+      "shaders/textured", "shaders/grayscale"};
+  for (size_t i = 0; i < PIE_ARRAYSIZE(kShaderNames); ++i) {
+    matman_.StartLoadingShader(kShaderNames[i]);
+  }
+  for (int i = 0; i < kShaderFeatureCombinations; ++i) {
+    if (cardboard_variants[i]) matman_.StartLoadingShader(kCardboardShader, i);
+  }
   shader_lit_textured_normal_ =
       matman_.LoadShader("shaders/lit_textured_normal");
-  shader_cardboard = matman_.LoadShader("shaders/cardboard");
   shader_simple_shadow_ = matman_.LoadShader("shaders/simple_shadow");
   shader_textured_ = matman_.LoadShader("shaders/textured");
   shader_grayscale_ = matman_.LoadShader("shaders/grayscale");
-  if (!(shader_lit_textured_normal_ && shader_cardboard &&
-        shader_simple_shadow_ && shader_textured_ && shader_grayscale_))
+  if (!(shader_lit_textured_normal_ && shader_simple_shadow_ &&
+        shader_textured_ && shader_grayscale_))
     return false;
+  for (int i = 0; i < kShaderFeatureCombinations; ++i) {
+    if (!cardboard_variants[i]) continue;
+    cardboard_shaders_[i] = matman_.LoadShader(kCardboardShader, i);
+    if (!cardboard_shaders_[i]) return false;
+  }
 
   // Load shadow material:
   shadow_mat_ = matman_.LoadMaterial("materials/floor_shadows.bin");
@@ -357,28 +466,44 @@ bool PieNoonGame::InitializeRenderingAssets() {
   gui_menu_.LoadAssets(TitleScreenButtons(config), &matman_);
   gui_menu_.LoadAssets(config.touchscreen_zones(), &matman_);
   gui_menu_.LoadAssets(config.pause_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.multiplayer_host(), &matman_);
-  gui_menu_.LoadAssets(config.multiplayer_client(), &matman_);
-  gui_menu_.LoadAssets(config.join_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.extras_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_pleasewait_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_waitingforplayers_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_waitingforgame_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_searching_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_connecting_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_cant_host_game_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_connection_lost_screen_buttons(), &matman_);
-  gui_menu_.LoadAssets(config.msx_host_disconnected_screen_buttons(), &matman_);
+  // Menus not shown at startup only load their textures once entered.
+  gui_menu_.LoadAssets(config.multiplayer_host(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.multiplayer_client(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.join_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.extras_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_pleasewait_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_waitingforplayers_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_waitingforgame_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_searching_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_connecting_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_cant_host_game_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_connection_lost_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
+  gui_menu_.LoadAssets(config.msx_host_disconnected_screen_buttons(), &matman_,
+                       kLoadPriorityOnDemand);
   gui_menu_.LoadAssets(config.msx_all_players_disconnected_screen_buttons(),
-                       &matman_);
+                       &matman_, kLoadPriorityOnDemand);
   // Configure the full screen fader.
   full_screen_fader_.set_material(
       matman_.FindMaterial(config.fade_material()->c_str()));
   full_screen_fader_.set_shader(shader_textured_);
 
-  // Start the thread that actually loads all assets we requested above.
-  matman_.StartLoadingTextures();
+  // Start the threads that actually load all assets we requested above.
+  matman_.set_texture_memory_budget(
+      static_cast<size_t>(config.texture_memory_budget()) * 1024);
+  matman_.StartLoadingTextures(config.texture_loader_threads());
 
   return true;
 }
@@ -398,8 +523,8 @@ bool PieNoonGame::InitializeGameState() {
   motive::SmoothInit::Register();
   motive::MatrixInit::Register();
 
-  // Load flatbuffer into buffer.
-  if (!LoadFile("character_state_machine_def.bin", &state_machine_source_)) {
+  // Map flatbuffer into memory.
+  if (!state_machine_source_.Open("character_state_machine_def.bin")) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR,
                  "Error loading character state machine.\n");
     return false;
@@ -497,6 +622,11 @@ bool PieNoonGame::Initialize(const char* const binary_directory) {
 
   if (!ChangeToUpstreamDir(binary_directory, kAssetsDir)) return false;
 
+  if (AssetFile::Exists(kAssetArchiveFileName) &&
+      asset_archive_.Open(kAssetArchiveFileName)) {
+    AssetFile::set_archive(&asset_archive_);
+  }
+
   if (!InitializeConfig()) return false;
 #ifdef ANDROID_CARDBOARD
   if (!InitializeCardboardConfig()) return false;
@@ -523,6 +653,11 @@ bool PieNoonGame::Initialize(const char* const binary_directory) {
 
   if (!InitializeGameState()) return false;
 
+  // Not fatal if this fails: the simulation then runs on the main thread.
+  if (GetConfig().pipeline_simulation()) {
+    simulation_thread_.Start("FPL Simulation Thread");
+  }
+
 #ifdef PIE_NOON_USES_GOOGLE_PLAY_GAMES
   if (!gpg_manager.Initialize(ReadPreference("logged_in", 1, 1) != 0))
     return false;
@@ -570,64 +705,135 @@ void PieNoonGame::RenderCardboard(const SceneDescription& scene,
                                   const mat4& camera_transform) {
   const Config& config = GetConfig();
 
+  // Test the bounds of all renderables against the view frustum in one batch.
+  // Shadows are rendered separately, since those of renderables out of view
+  // may still be visible.
+  cardboard_culler_.Begin(camera_transform);
   for (size_t i = 0; i < scene.renderables().size(); ++i) {
+    const auto& renderable = scene.renderables()[i];
+    const mat4& world = renderable->world_matrix();
+    const vec4& bounds = cardboard_bounds_[renderable->id()];
+    // Scale the radius by the largest axis scale of the world transform.
+    const float scale = std::max(
+        vec3(world(0, 0), world(1, 0), world(2, 0)).LengthSquared(),
+        std::max(vec3(world(0, 1), world(1, 1), world(2, 1)).LengthSquared(),
+                 vec3(world(0, 2), world(1, 2), world(2, 2)).LengthSquared()));
+    cardboard_culler_.AddSphere(world * bounds.xyz(),
+                                bounds.w() * sqrt(scale));
+  }
+  cardboard_culler_.Cull();
+
+  // Batch up visible renderables of the same id that follow each other in the
+  // scene, so that each batch can be drawn with one call per mesh. Cardboard
+  // is alpha blended and the scene is sorted back-to-front, so only adjacent
+  // ones can be batched without drawing something in front of what's behind
+  // it.
+  cardboard_instances_.clear();
+  cardboard_batches_.clear();
+  for (size_t i = 0; i < scene.renderables().size(); ++i) {
+    if (!cardboard_culler_.visible(static_cast<int>(i))) continue;
     const auto& renderable = scene.renderables()[i];
     const int id = renderable->id();
+    if (cardboard_batches_.empty() || cardboard_batches_.back().id != id) {
+      CardboardBatch batch;
+      batch.id = id;
+      batch.first_renderable = static_cast<int>(i);
+      batch.first_instance = static_cast<int>(cardboard_instances_.size());
+      batch.num_instances = 0;
+      cardboard_batches_.push_back(batch);
+    }
+    cardboard_batches_.back().num_instances++;
+    cardboard_instances_.push_back(
+        MeshInstance(renderable->world_matrix(), renderable->color()));
+  }
 
-    // Set up vertex transformation into projection space.
-    const mat4 mvp = camera_transform * renderable->world_matrix();
-    renderer_.model_view_projection() = mvp;
-
-    // Set the camera and light positions in object space.
-    const mat4 world_matrix_inverse = renderable->world_matrix().Inverse();
-    renderer_.camera_pos() =
-        world_matrix_inverse * game_state_.camera().Position();
-
-    // TODO: check amount of lights.
-    renderer_.light_pos() = world_matrix_inverse * (*scene.lights()[0]);
+  // All cardboard shaders do lighting in world space, so no renderable needs
+  // the inverse of its transform.
+  renderer_.camera_pos() = scene.camera_position();
+  // TODO: check amount of lights.
+  renderer_.light_pos() = *scene.lights()[0];
 
-    // The popsicle stick and cardboard back are always uncolored.
-    renderer_.color() = mathfu::kOnes4f;
+  for (auto it = cardboard_batches_.begin(); it != cardboard_batches_.end();
+       ++it) {
+    const int id = it->id;
+
+    // Without instanced arrays, instances get expanded on the CPU. That isn't
+    // worth it for a lone instance, which is drawn with the regular shaders
+    // instead, with its transform in the model uniform.
+    const bool instanced =
+        it->num_instances > 1 || renderer_.supports_instanced_arrays();
+    if (instanced) {
+      // The instanced shaders transform into world space themselves.
+      renderer_.model_view_projection() = camera_transform;
+      cardboard_mesh_pool_.SetInstances(
+          &cardboard_instances_[it->first_instance], it->num_instances);
+    } else {
+      const auto& renderable = scene.renderables()[it->first_renderable];
+      renderer_.model() = renderable->world_matrix();
+      renderer_.model_view_projection() =
+          camera_transform * renderable->world_matrix();
+    }
 
     // Note: Draw order is back-to-front, so draw the cardboard back, then
     // popsicle stick, then cardboard front--in that order.
     //
     // If we have a back, draw the back too, slightly offset.
     // The back is the *inside* of the cardboard, representing corrugation.
+    // The popsicle stick and cardboard back are always uncolored.
+    renderer_.color() = mathfu::kOnes4f;
     if (cardboard_backs_[id]) {
-      shader_cardboard->Set(renderer_);
-      cardboard_backs_[id]->Render(renderer_);
+      SetCardboardShader(cardboard_backs_[id], instanced);
+      if (instanced) {
+        cardboard_backs_[id]->RenderInstanced(renderer_, false);
+      } else {
+        cardboard_backs_[id]->Render(renderer_);
+      }
     }
 
     // Draw the popsicle stick that props up the cardboard.
     if (config.renderables()->Get(id)->stick() && stick_front_ != nullptr &&
         stick_back_ != nullptr) {
-      shader_textured_->Set(renderer_);
-      stick_front_->Render(renderer_);
-      stick_back_->Render(renderer_);
+      SetCardboardShader(stick_front_, instanced);
+      if (instanced) {
+        stick_front_->RenderInstanced(renderer_, false);
+        stick_back_->RenderInstanced(renderer_, false);
+      } else {
+        stick_front_->Render(renderer_);
+        stick_back_->Render(renderer_);
+      }
     }
 
-    renderer_.color() = renderable->color();
-
-    if (config.renderables()->Get(id)->cardboard()) {
-      shader_cardboard->Set(renderer_);
-      shader_cardboard->SetUniform(
-          "ambient_material", LoadVec3(config.cardboard_ambient_material()));
-      shader_cardboard->SetUniform(
-          "diffuse_material", LoadVec3(config.cardboard_diffuse_material()));
-      shader_cardboard->SetUniform(
-          "specular_material", LoadVec3(config.cardboard_specular_material()));
-      shader_cardboard->SetUniform("shininess", config.cardboard_shininess());
-      shader_cardboard->SetUniform("normalmap_scale",
-                                   config.cardboard_normalmap_scale());
-    } else {
-      shader_textured_->Set(renderer_);
+    if (!instanced) {
+      renderer_.color() = scene.renderables()[it->first_renderable]->color();
     }
     Mesh* front = GetCardboardFront(id);
-    front->Render(renderer_);
+    SetCardboardShader(front, instanced);
+    if (instanced) {
+      front->RenderInstanced(renderer_, true);
+    } else {
+      front->Render(renderer_);
+    }
   }
 }
 
+void PieNoonGame::SetCardboardShader(Mesh* mesh, bool instanced) {
+  const Config& config = GetConfig();
+  const int features = mesh->GetMaterial(0)->shader_features() |
+                       (instanced ? kShaderFeatureInstanced : 0);
+  Shader* shader = cardboard_shaders_[features];
+  assert(shader);
+  shader->Set(renderer_);
+  if (!(features & kShaderFeatureLighting)) return;
+  shader->SetUniform("ambient_material",
+                     LoadVec3(config.cardboard_ambient_material()));
+  shader->SetUniform("diffuse_material",
+                     LoadVec3(config.cardboard_diffuse_material()));
+  shader->SetUniform("specular_material",
+                     LoadVec3(config.cardboard_specular_material()));
+  shader->SetUniform("shininess", config.cardboard_shininess());
+  shader->SetUniform("normalmap_scale", config.cardboard_normalmap_scale());
+}
+
 void PieNoonGame::Render(const SceneDescription& scene) {
 #ifdef ANDROID_CARDBOARD
   if (game_state_.is_in_cardboard()) {
@@ -833,19 +1039,25 @@ void PieNoonGame::DebugPrintPieStates() {
   }
 }
 
+// Debug function to print out how many renderables were culled.
+void PieNoonGame::DebugPrintCullingStats() {
+  SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Renderables drawn %d, culled %d\n",
+              cardboard_culler_.num_visible(), cardboard_culler_.num_culled());
+}
+
 const Config& PieNoonGame::GetConfig() const {
-  return *fpl::pie_noon::GetConfig(config_source_.c_str());
+  return *fpl::pie_noon::GetConfig(config_source_.data());
 }
 
 #ifdef ANDROID_CARDBOARD
 const Config& PieNoonGame::GetCardboardConfig() const {
-  return *fpl::pie_noon::GetConfig(cardboard_config_source_.c_str());
+  return *fpl::pie_noon::GetConfig(cardboard_config_source_.data());
 }
 #endif
 
 const CharacterStateMachineDef* PieNoonGame::GetStateMachine() const {
   return fpl::pie_noon::GetCharacterStateMachineDef(
-      state_machine_source_.c_str());
+      state_machine_source_.data());
 }
 
 struct ButtonToTranslation {
@@ -971,10 +1183,11 @@ PieNoonState PieNoonGame::UpdatePieNoonState() {
       break;
     }
     case kLoading: {
-      // When we initialized assets, we kicked off a thread to load all
+      // When we initialized assets, we kicked off threads to load all
       // textures. Here we check if those have finished loading.
       // We also leave the loading screen up for a minimum amount of time.
-      if (!Fading() && matman_.TryFinalize()
+      if (!Fading() &&
+          matman_.TexturesLoaded()
 #if !IMGUI_TEST
           && (time - state_entry_time_) > config.min_loading_time()
 #endif  // IMGUI_TEST
@@ -1175,6 +1388,9 @@ void PieNoonGame::TransitionToPieNoonState(PieNoonState next_state) {
   assert(state_ != next_state);  // Must actually transition.
   const Config& config = GetConfig();
 
+  // The game state may be reset below, so don't render the last scene again.
+  populated_scene_valid_ = false;
+
   switch (next_state) {
     case kLoadingInitialMaterials: {
       break;
@@ -2320,6 +2536,10 @@ void PieNoonGame::Run() {
     renderer_.AdvanceFrame(input_.minimized_);
     renderer_.ClearFrameBuffer(mathfu::kZeros4f);
 
+    // Upload textures loaded in the background, and evict those that went
+    // unused for a while if we're over budget.
+    matman_.UpdateResidency(config.texture_finalize_budget());
+
     // Process input device messages since the last game loop.
     // Update render window size.
     input_.AdvanceFrame(&renderer_.window_size());
@@ -2525,15 +2745,41 @@ void PieNoonGame::Run() {
         }
 #endif
 
-        if (state_ != kPaused && state_ != kMultiscreenClient) {
-          // Update game logic by a variable number of milliseconds.
-          game_state_.AdvanceFrame(delta_time, &audio_engine_);
-        } else {
-          // We are the client, we only update a few small things.
-          game_state_.particle_manager().AdvanceFrame(
-              static_cast<TimeStep>(delta_time));
-          game_state_.engine().AdvanceFrame(delta_time);
-        }
+        // Update game logic by a variable number of milliseconds, then
+        // populate the next 'scene' from the game state--all the positions,
+        // orientations, and renderable-ids (which specify materials) of the
+        // characters and props. Also specify the camera matrix.
+        // The simulation thread does this while the scene populated last
+        // frame is rendered here.
+        const bool simulate =
+            state_ != kPaused && state_ != kMultiscreenClient;
+        const bool render_scene = state_ != kMultiscreenClient;
+        const int next_scene_index = 1 - populated_scene_index_;
+        SceneDescription* next_scene = &scenes_[next_scene_index];
+        simulation_thread_.Run([this, simulate, render_scene, delta_time,
+                                next_scene]() {
+          if (simulate) {
+            game_state_.AdvanceFrame(delta_time, &audio_engine_);
+          } else {
+            // We are the client, we only update a few small things.
+            game_state_.particle_manager().AdvanceFrame(
+                static_cast<TimeStep>(delta_time));
+            game_state_.engine().AdvanceFrame(delta_time);
+          }
+          if (render_scene) game_state_.PopulateScene(next_scene);
+        });
+
+        // Issue draw calls for the 'scene'.
+        // Without a previous scene (or a simulation thread) there is nothing
+        // to overlap with, so render the new scene once it's ready.
+        const bool overlap = render_scene && simulation_thread_.running() &&
+                             populated_scene_valid_;
+        if (overlap) Render(scenes_[populated_scene_index_]);
+        simulation_thread_.Wait();
+        if (render_scene && !overlap) Render(*next_scene);
+        if (!render_scene) Render2DElements();
+        populated_scene_index_ = next_scene_index;
+        populated_scene_valid_ = render_scene;
 
         if (state_ == kPlaying && !stinger_channel_.Valid() &&
             game_state_.IsGameOver()) {
@@ -2544,19 +2790,6 @@ void PieNoonGame::Run() {
         // Update audio engine state.
         audio_engine_.AdvanceFrame(world_time);
 
-        // Issue draw calls for the 'scene'.
-        if (state_ != kMultiscreenClient) {
-          // Populate 'scene' from the game state--all the positions,
-          // orientations, and renderable-ids (which specify materials) of the
-          // characters and props. Also specify the camera matrix.
-          game_state_.PopulateScene(&scene_);
-
-          // Issue draw calls for the 'scene'.
-          Render(scene_);
-        } else {
-          Render2DElements();
-        }
-
 // TEMP: testing GUI on top of everything else.
 #if IMGUI_TEST
         // Open OpenType font
@@ -2564,6 +2797,8 @@ void PieNoonGame::Run() {
         if (!fontman.FontLoaded()) {
           fontman.Open("fonts/NotoSansCJKjp-Bold.otf");
           fontman.SetRenderer(renderer_);
+          fontman.SetDistanceField(true);
+          fontman.SetAsync(true);
         }
         gui::TestGUI(matman_, fontman, input_);
 #endif  // IMGUI_TEST
@@ -2575,6 +2810,9 @@ void PieNoonGame::Run() {
         if (config.print_pie_states()) {
           DebugPrintPieStates();
         }
+        if (config.print_culling_stats()) {
+          DebugPrintCullingStats();
+        }
         if (config.allow_camera_movement()) {
           DebugCamera();
         }
@@ -2638,20 +2876,30 @@ void PieNoonGame::Run() {
         Mesh::RenderAAQuadAlongX(vec3(-extend.x(), extend.y(), 0),
                                  vec3(extend.x(), -extend.y(), 0), vec2(0, 1),
                                  vec2(1, 0));
+
+        // Show how many of the textures are ready, filling up from the left.
+        extend = LoadVec2(config.loading_progress_bar_size()) * vec2(res) / 2;
+        const float progress_x =
+            extend.x() * (2.0f * matman_.LoadingProgress() - 1.0f);
+        renderer_.model_view_projection() =
+            ortho_mat * mat4::FromTranslationVector(
+                            vec3(static_cast<float>(mid.x()),
+                                 static_cast<float>(res.y()) * 0.85f, 0.0f));
+        renderer_.color() = mathfu::kOnes4f;
+        full_screen_fader_.material()->Set(renderer_);
+        shader_textured_->Set(renderer_);
+        Mesh::RenderAAQuadAlongX(vec3(-extend.x(), extend.y(), 0),
+                                 vec3(progress_x, -extend.y(), 0), vec2(0, 1),
+                                 vec2(1, 0));
       }  // Fallthrough
 
       case kLoadingInitialMaterials:
-        // Finalize the materials that have been loaded thus far.
-        matman_.TryFinalize();
-
         if (UpdatePieNoonStateAndTransition() == kFinished) {
           game_state_.Reset(GameState::kNoAnalytics);
         }
         break;
 
       case kTutorial: {
-        matman_.TryFinalize();
-
         const bool should_transition =
             full_screen_fader_.Finished(world_time) && AnyControllerPresses();
         if (should_transition) {
@@ -20,7 +20,10 @@
 #endif
 
 #include "ai_controller.h"
+#include "asset_archive.h"
+#include "asset_file.h"
 #include "cardboard_controller.h"
+#include "frustum.h"
 #include "full_screen_fader.h"
 #include "game_state.h"
 #include "gui_menu.h"
@@ -34,6 +37,7 @@
 #include "scene_description.h"
 #include "touchscreen_button.h"
 #include "touchscreen_controller.h"
+#include "worker_thread.h"
 
 #ifdef ANDROID_GAMEPAD
 #include "gamepad_controller.h"
@@ -83,6 +87,8 @@ class PieNoonGame {
   bool InitializeGameState();
   void RenderCardboard(const SceneDescription& scene,
                        const mat4& camera_transform);
+  // Sets the variant of the cardboard shader that 'mesh's material needs.
+  void SetCardboardShader(Mesh* mesh, bool instanced);
   void Render(const SceneDescription& scene);
   void RenderForDefault(const SceneDescription& scene);
   void RenderForCardboard(const SceneDescription& scene);
@@ -95,6 +101,7 @@ class PieNoonGame {
   void CorrectCardboardCamera(mat4& cardboard_camera);
   void DebugPrintCharacterStates();
   void DebugPrintPieStates();
+  void DebugPrintCullingStats();
   void DebugCamera();
   const Config& GetConfig() const;
 #ifdef ANDROID_CARDBOARD
@@ -156,6 +163,10 @@ class PieNoonGame {
   void UpdateMultiscreenMenuIcons();
   void SetupWaitingForPlayersMenu();
 
+  // Assets loaded from the archive point into it, so it's declared first to be
+  // destroyed last.
+  AssetArchive asset_archive_;
+
   // The overall operating mode of our game. See CalculatePieNoonState for the
   // state machine definition.
   PieNoonState state_;
@@ -165,9 +176,9 @@ class PieNoonGame {
   WorldTime state_entry_time_;
 
   // Hold configuration binary data.
-  std::string config_source_;
+  AssetFile config_source_;
 #ifdef ANDROID_CARDBOARD
-  std::string cardboard_config_source_;
+  AssetFile cardboard_config_source_;
 #endif
 
   // Report touches, button presses, keyboard presses.
@@ -182,6 +193,9 @@ class PieNoonGame {
   // Manage ownership and playing of audio assets.
   pindrop::AudioEngine audio_engine_;
 
+  // Shared vertex and index buffers for all the cardboard meshes below.
+  MeshPool cardboard_mesh_pool_;
+
   // Map RenderableId to rendering mesh.
   std::vector<Mesh*> cardboard_fronts_;
   std::vector<Mesh*> cardboard_backs_;
@@ -191,17 +205,42 @@ class PieNoonGame {
   Mesh* stick_back_;
 
   // Shaders we use.
-  Shader* shader_cardboard;
+  // Variants of the cardboard shader, indexed by ShaderFeature flags. Only
+  // those cardboard materials need are loaded.
+  Shader* cardboard_shaders_[kShaderFeatureCombinations];
   Shader* shader_lit_textured_normal_;
   Shader* shader_simple_shadow_;
   Shader* shader_textured_;
   Shader* shader_grayscale_;
 
+  // Per RenderableId, an object space bounding sphere (xyz center, w radius)
+  // around the cardboard front, back and stick.
+  std::vector<vec4> cardboard_bounds_;
+
+  // Skips renderables that are outside of the view.
+  FrustumCuller cardboard_culler_;
+
+  // Renderables with the same RenderableId that are next to each other in
+  // the scene, drawn with one call per mesh.
+  struct CardboardBatch {
+    int id;
+    // Index in the scene of the first renderable in the batch.
+    int first_renderable;
+    // Range of the batch in cardboard_instances_.
+    int first_instance;
+    int num_instances;
+  };
+
+  // The instances to draw this frame, and the batches they're drawn in. Kept
+  // around to avoid reallocating every frame.
+  std::vector<MeshInstance> cardboard_instances_;
+  std::vector<CardboardBatch> cardboard_batches_;
+
   // Shadow material.
   Material* shadow_mat_;
 
   // Hold state machine binary data.
-  std::string state_machine_source_;
+  AssetFile state_machine_source_;
 
   // Hold characters, pies, camera state.
   GameState game_state_;
@@ -227,7 +266,20 @@ class PieNoonGame {
 
   // Description of the scene to be rendered. Isolates gameplay and rendering
   // code with a type-light structure. Recreated every frame.
-  SceneDescription scene_;
+  // Double buffered, so that the simulation can populate one while the other
+  // is being rendered.
+  SceneDescription scenes_[2];
+
+  // Index into scenes_ of the scene that was populated last.
+  int populated_scene_index_;
+
+  // True if scenes_[populated_scene_index_] holds a scene that can be
+  // rendered while the next one is populated.
+  bool populated_scene_valid_;
+
+  // Runs the simulation of the next frame while the current one renders.
+  // Jobs never outlive the frame that started them.
+  WorkerThread simulation_thread_;
 
   // World time of previous update. We use this to calculate the delta_time
   // of the current update. This value is tied to the real-world clock.
@@ -0,0 +1,132 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "pixel_conversion.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FPL_PIXEL_CONVERSION_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define FPL_PIXEL_CONVERSION_NEON
+#include <arm_neon.h>
+#endif
+
+// All loops below read a block of pixels before writing its (smaller)
+// converted form, and never write past what has been read. That's what makes
+// converting in place work.
+
+namespace fpl {
+
+void Convert8888To5551(const uint8_t *in, int count, uint16_t *out) {
+  int i = 0;
+#if defined(FPL_PIXEL_CONVERSION_SSE2)
+  // 8 pixels at a time, computed as 32 bit lanes of r | g << 8 | b << 16 |
+  // a << 24.
+  const __m128i mask_r = _mm_set1_epi32(0xF8);
+  const __m128i mask_g = _mm_set1_epi32(0xF800);
+  const __m128i mask_b = _mm_set1_epi32(0xF80000);
+  for (; i + 8 <= count; i += 8) {
+    __m128i p[2];
+    p[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 4));
+    p[1] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 4 + 16));
+    for (int j = 0; j < 2; j++) {
+      const __m128i c = p[j];
+      __m128i v = _mm_slli_epi32(_mm_and_si128(c, mask_r), 8);
+      v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(c, mask_g), 5));
+      v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(c, mask_b), 18));
+      v = _mm_or_si128(v, _mm_srli_epi32(c, 31));
+      // Sign extend the low 16 bits, so the saturating pack below keeps them
+      // as they are.
+      p[j] = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_packs_epi32(p[0], p[1]));
+  }
+#elif defined(FPL_PIXEL_CONVERSION_NEON)
+  // 16 pixels at a time, deinterleaved into one register per channel.
+  const uint8x16_t mask = vdupq_n_u8(0xF8);
+  for (; i + 16 <= count; i += 16) {
+    const uint8x16x4_t c = vld4q_u8(in + i * 4);
+    const uint8x16_t r = vandq_u8(c.val[0], mask);
+    const uint8x16_t g = vandq_u8(c.val[1], mask);
+    const uint8x16_t b = vshrq_n_u8(vandq_u8(c.val[2], mask), 2);
+    const uint8x16_t a = vshrq_n_u8(c.val[3], 7);
+    const uint16x8_t lo = vorrq_u16(
+        vorrq_u16(vshll_n_u8(vget_low_u8(r), 8), vshll_n_u8(vget_low_u8(g), 3)),
+        vmovl_u8(vorr_u8(vget_low_u8(b), vget_low_u8(a))));
+    const uint16x8_t hi = vorrq_u16(
+        vorrq_u16(vshll_n_u8(vget_high_u8(r), 8),
+                  vshll_n_u8(vget_high_u8(g), 3)),
+        vmovl_u8(vorr_u8(vget_high_u8(b), vget_high_u8(a))));
+    vst1q_u16(out + i, lo);
+    vst1q_u16(out + i + 8, hi);
+  }
+#endif
+  for (; i < count; i++) {
+    auto c = &in[i * 4];
+    out[i] = ((c[0] >> 3) << 11) | ((c[1] >> 3) << 6) | ((c[2] >> 3) << 1) |
+             ((c[3] >> 7) << 0);
+  }
+}
+
+void Convert888To565(const uint8_t *in, int count, uint16_t *out) {
+  int i = 0;
+#if defined(FPL_PIXEL_CONVERSION_SSE2)
+  // 4 pixels at a time. SSE2 can't shuffle bytes, so each pixel is read as an
+  // unaligned 32 bit word, which includes one byte of the next pixel. Stop
+  // early enough for that byte to still be within the image.
+  const __m128i mask_r = _mm_set1_epi32(0xF8);
+  const __m128i mask_g = _mm_set1_epi32(0xFC00);
+  const __m128i mask_b = _mm_set1_epi32(0xF80000);
+  for (; i + 4 < count; i += 4) {
+    int32_t words[4];
+    memcpy(words, in + i * 3, sizeof(words[0]));
+    memcpy(words + 1, in + i * 3 + 3, sizeof(words[0]));
+    memcpy(words + 2, in + i * 3 + 6, sizeof(words[0]));
+    memcpy(words + 3, in + i * 3 + 9, sizeof(words[0]));
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words));
+    __m128i v = _mm_slli_epi32(_mm_and_si128(c, mask_r), 8);
+    v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(c, mask_g), 5));
+    v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(c, mask_b), 19));
+    v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i),
+                     _mm_packs_epi32(v, v));
+  }
+#elif defined(FPL_PIXEL_CONVERSION_NEON)
+  // 16 pixels at a time, deinterleaved into one register per channel.
+  for (; i + 16 <= count; i += 16) {
+    const uint8x16x3_t c = vld3q_u8(in + i * 3);
+    const uint8x16_t r = vandq_u8(c.val[0], vdupq_n_u8(0xF8));
+    const uint8x16_t g = vandq_u8(c.val[1], vdupq_n_u8(0xFC));
+    const uint8x16_t b = vshrq_n_u8(c.val[2], 3);
+    const uint16x8_t lo = vorrq_u16(
+        vorrq_u16(vshll_n_u8(vget_low_u8(r), 8), vshll_n_u8(vget_low_u8(g), 3)),
+        vmovl_u8(vget_low_u8(b)));
+    const uint16x8_t hi = vorrq_u16(
+        vorrq_u16(vshll_n_u8(vget_high_u8(r), 8),
+                  vshll_n_u8(vget_high_u8(g), 3)),
+        vmovl_u8(vget_high_u8(b)));
+    vst1q_u16(out + i, lo);
+    vst1q_u16(out + i + 8, hi);
+  }
+#endif
+  for (; i < count; i++) {
+    auto c = &in[i * 3];
+    out[i] = ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | ((c[2] >> 3) << 0);
+  }
+}
+
+}  // namespace fpl
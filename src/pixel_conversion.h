@@ -0,0 +1,32 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_PIXEL_CONVERSION_H
+#define FPL_PIXEL_CONVERSION_H
+
+namespace fpl {
+
+// Convert 'count' RGBA8888 pixels in 'in' to RGBA5551 in 'out'.
+// 'out' may point to the same memory as 'in', to convert in place, since the
+// output is never larger than the input.
+// Safe to call from any thread.
+void Convert8888To5551(const uint8_t *in, int count, uint16_t *out);
+
+// Convert 'count' RGB888 pixels in 'in' to RGB565 in 'out'.
+// Like Convert8888To5551(), may convert in place.
+void Convert888To565(const uint8_t *in, int count, uint16_t *out);
+
+}  // namespace fpl
+
+#endif  // FPL_PIXEL_CONVERSION_H
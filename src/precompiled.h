@@ -17,9 +17,11 @@
 
 #include <assert.h>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <map>
 #include <math.h>
+#include <queue>
 #include <stdio.h>
 #include <string.h>
 #include <vector>
@@ -13,6 +13,9 @@
 // limitations under the License.
 
 #include "precompiled.h"
+#include "asset_file.h"
+#include "compressed_texture.h"
+#include "pixel_conversion.h"
 #include "renderer.h"
 #include "utilities.h"
 
@@ -20,6 +23,167 @@
 
 namespace fpl {
 
+// Parses the GL version string, which is "OpenGL ES major.minor ..." on
+// OpenGL ES and "major.minor ..." on desktop.
+static void GetGLVersion(int *major, int *minor, bool *es) {
+  *major = *minor = 0;
+  *es = false;
+  auto version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  if (!version) return;
+  static const char kESPrefix[] = "OpenGL ES ";
+  if (!strncmp(version, kESPrefix, sizeof(kESPrefix) - 1)) {
+    version += sizeof(kESPrefix) - 1;
+    *es = true;
+  }
+  sscanf(version, "%d.%d", major, minor);
+}
+
+// Looks up the GL function called 'name' followed by 'suffix', which
+// distinguishes the extension it comes from (e.g. "OES"), if any.
+// Returns false if the driver doesn't provide it.
+template <typename T>
+static bool LookupGLFunction(const char *name, const char *suffix,
+                             T *function) {
+  union {
+    void *data;
+    T function;
+  } data_function_union;
+  data_function_union.data =
+      SDL_GL_GetProcAddress((std::string(name) + suffix).c_str());
+  *function = data_function_union.function;
+  return data_function_union.data != nullptr;
+}
+
+static const uint64_t kHashOffsetBasis = 14695981039346656037ULL;
+
+// Folds 'str', including its terminator, into the 64-bit FNV-1a 'hash'.
+static uint64_t HashString(const char *str, uint64_t hash) {
+  if (!str) str = "";
+  do {
+    hash = (hash ^ static_cast<uint8_t>(*str)) * 1099511628211ULL;
+  } while (*str++);
+  return hash;
+}
+
+void Renderer::InitializeOptionalFeatures() {
+  int major, minor;
+  bool es;
+  GetGLVersion(&major, &minor, &es);
+
+  // Vertex array objects are core in OpenGL 3.0 and OpenGL ES 3.0.
+  const char *vao_suffix = nullptr;
+  if (major >= 3 || SDL_GL_ExtensionSupported("GL_ARB_vertex_array_object")) {
+    vao_suffix = "";
+  } else if (SDL_GL_ExtensionSupported("GL_OES_vertex_array_object")) {
+    vao_suffix = "OES";
+  } else if (SDL_GL_ExtensionSupported("GL_APPLE_vertex_array_object")) {
+    vao_suffix = "APPLE";
+  }
+  supports_vertex_array_objects_ =
+      vao_suffix &&
+      LookupGLFunction("glGenVertexArrays", vao_suffix,
+                       &glGenVertexArraysFPL) &&
+      LookupGLFunction("glBindVertexArray", vao_suffix,
+                       &glBindVertexArrayFPL) &&
+      LookupGLFunction("glDeleteVertexArrays", vao_suffix,
+                       &glDeleteVertexArraysFPL);
+
+  // Instanced arrays are core in OpenGL 3.3 and OpenGL ES 3.0.
+  const char *instancing_suffix = nullptr;
+  if (SDL_GL_ExtensionSupported("GL_ARB_instanced_arrays")) {
+    instancing_suffix = "ARB";
+  } else if (es ? major >= 3 : major > 3 || (major == 3 && minor >= 3)) {
+    instancing_suffix = "";
+  } else if (SDL_GL_ExtensionSupported("GL_EXT_instanced_arrays")) {
+    instancing_suffix = "EXT";
+  } else if (SDL_GL_ExtensionSupported("GL_ANGLE_instanced_arrays")) {
+    instancing_suffix = "ANGLE";
+  }
+  supports_instanced_arrays_ =
+      instancing_suffix &&
+      LookupGLFunction("glDrawElementsInstanced", instancing_suffix,
+                       &glDrawElementsInstancedFPL) &&
+      LookupGLFunction("glVertexAttribDivisor", instancing_suffix,
+                       &glVertexAttribDivisorFPL);
+
+  // Unpacking part of the rows of an image is core in desktop OpenGL and
+  // OpenGL ES 3.0.
+  supports_unpack_row_length_ =
+      !es || major >= 3 || SDL_GL_ExtensionSupported("GL_EXT_unpack_subimage");
+
+  // Compressed texture formats the driver can sample from. Some drivers
+  // support ETC1 without listing it.
+  GLint num_formats = 0;
+  GL_CALL(glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &num_formats));
+  std::vector<GLint> formats(num_formats);
+  if (num_formats > 0) {
+    GL_CALL(glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, &formats[0]));
+  }
+  compressed_formats_.assign(formats.begin(), formats.end());
+  if (SDL_GL_ExtensionSupported("GL_OES_compressed_ETC1_RGB8_texture")) {
+    compressed_formats_.push_back(kCompressedETC1RGB8);
+  }
+
+  // Program binaries are core in OpenGL 4.1 and OpenGL ES 3.0, but are only
+  // of use if the driver has a format to save them in.
+  const char *binary_suffix = nullptr;
+  if ((es ? major >= 3 : major > 4 || (major == 4 && minor >= 1)) ||
+      SDL_GL_ExtensionSupported("GL_ARB_get_program_binary")) {
+    binary_suffix = "";
+  } else if (SDL_GL_ExtensionSupported("GL_OES_get_program_binary")) {
+    binary_suffix = "OES";
+  }
+  GLint num_binary_formats = 0;
+  if (binary_suffix) {
+    GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_binary_formats));
+  }
+  supports_program_binaries_ =
+      num_binary_formats > 0 &&
+      LookupGLFunction("glGetProgramBinary", binary_suffix,
+                       &glGetProgramBinaryFPL) &&
+      LookupGLFunction("glProgramBinary", binary_suffix, &glProgramBinaryFPL);
+  // Some drivers only return a usable binary for programs linked with the
+  // retrievable hint set. The OES extension has no such hint.
+  glProgramParameteriFPL = nullptr;
+  if (supports_program_binaries_ && !*binary_suffix) {
+    LookupGLFunction("glProgramParameteri", "", &glProgramParameteriFPL);
+  }
+  // A driver update may change what binaries it accepts.
+  driver_hash_ = kHashOffsetBasis;
+  const GLenum kDriverStrings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+  for (size_t i = 0; i < sizeof(kDriverStrings) / sizeof(kDriverStrings[0]);
+       i++) {
+    driver_hash_ = HashString(
+        reinterpret_cast<const char *>(glGetString(kDriverStrings[i])),
+        driver_hash_);
+  }
+
+  // Derivatives in fragment shaders are core in everything but OpenGL ES 2.
+  supports_standard_derivatives_ =
+      !es || major >= 3 ||
+      SDL_GL_ExtensionSupported("GL_OES_standard_derivatives");
+
+  // Drivers that can compile shaders on background threads may only use as
+  // many as we allow.
+  const char *parallel_compile_suffix = nullptr;
+  if (SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile")) {
+    parallel_compile_suffix = "KHR";
+  } else if (SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile")) {
+    parallel_compile_suffix = "ARB";
+  }
+  if (parallel_compile_suffix &&
+      LookupGLFunction("glMaxShaderCompilerThreads", parallel_compile_suffix,
+                       &glMaxShaderCompilerThreadsFPL)) {
+    // 0xFFFFFFFF leaves the number of threads up to the driver.
+    GL_CALL(glMaxShaderCompilerThreadsFPL(0xFFFFFFFF));
+  }
+}
+
+bool Renderer::SupportsCompressedFormat(uint32_t internal_format) const {
+  return std::find(compressed_formats_.begin(), compressed_formats_.end(),
+                   internal_format) != compressed_formats_.end();
+}
+
 bool Renderer::Initialize(const vec2i &window_size, const char *window_title) {
   // Basic SDL initialization, does not actually initialize a Window or OpenGL,
   // typically should not fail.
@@ -123,7 +287,9 @@ bool Renderer::Initialize(const vec2i &window_size, const char *window_title) {
 #undef GLEXT
 #endif
 
-      blend_mode_ = kBlendModeOff;
+  InitializeOptionalFeatures();
+
+  blend_mode_ = kBlendModeOff;
   return true;
 }
 
@@ -163,92 +329,231 @@ void Renderer::ClearFrameBuffer(const vec4 &color) {
   GL_CALL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 }
 
-GLuint Renderer::CompileShader(GLenum stage, GLuint program,
-                               const GLchar *source) {
-  std::string platform_source =
+// Prepended to all shaders, to paper over the differences between OpenGL and
+// OpenGL ES.
+// Extensions must be enabled before the first statement, so the ones shaders
+// may use are enabled here, if the driver has them.
+static const char kShaderPlatformSource[] =
 #ifdef PLATFORM_MOBILE
-      "#ifdef GL_ES\nprecision highp float;\n#endif\n";
+    "#ifdef GL_ES\n"
+    "#ifdef GL_OES_standard_derivatives\n"
+    "#extension GL_OES_standard_derivatives : enable\n"
+    "#endif\n"
+    "precision highp float;\n"
+    "#endif\n";
 #else
-      "#version 120\n#define lowp\n#define mediump\n#define highp\n";
+    "#version 120\n#define lowp\n#define mediump\n#define highp\n";
 #endif
+
+GLuint Renderer::CompileShader(GLenum stage, GLuint program,
+                               const GLchar *defines, const GLchar *source) {
+  std::string platform_source = kShaderPlatformSource;
+  platform_source += defines;
   platform_source += source;
   const char *platform_source_ptr = platform_source.c_str();
   auto shader_obj = glCreateShader(stage);
   GL_CALL(glShaderSource(shader_obj, 1, &platform_source_ptr, nullptr));
   GL_CALL(glCompileShader(shader_obj));
+  // Querying the compile status here would wait for the compiler, so that's
+  // left to FinishCompilingShader().
+  GL_CALL(glAttachShader(program, shader_obj));
+  return shader_obj;
+}
+
+// Returns true if 'shader_obj' compiled, or sets 'error' to why not.
+static bool CheckShaderCompiled(GLuint shader_obj, std::string *error) {
   GLint success;
   GL_CALL(glGetShaderiv(shader_obj, GL_COMPILE_STATUS, &success));
-  if (success) {
-    GL_CALL(glAttachShader(program, shader_obj));
-    return shader_obj;
-  } else {
-    GLint length = 0;
-    GL_CALL(glGetShaderiv(shader_obj, GL_INFO_LOG_LENGTH, &length));
-    last_error_.assign(length, '\0');
-    GL_CALL(glGetShaderInfoLog(shader_obj, length, &length, &last_error_[0]));
-    GL_CALL(glDeleteShader(shader_obj));
-    return 0;
+  if (success) return true;
+  GLint length = 0;
+  GL_CALL(glGetShaderiv(shader_obj, GL_INFO_LOG_LENGTH, &length));
+  error->assign(length, '\0');
+  if (length) {
+    GL_CALL(glGetShaderInfoLog(shader_obj, length, &length, &(*error)[0]));
   }
+  return false;
 }
 
 Shader *Renderer::CompileAndLinkShader(const char *vs_source,
                                        const char *ps_source) {
+  auto shader = StartCompilingShader(vs_source, ps_source);
+  if (FinishCompilingShader(shader)) return shader;
+  delete shader;
+  return nullptr;
+}
+
+Shader *Renderer::StartCompilingShader(const char *vs_source,
+                                       const char *ps_source,
+                                       const char *defines) {
+  uint64_t binary_key = 0;
+  if (supports_program_binaries_ && !shader_cache_directory_.empty()) {
+    binary_key = driver_hash_;
+    const char *sources[] = {kShaderPlatformSource, defines, vs_source,
+                             ps_source};
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+      binary_key = HashString(sources[i], binary_key);
+    }
+    auto program = LoadProgramBinary(binary_key);
+    if (program) return new Shader(program, 0, 0);
+  }
   auto program = glCreateProgram();
-  auto vs = CompileShader(GL_VERTEX_SHADER, program, vs_source);
-  if (vs) {
-    auto ps = CompileShader(GL_FRAGMENT_SHADER, program, ps_source);
-    if (ps) {
-      GL_CALL(
-          glBindAttribLocation(program, Mesh::kAttributePosition, "aPosition"));
-      GL_CALL(glBindAttribLocation(program, Mesh::kAttributeNormal, "aNormal"));
-      GL_CALL(
-          glBindAttribLocation(program, Mesh::kAttributeTangent, "aTangent"));
-      GL_CALL(
-          glBindAttribLocation(program, Mesh::kAttributeTexCoord, "aTexCoord"));
-      GL_CALL(glBindAttribLocation(program, Mesh::kAttributeColor, "aColor"));
-      GL_CALL(glLinkProgram(program));
-      GLint status;
-      GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
-      if (status == GL_TRUE) {
-        auto shader = new Shader(program, vs, ps);
-        GL_CALL(glUseProgram(program));
-        shader->InitializeUniforms();
-        return shader;
-      }
+  auto vs = CompileShader(GL_VERTEX_SHADER, program, defines, vs_source);
+  auto ps = CompileShader(GL_FRAGMENT_SHADER, program, defines, ps_source);
+  GL_CALL(glBindAttribLocation(program, Mesh::kAttributePosition, "aPosition"));
+  GL_CALL(glBindAttribLocation(program, Mesh::kAttributeNormal, "aNormal"));
+  GL_CALL(glBindAttribLocation(program, Mesh::kAttributeTangent, "aTangent"));
+  GL_CALL(glBindAttribLocation(program, Mesh::kAttributeTexCoord, "aTexCoord"));
+  GL_CALL(glBindAttribLocation(program, Mesh::kAttributeColor, "aColor"));
+  GL_CALL(glBindAttribLocation(program, Mesh::kAttributeInstanceTransform + 0,
+                               "aInstanceRow0"));
+  GL_CALL(glBindAttribLocation(program, Mesh::kAttributeInstanceTransform + 1,
+                               "aInstanceRow1"));
+  GL_CALL(glBindAttribLocation(program, Mesh::kAttributeInstanceTransform + 2,
+                               "aInstanceRow2"));
+  if (binary_key && glProgramParameteriFPL) {
+    GL_CALL(glProgramParameteriFPL(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                   GL_TRUE));
+  }
+  GL_CALL(glLinkProgram(program));
+  auto shader = new Shader(program, vs, ps);
+  shader->binary_key_ = binary_key;
+  return shader;
+}
+
+bool Renderer::FinishCompilingShader(Shader *shader) {
+  GLint status;
+  GL_CALL(glGetProgramiv(shader->program_, GL_LINK_STATUS, &status));
+  if (status != GL_TRUE) {
+    // Report why compiling failed, if it did, as linking fails as a result.
+    if (CheckShaderCompiled(shader->vs_, &last_error_) &&
+        CheckShaderCompiled(shader->ps_, &last_error_)) {
       GLint length = 0;
-      GL_CALL(glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length));
+      GL_CALL(glGetProgramiv(shader->program_, GL_INFO_LOG_LENGTH, &length));
       last_error_.assign(length, '\0');
-      GL_CALL(glGetProgramInfoLog(program, length, &length, &last_error_[0]));
-      GL_CALL(glDeleteShader(ps));
+      if (length) {
+        GL_CALL(glGetProgramInfoLog(shader->program_, length, &length,
+                                    &last_error_[0]));
+      }
     }
-    GL_CALL(glDeleteShader(vs));
+    return false;
+  }
+  if (shader->binary_key_) {
+    SaveProgramBinary(*shader);
+    shader->binary_key_ = 0;
   }
+  GL_CALL(glUseProgram(shader->program_));
+  shader->InitializeUniforms();
+  return true;
+}
+
+// Name of the file in 'directory' that the program binary for 'key' is
+// cached in.
+static std::string ProgramBinaryFileName(const std::string &directory,
+                                         uint64_t key) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string filename = directory + "shader_";
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    filename += kHexDigits[(key >> shift) & 0xf];
+  }
+  return filename + ".bin";
+}
+
+// Program binary files hold the binary's format, followed by the binary.
+GLuint Renderer::LoadProgramBinary(uint64_t key) {
+  auto handle = SDL_RWFromFile(
+      ProgramBinaryFileName(shader_cache_directory_, key).c_str(), "rb");
+  if (!handle) return 0;
+  const Sint64 len = SDL_RWseek(handle, 0, RW_SEEK_END);
+  SDL_RWseek(handle, 0, RW_SEEK_SET);
+  std::vector<uint8_t> file(len > 0 ? static_cast<size_t>(len) : 0);
+  const bool read = file.size() > sizeof(uint32_t) &&
+                    SDL_RWread(handle, &file[0], file.size(), 1) == 1;
+  SDL_RWclose(handle);
+  if (!read) return 0;
+  uint32_t format;
+  memcpy(&format, &file[0], sizeof(format));
+  const GLsizei length = static_cast<GLsizei>(file.size() - sizeof(format));
+  auto program = glCreateProgram();
+  GL_CALL(glProgramBinaryFPL(program, format, &file[sizeof(format)], length));
+  GLint status;
+  GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+  if (status == GL_TRUE) return program;
   GL_CALL(glDeleteProgram(program));
-  return nullptr;
+  return 0;
 }
 
-uint16_t *Renderer::Convert8888To5551(const uint8_t *buffer,
-                                      const vec2i &size) {
-  auto buffer16 = new uint16_t[size.x() * size.y()];
-  for (int i = 0; i < size.x() * size.y(); i++) {
-    auto c = &buffer[i * 4];
-    buffer16[i] = ((c[0] >> 3) << 11) | ((c[1] >> 3) << 6) |
-                  ((c[2] >> 3) << 1) | ((c[3] >> 7) << 0);
+void Renderer::SaveProgramBinary(const Shader &shader) {
+  GLint length = 0;
+  GL_CALL(glGetProgramiv(shader.program_, GL_PROGRAM_BINARY_LENGTH, &length));
+  if (length <= 0) return;
+  std::vector<uint8_t> file(sizeof(uint32_t) + length);
+  GLenum format = 0;
+  GL_CALL(glGetProgramBinaryFPL(shader.program_, length, &length, &format,
+                                &file[sizeof(uint32_t)]));
+  const uint32_t file_format = format;
+  memcpy(&file[0], &file_format, sizeof(file_format));
+  const std::string filename =
+      ProgramBinaryFileName(shader_cache_directory_, shader.binary_key_);
+  auto handle = SDL_RWFromFile(filename.c_str(), "wb");
+  const bool written =
+      handle &&
+      SDL_RWwrite(handle, &file[0], sizeof(file_format) + length, 1) == 1;
+  if (handle) SDL_RWclose(handle);
+  if (!written) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Can't write shader cache file %s",
+                 filename.c_str());
   }
-  return buffer16;
 }
 
-uint16_t *Renderer::Convert888To565(const uint8_t *buffer, const vec2i &size) {
-  auto buffer16 = new uint16_t[size.x() * size.y()];
-  for (int i = 0; i < size.x() * size.y(); i++) {
-    auto c = &buffer[i * 3];
-    buffer16[i] = ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | ((c[2] >> 3) << 0);
+TextureFormat Renderer::UploadFormat(bool has_alpha,
+                                    TextureFormat desired) const {
+  if (desired == kFormatAuto) desired = has_alpha ? kFormat5551 : kFormat565;
+  if (!use_16bpp_) {
+    // Fallback to 8888 or 888.
+    if (desired == kFormat5551) return kFormat8888;
+    if (desired == kFormat565) return kFormat888;
+  }
+  return desired;
+}
+
+void Renderer::ConvertTexture(uint8_t *buffer, const vec2i &size,
+                              TextureFormat format) {
+  auto buffer16 = reinterpret_cast<uint16_t *>(buffer);
+  switch (format) {
+    case kFormat5551:
+      Convert8888To5551(buffer, size.x() * size.y(), buffer16);
+      break;
+    case kFormat565:
+      Convert888To565(buffer, size.x() * size.y(), buffer16);
+      break;
+    default:
+      break;
   }
-  return buffer16;
 }
 
 GLuint Renderer::CreateTexture(const uint8_t *buffer, const vec2i &size,
                                bool has_alpha, TextureFormat desired) {
+  const TextureFormat format = UploadFormat(has_alpha, desired);
+  switch (format) {
+    case kFormat5551:
+      assert(has_alpha);
+      conversion_buffer_.resize(size.x() * size.y());
+      Convert8888To5551(buffer, size.x() * size.y(), &conversion_buffer_[0]);
+      return UploadTexture(&conversion_buffer_[0], size, format);
+    case kFormat565:
+      assert(!has_alpha);
+      conversion_buffer_.resize(size.x() * size.y());
+      Convert888To565(buffer, size.x() * size.y(), &conversion_buffer_[0]);
+      return UploadTexture(&conversion_buffer_[0], size, format);
+    default:
+      assert(has_alpha == (format == kFormat8888));
+      return UploadTexture(buffer, size, format);
+  }
+}
+
+// Creates and binds a texture with our usual sampling parameters.
+// Returns 0 if not a power of two in size.
+static GLuint GenTexture(const vec2i &size, bool mipmapped) {
   int area = size.x() * size.y();
   if (area & (area - 1)) {
     SDL_LogError(SDL_LOG_CATEGORY_ERROR,
@@ -264,61 +569,159 @@ GLuint Renderer::CreateTexture(const uint8_t *buffer, const vec2i &size,
   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT));
   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT));
   GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-  GL_CALL(
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                      GL_LINEAR_MIPMAP_NEAREST /*GL_LINEAR_MIPMAP_LINEAR*/));
-  if (desired == kFormatAuto) desired = has_alpha ? kFormat5551 : kFormat565;
-  switch (desired) {
-    case kFormat5551: {
-      assert(has_alpha);
-      if (use_16bpp_) {
-        auto buffer16 = Convert8888To5551(buffer, size);
-        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x(), size.y(), 0,
-                             GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, buffer16));
-        delete[] buffer16;
-      } else {
-        // Fallback to 8888
-        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x(), size.y(), 0,
-                             GL_RGBA, GL_UNSIGNED_BYTE, buffer));
-      }
-      break;
-    }
-    case kFormat565: {
-      assert(!has_alpha);
-      if (use_16bpp_) {
-        auto buffer16 = Convert888To565(buffer, size);
-        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size.x(), size.y(), 0,
-                             GL_RGB, GL_UNSIGNED_SHORT_5_6_5, buffer16));
-        delete[] buffer16;
-      } else {
-        // Fallback to 888
-        GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size.x(), size.y(), 0,
-                             GL_RGB, GL_UNSIGNED_BYTE, buffer));
-      }
-      break;
-    }
-    case kFormat8888: {
-      assert(has_alpha);
-      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x(), size.y(), 0,
-                           GL_RGBA, GL_UNSIGNED_BYTE, buffer));
-      break;
-    }
-    case kFormat888: {
-      assert(!has_alpha);
-      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size.x(), size.y(), 0,
-                           GL_RGB, GL_UNSIGNED_BYTE, buffer));
-      break;
-    }
-    case kFormatLuminance: {
-      assert(!has_alpha);
-      GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, size.x(), size.y(),
-                           0, GL_LUMINANCE, GL_UNSIGNED_BYTE, buffer));
-      break;
-    }
+  GL_CALL(glTexParameteri(
+      GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+      mipmapped ? GL_LINEAR_MIPMAP_NEAREST /*GL_LINEAR_MIPMAP_LINEAR*/
+                : GL_LINEAR));
+  return texture_id;
+}
+
+// The size of mip level 'level' of a texture of 'size'.
+static vec2i MipLevelSize(const vec2i &size, int level) {
+  return vec2i(std::max(size.x() >> level, 1), std::max(size.y() >> level, 1));
+}
+
+// The GL format and type 'format' is uploaded as. Returns bytes per pixel.
+static int TextureFormatToGL(TextureFormat format, GLenum *gl_format,
+                             GLenum *gl_type) {
+  *gl_format = GL_RGBA;
+  *gl_type = GL_UNSIGNED_BYTE;
+  switch (format) {
+    case kFormat5551:
+      *gl_type = GL_UNSIGNED_SHORT_5_5_5_1;
+      return 2;
+    case kFormat565:
+      *gl_format = GL_RGB;
+      *gl_type = GL_UNSIGNED_SHORT_5_6_5;
+      return 2;
+    case kFormat8888:
+      return 4;
+    case kFormat888:
+      *gl_format = GL_RGB;
+      return 3;
+    case kFormatLuminance:
+      *gl_format = GL_LUMINANCE;
+      return 1;
     default:
       assert(0);
+      return 4;
+  }
+}
+
+GLuint Renderer::UploadTexture(const void *buffer, const vec2i &size,
+                               TextureFormat format, int mip_levels) {
+  GLuint texture_id = GenTexture(size, true);
+  if (!texture_id) return 0;
+  GLenum gl_format, gl_type;
+  const int bytes_per_pixel = TextureFormatToGL(format, &gl_format, &gl_type);
+  // Rows of the smallest mip levels aren't 4 byte aligned.
+  GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+  auto level_data = static_cast<const uint8_t *>(buffer);
+  for (int level = 0; level < std::max(mip_levels, 1); level++) {
+    const vec2i level_size = MipLevelSize(size, level);
+    GL_CALL(glTexImage2D(GL_TEXTURE_2D, level, gl_format, level_size.x(),
+                         level_size.y(), 0, gl_format, gl_type, level_data));
+    level_data += level_size.x() * level_size.y() * bytes_per_pixel;
+  }
+  GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+  if (!mip_levels) GL_CALL(glGenerateMipmap(GL_TEXTURE_2D));
+  return texture_id;
+}
+
+size_t Renderer::TextureMemory(const vec2i &size, TextureFormat format,
+                               int mip_levels) {
+  GLenum gl_format, gl_type;
+  const size_t bytes_per_pixel =
+      TextureFormatToGL(format, &gl_format, &gl_type);
+  // Generated mip levels go all the way down to 1x1.
+  size_t num_pixels = 0;
+  for (int level = 0;; level++) {
+    const vec2i level_size = MipLevelSize(size, level);
+    num_pixels += level_size.x() * level_size.y();
+    if (mip_levels ? level + 1 >= mip_levels
+                   : level_size.x() == 1 && level_size.y() == 1)
+      break;
+  }
+  return bytes_per_pixel * num_pixels;
+}
+
+GLuint Renderer::AllocateTexture(const vec2i &size, TextureFormat format) {
+  GLuint texture_id = GenTexture(size, true);
+  if (!texture_id) return 0;
+  GLenum gl_format, gl_type;
+  TextureFormatToGL(format, &gl_format, &gl_type);
+  GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, gl_format, size.x(), size.y(), 0,
+                       gl_format, gl_type, nullptr));
+  return texture_id;
+}
+
+int Renderer::UploadTextureRows(GLuint texture_id, const void *buffer,
+                                const vec2i &size, TextureFormat format,
+                                int first_row, size_t max_bytes) {
+  GLenum gl_format, gl_type;
+  const int bytes_per_pixel = TextureFormatToGL(format, &gl_format, &gl_type);
+  const size_t row_bytes = size.x() * bytes_per_pixel;
+  const size_t rows_left = static_cast<size_t>(size.y() - first_row);
+  // Always make progress, even if a single row exceeds 'max_bytes'.
+  const int num_rows =
+      static_cast<int>(std::max(std::min(max_bytes / row_bytes, rows_left),
+                                static_cast<size_t>(1)));
+  GL_CALL(glActiveTexture(GL_TEXTURE0));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, texture_id));
+  GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+  GL_CALL(glTexSubImage2D(
+      GL_TEXTURE_2D, 0, 0, first_row, size.x(), num_rows, gl_format, gl_type,
+      static_cast<const uint8_t *>(buffer) + first_row * row_bytes));
+  GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+  const int next_row = first_row + num_rows;
+  if (next_row == size.y()) GL_CALL(glGenerateMipmap(GL_TEXTURE_2D));
+  return next_row;
+}
+
+void Renderer::UploadTextureRect(GLuint texture_id, const void *buffer,
+                                 const vec2i &size, TextureFormat format,
+                                 const vec2i &pos, const vec2i &rect_size) {
+  GLenum gl_format, gl_type;
+  const int bytes_per_pixel = TextureFormatToGL(format, &gl_format, &gl_type);
+  const size_t row_bytes = rect_size.x() * bytes_per_pixel;
+  const size_t pitch = size.x() * bytes_per_pixel;
+  auto pixels = static_cast<const uint8_t *>(buffer) + pos.y() * pitch +
+                pos.x() * bytes_per_pixel;
+  GL_CALL(glActiveTexture(GL_TEXTURE0));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, texture_id));
+  GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+  if (supports_unpack_row_length_) {
+    GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, size.x()));
+  } else if (rect_size.x() != size.x()) {
+    upload_buffer_.resize(row_bytes * rect_size.y());
+    for (int y = 0; y < rect_size.y(); y++) {
+      memcpy(&upload_buffer_[y * row_bytes], pixels + y * pitch, row_bytes);
+    }
+    pixels = upload_buffer_.data();
+  }
+  GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, pos.x(), pos.y(), rect_size.x(),
+                          rect_size.y(), gl_format, gl_type, pixels));
+  if (supports_unpack_row_length_) {
+    GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+  }
+  GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+}
+
+GLuint Renderer::UploadCompressedTexture(const KTXTexture &ktx) {
+  assert(SupportsCompressedFormat(ktx.internal_format));
+  // Compressed textures can't have their mip levels generated. Without all of
+  // them, sample from the first only.
+  const bool mipmapped = ktx.HasCompleteMipChain();
+  GLuint texture_id = GenTexture(ktx.size, mipmapped);
+  if (!texture_id) return 0;
+  const size_t num_levels = mipmapped ? ktx.levels.size() : 1;
+  for (size_t level = 0; level < num_levels; level++) {
+    const vec2i level_size = MipLevelSize(ktx.size, static_cast<int>(level));
+    GL_CALL(glCompressedTexImage2D(
+        GL_TEXTURE_2D, static_cast<GLint>(level), ktx.internal_format,
+        level_size.x(), level_size.y(), 0, ktx.level_sizes[level],
+        ktx.levels[level]));
   }
-  GL_CALL(glGenerateMipmap(GL_TEXTURE_2D));
   return texture_id;
 }
 
@@ -386,28 +789,29 @@ uint8_t *Renderer::UnpackWebP(const void *webp_buf, size_t size,
 }
 
 uint8_t *Renderer::LoadAndUnpackTexture(const char *filename, vec2i *dimensions,
-                                        bool *has_alpha) {
-  std::string file;
-  if (LoadFile(filename, &file)) {
+                                        bool *has_alpha,
+                                        std::string *error) {
+  AssetFile file;
+  if (file.Open(filename)) {
     std::string ext = filename;
     size_t ext_pos = ext.find_last_of(".");
     if (ext_pos != std::string::npos) ext = ext.substr(ext_pos + 1);
     if (ext == "tga") {
-      auto buf = UnpackTGA(file.c_str(), dimensions, has_alpha);
-      if (!buf) last_error() = std::string("TGA format problem: ") + filename;
+      auto buf = UnpackTGA(file.data(), dimensions, has_alpha);
+      if (!buf) *error = std::string("TGA format problem: ") + filename;
       return buf;
     } else if (ext == "webp") {
-      auto buf = UnpackWebP(file.c_str(), file.length(), dimensions, has_alpha);
-      if (!buf) last_error() = std::string("WebP format problem: ") + filename;
+      auto buf = UnpackWebP(file.data(), file.size(), dimensions, has_alpha);
+      if (!buf) *error = std::string("WebP format problem: ") + filename;
       return buf;
     } else {
-      last_error() =
+      *error =
           std::string("Can\'t figure out file type from extension: ") +
           filename;
       return nullptr;
     }
   }
-  last_error() = std::string("Couldn\'t load: ") + filename;
+  *error = std::string("Couldn\'t load: ") + filename;
   return nullptr;
 }
 
@@ -499,3 +903,7 @@ void LogGLError(const char *file, int line, const char *call) {
 GLBASEEXTS GLEXTS
 #undef GLEXT
 #endif
+
+#define GLOPTEXT(type, name) type name = nullptr;
+GLOPTEXTS
+#undef GLOPTEXT
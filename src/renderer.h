@@ -16,6 +16,7 @@
 #define FPL_RENDERER_H
 
 #include "mathfu/glsl_mappings.h"
+#include "compressed_texture.h"
 #include "material.h"
 #include "mesh.h"
 #include "shader.h"
@@ -49,38 +50,100 @@ class Renderer {
   // Returns nullptr upon error, with a descriptive message in glsl_error().
   // Attribute names in the vertex shader should be aPosition, aNormal,
   // aTexCoord and aColor to match whatever attributes your vertex data has.
+  // Shaders for Mesh::RenderInstanced() additionally take the per-instance
+  // transform in aInstanceRow0..2, and the instance color in aColor.
   Shader *CompileAndLinkShader(const char *vs_source, const char *ps_source);
 
+  // CompileAndLinkShader() in two halves. StartCompilingShader() hands the
+  // sources to the driver without waiting for the result, so drivers that
+  // compile in the background can work on several shaders at once. If the
+  // shader cache holds a binary for these sources, it's used instead.
+  // FinishCompilingShader() then waits for the shader to link and readies it
+  // for use. It returns false upon error, with a descriptive message in
+  // last_error(), in which case you must delete the shader.
+  // 'defines' is inserted ahead of both sources, to compile a variant of
+  // them.
+  Shader *StartCompilingShader(const char *vs_source, const char *ps_source,
+                               const char *defines = "");
+  bool FinishCompilingShader(Shader *shader);
+
   // Create a texture from a memory buffer containing xsize * ysize RGBA pixels.
   // Return 0 if not a power of two in size.
   GLuint CreateTexture(const uint8_t *buffer, const vec2i &size, bool has_alpha,
                        TextureFormat desired = kFormatAuto);
 
+  // Like CreateTexture(), but for pixels that have already been converted to
+  // 'format', as returned by UploadFormat(). See ConvertTexture().
+  // If 'mip_levels' is non-zero, 'buffer' holds that many mip levels back to
+  // back, each half the size of the previous one. Otherwise mip levels are
+  // generated.
+  GLuint UploadTexture(const void *buffer, const vec2i &size,
+                       TextureFormat format, int mip_levels = 0);
+
+  // Alternatively, textures may be uploaded a few rows at a time, so large
+  // ones can be spread over several frames. AllocateTexture() creates a
+  // texture of 'size' and 'format' without any pixels, or returns 0 if not a
+  // power of two in size. UploadTextureRows() then uploads rows of 'buffer'
+  // to it, starting at 'first_row', and stopping after roughly 'max_bytes' but
+  // at least one row. It returns the row to continue from, and generates the
+  // mip levels once that reaches size.y().
+  GLuint AllocateTexture(const vec2i &size, TextureFormat format);
+
+  // GPU memory taken up by a texture created by UploadTexture() or
+  // AllocateTexture(), including its mip levels. 'mip_levels' is as passed to
+  // UploadTexture(), so only 0 counts generated mip levels.
+  static size_t TextureMemory(const vec2i &size, TextureFormat format,
+                              int mip_levels = 0);
+  int UploadTextureRows(GLuint texture_id, const void *buffer,
+                        const vec2i &size, TextureFormat format, int first_row,
+                        size_t max_bytes);
+
+  // Uploads the 'rect_size' pixels at 'pos' of an image of 'size' in 'buffer'
+  // to the same area of level 0 of a texture, e.g. to update the parts of a
+  // texture atlas that changed. Unless supports_unpack_row_length(), the rows
+  // of the area are copied next to each other first.
+  void UploadTextureRect(GLuint texture_id, const void *buffer,
+                         const vec2i &size, TextureFormat format,
+                         const vec2i &pos, const vec2i &rect_size);
+
+  // Create a texture from GPU compressed data, which must be in a format
+  // SupportsCompressedFormat() returns true for.
+  // Return 0 if not a power of two in size.
+  GLuint UploadCompressedTexture(const KTXTexture &ktx);
+
+  // The format a texture that asks for 'desired' gets uploaded in. Resolves
+  // kFormatAuto, and falls back to 32bit formats if 16bit ones are disabled.
+  // Safe to call from any thread once initialized.
+  TextureFormat UploadFormat(bool has_alpha, TextureFormat desired) const;
+
   // Unpacks a memory buffer containing a TGA format file.
   // May only be uncompressed RGB or RGBA data, Y-flipped or not.
   // Returns RGBA array of returned dimensions or nullptr if the
   // format is not understood.
   // You must free() the returned pointer when done.
-  uint8_t *UnpackTGA(const void *tga_buf, vec2i *dimensions, bool *has_alpha);
+  static uint8_t *UnpackTGA(const void *tga_buf, vec2i *dimensions,
+                            bool *has_alpha);
 
   // Unpacks a memory buffer containing a Webp format file.
   // Returns RGBA array of the returned dimensions or nullptr if the format
   // is not understood.
   // You must free() the returned pointer when done.
-  uint8_t *UnpackWebP(const void *webp_buf, size_t size, vec2i *dimensions,
-                      bool *has_alpha);
+  static uint8_t *UnpackWebP(const void *webp_buf, size_t size,
+                             vec2i *dimensions, bool *has_alpha);
 
   // Loads the file in filename, and then unpacks the file format (supports
-  // TGA and WebP).
-  // last_error() contains more information if nullptr is returned.
+  // TGA and WebP). Safe to call from several loader threads at once, which
+  // is why 'error' receives more information if nullptr is returned, rather
+  // than last_error().
   // You must free() the returned pointer when done.
-  uint8_t *LoadAndUnpackTexture(const char *filename, vec2i *dimensions,
-                                bool *has_alpha);
+  static uint8_t *LoadAndUnpackTexture(const char *filename, vec2i *dimensions,
+                                       bool *has_alpha, std::string *error);
 
-  // Utility functions to convert 32bit RGBA to 16bit.
-  // You must delete[] the return value afterwards.
-  uint16_t *Convert8888To5551(const uint8_t *buffer, const vec2i &size);
-  uint16_t *Convert888To565(const uint8_t *buffer, const vec2i &size);
+  // Converts the pixels returned by LoadAndUnpackTexture() to 'format', as
+  // returned by UploadFormat(), in place. Safe to call from any thread, so the
+  // loader thread can do this ahead of UploadTexture().
+  static void ConvertTexture(uint8_t *buffer, const vec2i &size,
+                             TextureFormat format);
 
   // Set alpha test (cull pixels with alpha below amount) vs alpha blend
   // (blend with framebuffer pixel regardedless).
@@ -98,7 +161,13 @@ class Renderer {
         camera_pos_(mathfu::kZeros3f),
         window_size_(mathfu::kZeros2i),
         window_(nullptr),
-        context_(nullptr) {}
+        context_(nullptr),
+        supports_vertex_array_objects_(false),
+        supports_instanced_arrays_(false),
+        supports_program_binaries_(false),
+        supports_unpack_row_length_(false),
+        supports_standard_derivatives_(false),
+        driver_hash_(0) {}
   ~Renderer() { ShutDown(); }
 
   // Shader uniform: model_view_projection
@@ -131,8 +200,54 @@ class Renderer {
   vec2i &window_size() { return window_size_; }
   const vec2i &window_size() const { return window_size_; }
 
+  // Whether glGenVertexArraysFPL() and friends are available.
+  bool supports_vertex_array_objects() const {
+    return supports_vertex_array_objects_;
+  }
+
+  // Whether glDrawElementsInstancedFPL() and glVertexAttribDivisorFPL() are
+  // available.
+  bool supports_instanced_arrays() const { return supports_instanced_arrays_; }
+
+  // Whether textures in 'internal_format' (see CompressedTextureFormat) can
+  // be uploaded as they are. Safe to call from any thread once initialized.
+  bool SupportsCompressedFormat(uint32_t internal_format) const;
+
+  // Whether linked shaders can be saved to and restored from the shader
+  // cache, through glGetProgramBinaryFPL() and glProgramBinaryFPL().
+  bool supports_program_binaries() const {
+    return supports_program_binaries_;
+  }
+
+  // Whether GL_UNPACK_ROW_LENGTH can be set, to upload part of the rows of an
+  // image.
+  bool supports_unpack_row_length() const {
+    return supports_unpack_row_length_;
+  }
+
+  // Whether fragment shaders can use dFdx(), dFdy() and fwidth().
+  bool supports_standard_derivatives() const {
+    return supports_standard_derivatives_;
+  }
+
+  // Directory, ending in a path separator, where linked shaders are saved so
+  // that later runs can skip compiling them. Binaries are keyed on the shader
+  // sources and the driver, so updating either just recompiles. Empty, the
+  // default, disables the cache.
+  void set_shader_cache_directory(const std::string &directory) {
+    shader_cache_directory_ = directory;
+  }
+
  private:
-  GLuint CompileShader(GLenum stage, GLuint program, const GLchar *source);
+  GLuint CompileShader(GLenum stage, GLuint program, const GLchar *defines,
+                       const GLchar *source);
+  // Creates a program from the binary cached under 'key', or returns 0 if
+  // there's none, or the driver no longer accepts it.
+  GLuint LoadProgramBinary(uint64_t key);
+  // Saves the binary of a freshly linked 'shader' to the cache.
+  void SaveProgramBinary(const Shader &shader);
+  // Looks up the optional GL functions (see GLOPTEXTS) the driver supports.
+  void InitializeOptionalFeatures();
 
   // The mvp. Use the Ortho() and Perspective() methods in mathfu::Matrix
   // to conveniently change the camera.
@@ -152,6 +267,24 @@ class Renderer {
   BlendMode blend_mode_;
 
   bool use_16bpp_;
+
+  // Holds the 16bit pixels CreateTexture() converts to, between calls.
+  std::vector<uint16_t> conversion_buffer_;
+
+  // Holds the rows UploadTextureRect() copies together, between calls.
+  std::vector<uint8_t> upload_buffer_;
+
+  bool supports_vertex_array_objects_;
+  bool supports_instanced_arrays_;
+  bool supports_program_binaries_;
+  bool supports_unpack_row_length_;
+  bool supports_standard_derivatives_;
+  std::vector<uint32_t> compressed_formats_;
+
+  // Hash of the driver's vendor, renderer and version strings, which all
+  // program binary keys start from.
+  uint64_t driver_hash_;
+  std::string shader_cache_directory_;
 };
 
 }  // namespace fpl
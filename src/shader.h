@@ -41,7 +41,8 @@ class Shader {
         uniform_model_(-1),
         uniform_color_(-1),
         uniform_light_pos_(-1),
-        uniform_camera_pos_(-1) {}
+        uniform_camera_pos_(-1),
+        binary_key_(0) {}
 
   ~Shader() {
     if (vs_) GL_CALL(glDeleteShader(vs_));
@@ -104,6 +105,8 @@ class Shader {
   void InitializeUniforms();
 
  private:
+  friend class Renderer;
+
   GLuint program_, vs_, ps_;
 
   GLint uniform_model_view_projection_;
@@ -111,6 +114,9 @@ class Shader {
   GLint uniform_color_;
   GLint uniform_light_pos_;
   GLint uniform_camera_pos_;
+
+  // Identifies the cached program binary to save once linked, or 0.
+  uint64_t binary_key_;
 };
 
 }  // namespace fpl
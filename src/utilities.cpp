@@ -15,21 +15,15 @@
 #include "precompiled.h"
 
 #include "utilities.h"
+#include "asset_file.h"
 
 namespace fpl {
 
 bool LoadFile(const char* filename, std::string* dest) {
-  auto handle = SDL_RWFromFile(filename, "rb");
-  if (!handle) {
-    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "LoadFile fail on %s", filename);
-    return false;
-  }
-  auto len = static_cast<size_t>(SDL_RWseek(handle, 0, RW_SEEK_END));
-  SDL_RWseek(handle, 0, RW_SEEK_SET);
-  dest->assign(len + 1, 0);
-  size_t rlen = static_cast<size_t>(SDL_RWread(handle, &(*dest)[0], 1, len));
-  SDL_RWclose(handle);
-  return len == rlen && len > 0;
+  AssetFile file;
+  if (!file.Open(filename)) return false;
+  dest->assign(reinterpret_cast<const char*>(file.data()), file.size());
+  return true;
 }
 
 #if defined(_WIN32)
@@ -26,6 +26,8 @@
 
 namespace fpl {
 
+// Copies the whole file into 'dest'. Use AssetFile instead for data that can
+// be used in place.
 bool LoadFile(const char* filename, std::string* dest);
 
 inline const mathfu::vec3 LoadVec3(const pie_noon::Vec3* v) {
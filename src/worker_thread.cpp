@@ -0,0 +1,87 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "worker_thread.h"
+
+namespace fpl {
+
+WorkerThread::WorkerThread()
+    : thread_(nullptr), busy_(false), quit_(false) {
+  job_semaphore_ = SDL_CreateSemaphore(0);
+  done_semaphore_ = SDL_CreateSemaphore(0);
+  assert(job_semaphore_ && done_semaphore_);
+}
+
+WorkerThread::~WorkerThread() {
+  if (thread_) {
+    Wait();
+    quit_ = true;
+    SDL_SemPost(job_semaphore_);
+    SDL_WaitThread(thread_, nullptr);
+    thread_ = nullptr;
+  }
+  if (job_semaphore_) {
+    SDL_DestroySemaphore(job_semaphore_);
+    job_semaphore_ = nullptr;
+  }
+  if (done_semaphore_) {
+    SDL_DestroySemaphore(done_semaphore_);
+    done_semaphore_ = nullptr;
+  }
+}
+
+bool WorkerThread::Start(const char *name) {
+  assert(!thread_);
+  thread_ = SDL_CreateThread(WorkerThread::WorkerThreadMain, name, this);
+  if (!thread_) {
+    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Couldn't create thread %s: %s\n",
+                 name, SDL_GetError());
+    return false;
+  }
+  return true;
+}
+
+void WorkerThread::Run(const std::function<void()> &job) {
+  assert(!busy_);
+  if (!thread_) {
+    job();
+    return;
+  }
+  job_ = job;
+  busy_ = true;
+  SDL_SemPost(job_semaphore_);
+}
+
+void WorkerThread::Wait() {
+  if (!busy_) return;
+  SDL_SemWait(done_semaphore_);
+  busy_ = false;
+}
+
+void WorkerThread::Worker() {
+  for (;;) {
+    SDL_SemWait(job_semaphore_);
+    if (quit_) break;
+    job_();
+    SDL_SemPost(done_semaphore_);
+  }
+}
+
+int WorkerThread::WorkerThreadMain(void *user_data) {
+  reinterpret_cast<WorkerThread *>(user_data)->Worker();
+  return 0;
+}
+
+}  // namespace fpl
@@ -0,0 +1,65 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_WORKER_THREAD_H
+#define FPL_WORKER_THREAD_H
+
+namespace fpl {
+
+// A persistent thread that runs one job at a time, handed to it by the main
+// thread. The main thread is free to do other work until it calls Wait().
+// Used to overlap the simulation of one frame with the rendering of the
+// previous one.
+class WorkerThread {
+ public:
+  WorkerThread();
+  ~WorkerThread();
+
+  // Launches the thread. Returns false if that failed, in which case Run()
+  // executes jobs immediately on the calling thread instead.
+  bool Start(const char *name);
+
+  // Starts executing 'job' on the worker thread. The previous job must have
+  // been waited for.
+  void Run(const std::function<void()> &job);
+
+  // Blocks until the job passed to Run() has completed. Returns immediately if
+  // there is no such job.
+  void Wait();
+
+  bool running() const { return thread_ != nullptr; }
+
+ private:
+  void Worker();
+  static int WorkerThreadMain(void *user_data);
+
+  std::function<void()> job_;
+
+  SDL_Thread *thread_;
+
+  // Posted by the main thread when there's a job (or it is time to quit), and
+  // by the worker thread when the job is done.
+  SDL_semaphore *job_semaphore_;
+  SDL_semaphore *done_semaphore_;
+
+  // Only accessed by the main thread.
+  bool busy_;
+
+  // Written by the main thread before posting job_semaphore_.
+  bool quit_;
+};
+
+}  // namespace fpl
+
+#endif  // FPL_WORKER_THREAD_H
@@ -0,0 +1,143 @@
+/*
+* Copyright (c) 2014 Google, Inc.
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "compressed_texture.h"
+#include "gtest/gtest.h"
+
+class CompressedTextureTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() {}
+};
+
+// Appends a little endian 32 bit value.
+static void Append32(std::vector<uint8_t> *data, uint32_t value) {
+  for (int i = 0; i < 4; i++) data->push_back((value >> (i * 8)) & 0xFF);
+}
+
+// Builds a KTX file with one mip level per entry in 'levels'.
+static std::vector<uint8_t> MakeKTX(
+    uint32_t internal_format, int width, int height,
+    const std::vector<std::vector<uint8_t>> &levels) {
+  static const uint8_t kIdentifier[12] = {0xAB, 'K',  'T',  'X', ' ',  '1',
+                                          '1',  0xBB, '\r', '\n', 0x1A, '\n'};
+  std::vector<uint8_t> data(kIdentifier, kIdentifier + sizeof(kIdentifier));
+  Append32(&data, 0x04030201);       // endianness
+  Append32(&data, 0);                // glType
+  Append32(&data, 1);                // glTypeSize
+  Append32(&data, 0);                // glFormat
+  Append32(&data, internal_format);  // glInternalFormat
+  Append32(&data, 0x1907);           // glBaseInternalFormat, GL_RGB
+  Append32(&data, width);
+  Append32(&data, height);
+  Append32(&data, 0);  // pixelDepth
+  Append32(&data, 0);  // numberOfArrayElements
+  Append32(&data, 1);  // numberOfFaces
+  Append32(&data, static_cast<uint32_t>(levels.size()));
+  Append32(&data, 0);  // bytesOfKeyValueData
+  for (size_t i = 0; i < levels.size(); i++) {
+    Append32(&data, static_cast<uint32_t>(levels[i].size()));
+    data.insert(data.end(), levels[i].begin(), levels[i].end());
+  }
+  return data;
+}
+
+// An ETC1 block in individual mode: base colors (255, 136, 0) on the left
+// and (0, 136, 255) on the right, with modifier tables 0 and 7. All pixels
+// use the first, positive modifier, except for the one at (1, 0), which uses
+// the second one, negated.
+static const uint8_t kETC1Block[8] = {0xF0, 0x88, 0x0F, 0x1C,
+                                      0x00, 0x10, 0x00, 0x10};
+
+TEST_F(CompressedTextureTests, DecodeETC1Block) {
+  uint8_t rgb[4 * 4 * 3];
+  fpl::DecodeETC1(kETC1Block, mathfu::vec2i(4, 4), rgb);
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) {
+      const uint8_t *pixel = &rgb[(y * 4 + x) * 3];
+      if (x == 1 && y == 0) {
+        EXPECT_EQ(247, pixel[0]);
+        EXPECT_EQ(128, pixel[1]);
+        EXPECT_EQ(0, pixel[2]);
+      } else if (x < 2) {
+        EXPECT_EQ(255, pixel[0]);
+        EXPECT_EQ(138, pixel[1]);
+        EXPECT_EQ(2, pixel[2]);
+      } else {
+        EXPECT_EQ(47, pixel[0]);
+        EXPECT_EQ(183, pixel[1]);
+        EXPECT_EQ(255, pixel[2]);
+      }
+    }
+  }
+}
+
+// Images smaller than a block only get the top left of it.
+TEST_F(CompressedTextureTests, DecodeETC1PartialBlock) {
+  uint8_t rgb[2 * 1 * 3];
+  fpl::DecodeETC1(kETC1Block, mathfu::vec2i(2, 1), rgb);
+  const uint8_t expected[] = {255, 138, 2, 247, 128, 0};
+  EXPECT_EQ(0, memcmp(expected, rgb, sizeof(expected)));
+}
+
+TEST_F(CompressedTextureTests, ParseKTX) {
+  const std::vector<uint8_t> block(kETC1Block, kETC1Block + 8);
+  std::vector<std::vector<uint8_t>> levels(3, block);
+  const std::vector<uint8_t> file =
+      MakeKTX(fpl::kCompressedETC1RGB8, 4, 4, levels);
+
+  fpl::KTXTexture ktx;
+  ASSERT_TRUE(fpl::ParseKTX(&file[0], file.size(), &ktx));
+  EXPECT_EQ(static_cast<uint32_t>(fpl::kCompressedETC1RGB8),
+            ktx.internal_format);
+  EXPECT_EQ(4, ktx.size.x());
+  EXPECT_EQ(4, ktx.size.y());
+  ASSERT_EQ(3u, ktx.levels.size());
+  EXPECT_TRUE(ktx.HasCompleteMipChain());
+  for (size_t i = 0; i < ktx.levels.size(); i++) {
+    EXPECT_EQ(8u, ktx.level_sizes[i]);
+    EXPECT_EQ(0, memcmp(kETC1Block, ktx.levels[i], 8));
+  }
+  EXPECT_FALSE(fpl::CompressedFormatHasAlpha(ktx.internal_format));
+}
+
+TEST_F(CompressedTextureTests, ParseKTXRejectsBadFiles) {
+  const std::vector<uint8_t> block(kETC1Block, kETC1Block + 8);
+  std::vector<std::vector<uint8_t>> levels(1, block);
+  std::vector<uint8_t> file = MakeKTX(fpl::kCompressedETC1RGB8, 8, 8, levels);
+  fpl::KTXTexture ktx;
+
+  // A single level isn't a full mip chain for 8x8.
+  ASSERT_TRUE(fpl::ParseKTX(&file[0], file.size(), &ktx));
+  EXPECT_FALSE(ktx.HasCompleteMipChain());
+
+  // Truncated image data.
+  EXPECT_FALSE(fpl::ParseKTX(&file[0], file.size() - 1, &ktx));
+
+  // Wrong identifier.
+  file[1] = 'X';
+  EXPECT_FALSE(fpl::ParseKTX(&file[0], file.size(), &ktx));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
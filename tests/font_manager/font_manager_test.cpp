@@ -18,6 +18,7 @@
 
 #include "gtest/gtest.h"
 #include "common.h"
+#include "font_cache.h"
 #include "glyph_cache.h"
 
 class FontManagerTests : public ::testing::Test {
@@ -142,6 +143,228 @@ TEST_F(FontManagerTests, Glyph_Cache_InvolveEviction) {
   EXPECT_EQ(cache, cache);
 }
 
+// Test that a full cache adds pages instead of evicting glyphs.
+TEST_F(FontManagerTests, Glyph_Cache_MultiplePages) {
+  mathfu::vec2i cache_size = mathfu::vec2i(256, 256);
+  int32_t image_width = 31;
+  int32_t image_height = 31;
+  const int32_t kMaxPages = 2;
+
+  // Initialize Glyph cache
+  std::unique_ptr<fpl::GlyphCache<uint8_t>> cache(
+      new fpl::GlyphCache<uint8_t>(cache_size, kMaxPages));
+  std::unique_ptr<uint8_t[]> image(new uint8_t[image_width * image_height]);
+
+  fpl::GlyphCacheEntry entry;
+  entry.set_size(mathfu::vec2i(image_width, image_height));
+
+  // Fill two pages worth of glyphs in a single cycle.
+  const int32_t glyphs_per_page =
+      (cache_size.y() / (image_height + fpl::kGlyphCachePaddingY)) *
+      (cache_size.x() / (image_width + fpl::kGlyphCachePaddingX));
+  for (int32_t k = 0; k < glyphs_per_page * kMaxPages; ++k) {
+    entry.set_code_point(k);
+    auto p = cache->Set(image.get(), image_height, entry);
+    ASSERT_NE(nullptr, p);
+    EXPECT_EQ(k / glyphs_per_page, p->get_page());
+  }
+  EXPECT_EQ(kMaxPages, cache->get_num_pages());
+
+  // All glyphs are still cached.
+  for (int32_t k = 0; k < glyphs_per_page * kMaxPages; ++k) {
+    EXPECT_NE(nullptr, cache->Find(k, image_height));
+  }
+
+  // With all pages full of glyphs used in this cycle, there is no room left.
+  entry.set_code_point(glyphs_per_page * kMaxPages);
+  EXPECT_EQ(nullptr, cache->Set(image.get(), image_height, entry));
+
+  // In the next cycle, a glyph can be evicted instead.
+  cache->Update();
+  EXPECT_NE(nullptr, cache->Set(image.get(), image_height, entry));
+  EXPECT_EQ(kMaxPages, cache->get_num_pages());
+}
+
+// Test that glyphs are evicted one at a time, and that a wider glyph evicts
+// the unused glyphs next to each other instead of the whole row.
+TEST_F(FontManagerTests, Glyph_Cache_EvictGlyphs) {
+  mathfu::vec2i cache_size = mathfu::vec2i(256, 256);
+  int32_t image_width = 31;
+  int32_t image_height = 31;
+  int32_t wide_width = image_width * 2 + fpl::kGlyphCachePaddingX;
+
+  // Initialize Glyph cache
+  std::unique_ptr<fpl::GlyphCache<uint8_t>> cache(
+      new fpl::GlyphCache<uint8_t>(cache_size));
+  std::unique_ptr<uint8_t[]> image(new uint8_t[wide_width * image_height]);
+
+  fpl::GlyphCacheEntry entry;
+  entry.set_size(mathfu::vec2i(image_width, image_height));
+
+  // Fill the cache.
+  const int32_t kGlyphs =
+      (cache_size.y() / (image_height + fpl::kGlyphCachePaddingY)) *
+      (cache_size.x() / (image_width + fpl::kGlyphCachePaddingX));
+  for (int32_t k = 0; k < kGlyphs; ++k) {
+    entry.set_code_point(k);
+    ASSERT_NE(nullptr, cache->Set(image.get(), image_height, entry));
+  }
+  const float kArea = static_cast<float>(cache_size.x() * cache_size.y());
+  EXPECT_FLOAT_EQ(kGlyphs * image_width * image_height / kArea,
+                  cache->get_fill_ratio());
+
+  // In the next cycle, use all glyphs but the first two of the top row.
+  cache->Update();
+  for (int32_t k = 2; k < kGlyphs; ++k) {
+    EXPECT_NE(nullptr, cache->Find(k, image_height));
+  }
+
+  // A glyph twice as wide takes the place of both of them.
+  entry.set_code_point(kGlyphs);
+  entry.set_size(mathfu::vec2i(wide_width, image_height));
+  auto p = cache->Set(image.get(), image_height, entry);
+  ASSERT_NE(nullptr, p);
+  EXPECT_EQ(0.0f, p->get_uv().x());
+  EXPECT_EQ(0.0f, p->get_uv().y());
+  EXPECT_EQ(2, cache->get_stats().evictions);
+  EXPECT_EQ(kGlyphs + 1, cache->get_stats().stores);
+  EXPECT_FLOAT_EQ(2.0f / (kGlyphs + 1), cache->get_eviction_rate());
+  EXPECT_FLOAT_EQ(((kGlyphs - 2) * image_width + wide_width) * image_height /
+                      kArea,
+                  cache->get_fill_ratio());
+
+  // The rest of the row is still cached.
+  EXPECT_EQ(nullptr, cache->Find(0, image_height));
+  EXPECT_EQ(nullptr, cache->Find(1, image_height));
+  for (int32_t k = 2; k <= kGlyphs; ++k) {
+    EXPECT_NE(nullptr, cache->Find(k, image_height));
+  }
+  cache->Status();
+}
+
+// Test that the dirty rects of a page cover only the glyphs of each row.
+TEST_F(FontManagerTests, Glyph_Cache_DirtyRects) {
+  mathfu::vec2i cache_size = mathfu::vec2i(256, 256);
+  int32_t image_width = 31;
+  int32_t image_height = 31;
+
+  // Initialize Glyph cache
+  std::unique_ptr<fpl::GlyphCache<uint8_t>> cache(
+      new fpl::GlyphCache<uint8_t>(cache_size));
+  std::unique_ptr<uint8_t[]> image(new uint8_t[image_width * image_height]);
+
+  fpl::GlyphCacheEntry entry;
+  entry.set_size(mathfu::vec2i(image_width, image_height));
+
+  // Fill the top row, and put one glyph in the row below.
+  const int32_t glyphs_per_row =
+      cache_size.x() / (image_width + fpl::kGlyphCachePaddingX);
+  for (int32_t k = 0; k <= glyphs_per_row; ++k) {
+    entry.set_code_point(k);
+    ASSERT_NE(nullptr, cache->Set(image.get(), image_height, entry));
+  }
+  EXPECT_TRUE(cache->get_dirty_state(0));
+
+  auto &rects = cache->get_dirty_rects(0);
+  ASSERT_EQ(2u, rects.size());
+  const int32_t row_height = image_height + fpl::kGlyphCachePaddingY;
+  EXPECT_EQ(0, rects[0].x());
+  EXPECT_EQ(0, rects[0].y());
+  EXPECT_EQ(cache_size.x() - fpl::kGlyphCachePaddingX, rects[0].z());
+  EXPECT_EQ(image_height, rects[0].w());
+  EXPECT_EQ(0, rects[1].x());
+  EXPECT_EQ(row_height, rects[1].y());
+  EXPECT_EQ(image_width, rects[1].z());
+  EXPECT_EQ(row_height + image_height, rects[1].w());
+
+  // Uploading the page clears them.
+  cache->set_dirty_state(0, false);
+  EXPECT_TRUE(cache->get_dirty_rects(0).empty());
+}
+
+// Test hits, misses and LRU eviction of the string cache.
+TEST_F(FontManagerTests, Font_Cache_Eviction) {
+  const size_t kEntrySize = 100;
+  const char *kTexts[] = {"0", "1", "2", "3"};
+  fpl::FontCache<int> cache;
+  cache.set_memory_budget(kEntrySize * 3);
+
+  for (int i = 0; i < 4; ++i) {
+    auto key = fpl::FontCache<int>::Key(kTexts[i], 16, 0);
+    EXPECT_EQ(nullptr, cache.Find(key, kTexts[i]));
+    cache.Insert(key, kTexts[i], std::unique_ptr<int>(new int(i)), kEntrySize);
+  }
+
+  // All entries were used in this cycle, so nothing can be evicted yet.
+  EXPECT_EQ(4u, cache.size());
+  EXPECT_EQ(0u, cache.evictions());
+
+  // In the next cycle, the least recently used entry "0" is evicted.
+  cache.Update();
+  auto key0 = fpl::FontCache<int>::Key(kTexts[0], 16, 0);
+  auto key1 = fpl::FontCache<int>::Key(kTexts[1], 16, 0);
+  EXPECT_EQ(3u, cache.size());
+  EXPECT_EQ(1u, cache.evictions());
+  EXPECT_EQ(nullptr, cache.Find(key0, kTexts[0]));
+
+  // Inserting "0" again evicts "1".
+  cache.Insert(key0, kTexts[0], std::unique_ptr<int>(new int(0)), kEntrySize);
+  EXPECT_EQ(2u, cache.evictions());
+  EXPECT_EQ(nullptr, cache.Find(key1, kTexts[1]));
+  EXPECT_EQ(0, *cache.Find(key0, kTexts[0]));
+  EXPECT_EQ(kEntrySize * 3, cache.memory());
+
+  // Same text in a different size or font is a different entry.
+  EXPECT_NE(key0, fpl::FontCache<int>::Key(kTexts[0], 17, 0));
+  EXPECT_NE(key0, fpl::FontCache<int>::Key(kTexts[0], 16, 1));
+
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_EQ(6u, cache.misses());
+  cache.Status("Font cache");
+}
+
+// Test how strings the text thread creates in async mode are tracked: a
+// failure is reported once, so the caller can flush the glyph cache, and the
+// string can then be queued again.
+TEST_F(FontManagerTests, Text_Job_Tracker) {
+  fpl::TextJobTracker tracker;
+  const uint64_t key = fpl::FontCache<int>::Key("text", 32, 0);
+  const uint64_t other_key = fpl::FontCache<int>::Key("other", 32, 0);
+
+  // A string is only queued once while the text thread works on it.
+  EXPECT_TRUE(tracker.Queue(key));
+  EXPECT_FALSE(tracker.Queue(key));
+  EXPECT_TRUE(tracker.pending(key));
+  EXPECT_FALSE(tracker.pending(other_key));
+
+  // A finished string is neither pending nor failed.
+  tracker.Finish(key);
+  EXPECT_FALSE(tracker.pending(key));
+  EXPECT_FALSE(tracker.TakeFailure(key));
+
+  // A failed string is reported once, then it can be queued again.
+  EXPECT_TRUE(tracker.Queue(key));
+  tracker.Fail(key);
+  EXPECT_FALSE(tracker.pending(key));
+  EXPECT_FALSE(tracker.TakeFailure(other_key));
+  EXPECT_TRUE(tracker.TakeFailure(key));
+  EXPECT_FALSE(tracker.TakeFailure(key));
+  EXPECT_TRUE(tracker.Queue(key));
+
+  // Clearing failures keeps pending strings.
+  EXPECT_TRUE(tracker.Queue(other_key));
+  tracker.Fail(key);
+  tracker.ClearFailures();
+  EXPECT_FALSE(tracker.TakeFailure(key));
+  EXPECT_TRUE(tracker.pending(other_key));
+
+  // Clearing forgets about everything.
+  tracker.Fail(key);
+  tracker.Clear();
+  EXPECT_FALSE(tracker.pending(other_key));
+  EXPECT_FALSE(tracker.TakeFailure(key));
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,187 @@
+/*
+* Copyright (c) 2014 Google, Inc.
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+#include "flatbuffers/util.h"
+#include "gtest/gtest.h"
+#include "pixel_conversion.h"
+#include "webp/decode.h"
+
+// Directory with the textures to benchmark against. The built assets by
+// default, or the first command line argument.
+static std::string g_texture_dir = "../assets/textures";
+
+// The conversions the SIMD kernels have to reproduce exactly.
+static uint16_t Reference8888To5551(const uint8_t *c) {
+  return ((c[0] >> 3) << 11) | ((c[1] >> 3) << 6) | ((c[2] >> 3) << 1) |
+         ((c[3] >> 7) << 0);
+}
+
+static uint16_t Reference888To565(const uint8_t *c) {
+  return ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | ((c[2] >> 3) << 0);
+}
+
+static std::vector<uint8_t> RandomPixels(int count, int bytes_per_pixel) {
+  std::vector<uint8_t> pixels(count * bytes_per_pixel);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    pixels[i] = static_cast<uint8_t>(rand());
+  }
+  return pixels;
+}
+
+class PixelConversionTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() { srand(1); }
+  virtual void TearDown() {}
+};
+
+// Pixel counts that aren't a multiple of any vector width exercise the scalar
+// tail loops as well.
+TEST_F(PixelConversionTests, Convert8888To5551MatchesReference) {
+  for (int count = 1; count < 100; count++) {
+    const std::vector<uint8_t> pixels = RandomPixels(count, 4);
+    std::vector<uint16_t> converted(count);
+    fpl::Convert8888To5551(&pixels[0], count, &converted[0]);
+    for (int i = 0; i < count; i++) {
+      EXPECT_EQ(Reference8888To5551(&pixels[i * 4]), converted[i]);
+    }
+  }
+}
+
+TEST_F(PixelConversionTests, Convert888To565MatchesReference) {
+  for (int count = 1; count < 100; count++) {
+    const std::vector<uint8_t> pixels = RandomPixels(count, 3);
+    std::vector<uint16_t> converted(count);
+    fpl::Convert888To565(&pixels[0], count, &converted[0]);
+    for (int i = 0; i < count; i++) {
+      EXPECT_EQ(Reference888To565(&pixels[i * 3]), converted[i]);
+    }
+  }
+}
+
+TEST_F(PixelConversionTests, ConvertInPlace) {
+  for (int count = 1; count < 100; count++) {
+    const std::vector<uint8_t> rgba = RandomPixels(count, 4);
+    std::vector<uint8_t> buffer(rgba);
+    fpl::Convert8888To5551(&buffer[0], count,
+                           reinterpret_cast<uint16_t *>(&buffer[0]));
+    const uint16_t *converted = reinterpret_cast<uint16_t *>(&buffer[0]);
+    for (int i = 0; i < count; i++) {
+      EXPECT_EQ(Reference8888To5551(&rgba[i * 4]), converted[i]);
+    }
+
+    const std::vector<uint8_t> rgb = RandomPixels(count, 3);
+    buffer = rgb;
+    fpl::Convert888To565(&buffer[0], count,
+                         reinterpret_cast<uint16_t *>(&buffer[0]));
+    converted = reinterpret_cast<uint16_t *>(&buffer[0]);
+    for (int i = 0; i < count; i++) {
+      EXPECT_EQ(Reference888To565(&rgb[i * 3]), converted[i]);
+    }
+  }
+}
+
+// Not a correctness test: times the conversions against the scalar reference
+// over the game's own textures, and prints the results.
+TEST_F(PixelConversionTests, BenchmarkGameTextures) {
+#ifdef _WIN32
+  printf("Benchmark not supported on this platform.\n");
+#else
+  DIR *dir = opendir(g_texture_dir.c_str());
+  if (!dir) {
+    printf("No textures found in %s, build assets first.\n",
+           g_texture_dir.c_str());
+    return;
+  }
+  typedef std::chrono::high_resolution_clock Clock;
+  Clock::duration reference_time = Clock::duration::zero();
+  Clock::duration kernel_time = Clock::duration::zero();
+  int textures = 0;
+  int64_t pixels = 0;
+  while (dirent *entry = readdir(dir)) {
+    const std::string name = entry->d_name;
+    if (name.size() < 5 || name.substr(name.size() - 5) != ".webp") continue;
+    std::string file;
+    if (!flatbuffers::LoadFile((g_texture_dir + "/" + name).c_str(), true,
+                               &file)) {
+      continue;
+    }
+    const uint8_t *webp = reinterpret_cast<const uint8_t *>(file.c_str());
+    WebPBitstreamFeatures features;
+    if (WebPGetFeatures(webp, file.size(), &features) != VP8_STATUS_OK) {
+      continue;
+    }
+    int width = 0, height = 0;
+    uint8_t *decoded =
+        features.has_alpha ? WebPDecodeRGBA(webp, file.size(), &width, &height)
+                           : WebPDecodeRGB(webp, file.size(), &width, &height);
+    if (!decoded) continue;
+    const int count = width * height;
+    std::vector<uint16_t> converted(count);
+
+    // Time the reference implementation, as the loader used to run it.
+    auto start = Clock::now();
+    for (int i = 0; i < count; i++) {
+      converted[i] = features.has_alpha ? Reference8888To5551(&decoded[i * 4])
+                                        : Reference888To565(&decoded[i * 3]);
+    }
+    reference_time += Clock::now() - start;
+    const std::vector<uint16_t> expected(converted);
+
+    // Time the kernel, in place, as the loader runs it now.
+    start = Clock::now();
+    uint16_t *in_place = reinterpret_cast<uint16_t *>(decoded);
+    if (features.has_alpha) {
+      fpl::Convert8888To5551(decoded, count, in_place);
+    } else {
+      fpl::Convert888To565(decoded, count, in_place);
+    }
+    kernel_time += Clock::now() - start;
+    EXPECT_EQ(0, memcmp(&expected[0], in_place, count * sizeof(uint16_t)))
+        << name;
+
+    free(decoded);
+    textures++;
+    pixels += count;
+  }
+  closedir(dir);
+
+  typedef std::chrono::duration<double, std::milli> Milliseconds;
+  printf("Converted %d textures, %lld pixels.\n", textures,
+         static_cast<long long>(pixels));
+  printf("  reference: %.2fms\n",
+         std::chrono::duration_cast<Milliseconds>(reference_time).count());
+  printf("  kernel:    %.2fms\n",
+         std::chrono::duration_cast<Milliseconds>(kernel_time).count());
+#endif  // _WIN32
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (argc > 1) g_texture_dir = argv[1];
+  return RUN_ALL_TESTS();
+}